@@ -0,0 +1,235 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include "blockstore.h"
+#include "bufpool.h"
+#include "spill.h"
+
+static struct {
+	struct blockstore_block **slot;	/* NULL for an empty one */
+	size_t size;
+	size_t count;
+	uint64_t held;		/* Room of the live blocks buffers */
+	uint64_t spilled;	/* Bytes of the live blocks in the spill file */
+	uint64_t unique;	/* Bytes of the live blocks */
+	uint64_t referenced;	/* Bytes of all their references */
+	uint64_t lookups;
+	uint64_t candidates;	/* Lookups finding a block of that fingerprint */
+	uint64_t hits;		/* Candidates holding the same bytes */
+} store;
+
+/*
+ * Memory taken by the block buffer
+ */
+static inline size_t block_room(const struct blockstore_block *block)
+{
+	return bufpool_room(blockstore_stored(block));
+}
+
+static struct blockstore_block **index_find(const struct fingerprint *fp, const size_t size)
+{
+	size_t pos = fp->h1 & (store.size - 1);
+
+	while (store.slot[pos] != NULL) {
+		const struct blockstore_block *block = store.slot[pos];
+
+		if (block->size == size && fingerprint_equal(&block->fingerprint, fp))
+			break;
+		pos = (pos + 1) & (store.size - 1);
+	}
+
+	return &store.slot[pos];
+}
+
+static int index_grow(void)
+{
+	struct blockstore_block **old = store.slot;
+	const size_t old_size = store.size;
+	const size_t size = old_size != 0 ? 2 * old_size : BLOCKSTORE_INDEX_MIN;
+
+	store.slot = calloc(size, sizeof store.slot[0]);
+	if (store.slot == NULL) {
+		fprintf(stderr, "Failed to allocate a %zd slots block index\n", size);
+		store.slot = old;
+		return -1;
+	}
+	store.size = size;
+
+	for (size_t i = 0 ; i < old_size ; i ++) {
+		if (old[i] != NULL)
+			*index_find(&old[i]->fingerprint, old[i]->size) = old[i];
+	}
+
+	free(old);
+	return 0;
+}
+
+/*
+ * Backward shift deletion, the index stays free of tombstones
+ */
+static void index_remove(struct blockstore_block **slot)
+{
+	size_t hole = slot - store.slot;
+	size_t pos = hole;
+
+	for (;;) {
+		size_t home;
+
+		pos = (pos + 1) & (store.size - 1);
+		if (store.slot[pos] == NULL)
+			break;
+
+		home = store.slot[pos]->fingerprint.h1 & (store.size - 1);
+		if (((pos - home) & (store.size - 1)) >= ((pos - hole) & (store.size - 1))) {
+			store.slot[hole] = store.slot[pos];
+			hole = pos;
+		}
+	}
+
+	store.slot[hole] = NULL;
+}
+
+struct blockstore_block *blockstore_find(const struct fingerprint *fp, const size_t size)
+{
+	struct blockstore_block *block;
+
+	store.lookups ++;
+	if (store.count == 0)
+		return NULL;
+
+	block = *index_find(fp, size);
+	if (block != NULL)
+		store.candidates ++;
+	return block;
+}
+
+void blockstore_take(struct blockstore_block *block)
+{
+	block->refs ++;
+	store.referenced += block->size;
+	store.hits ++;
+}
+
+struct blockstore_block *blockstore_add(const struct fingerprint *fp, uint8_t *buffer, const size_t size, const size_t compressed)
+{
+	struct blockstore_block *block;
+
+	if ((store.count + 1) * 4 > store.size * 3 && index_grow() < 0)
+		goto err;
+
+	block = bufpool_alloc(sizeof block[0]);
+	if (block == NULL) {
+		fprintf(stderr, "Failed to allocate blockstore_block\n");
+		goto err;
+	}
+
+	block->fingerprint = *fp;
+	block->buffer = buffer;
+	block->spill_offset = 0;
+	block->size = size;
+	block->compressed = compressed;
+	block->refs = 1;
+
+	*index_find(fp, size) = block;
+	store.count ++;
+	store.held += block_room(block);
+	store.unique += size;
+	store.referenced += size;
+	return block;
+
+err:
+	return NULL;
+}
+
+void blockstore_release(struct blockstore_block *block)
+{
+	store.referenced -= block->size;
+	if (-- block->refs > 0)
+		return;
+
+	index_remove(index_find(&block->fingerprint, block->size));
+	store.count --;
+	store.unique -= block->size;
+
+	if (block->buffer != NULL) {
+		store.held -= block_room(block);
+		bufpool_free(block->buffer);
+	} else {
+		store.spilled -= blockstore_stored(block);
+		spill_release(block->spill_offset, blockstore_stored(block));
+	}
+	bufpool_free(block);
+}
+
+const uint8_t *blockstore_data(const struct blockstore_block *block)
+{
+	if (block->buffer != NULL)
+		return block->buffer;
+	return spill_data(block->spill_offset, blockstore_stored(block));
+}
+
+/*
+ * The chunks sharing the block read it from the spill file from now on
+ */
+int blockstore_spill(struct blockstore_block *block)
+{
+	const size_t stored = blockstore_stored(block);
+
+	if (block->buffer == NULL)
+		return 0;
+
+	if (spill_write(block->buffer, stored, &block->spill_offset) < 0)
+		return -1;
+
+	bufpool_free(block->buffer);
+	block->buffer = NULL;
+	store.held -= block_room(block);
+	store.spilled += stored;
+	return 0;
+}
+
+/*
+ * Last resort once no session has bytes of its own left to spill
+ */
+int blockstore_spill_all(void)
+{
+	for (size_t i = 0 ; i < store.size ; i ++) {
+		if (store.slot[i] != NULL && blockstore_spill(store.slot[i]) < 0)
+			return -1;
+	}
+
+	return 0;
+}
+
+size_t blockstore_held(void)
+{
+	return store.held;
+}
+
+size_t blockstore_spilled(void)
+{
+	return store.spilled;
+}
+
+/*
+ * Once every chunk is gone, blocks are too
+ */
+void blockstore_free(void)
+{
+	free(store.slot);
+	memset(&store, 0, sizeof store);
+}
+
+int blockstore_dump(FILE *file, const int depth)
+{
+	int done = 0;
+
+	done += fprintf(file, "%*sBlocks %zd, holding %" PRIu64 "b, spilled %" PRIu64 "b for %" PRIu64 "b unique and %" PRIu64 "b referenced", depth, "", store.count, store.held, store.spilled, store.unique, store.referenced);
+	if (store.unique > 0)
+		done += fprintf(file, ", ratio %.2f", (double)store.referenced / store.unique);
+	done += fprintf(file, "\n");
+	done += fprintf(file, "%*sLookups %" PRIu64 ", found %" PRIu64 ", %" PRIu64 " fingerprint collision(s)\n", depth, "", store.lookups, store.hits, store.candidates - store.hits);
+	return done;
+}
@@ -0,0 +1,62 @@
+#ifndef __blockstore_h_666__
+# define __blockstore_h_666__
+
+# include <stdio.h>
+# include <stdint.h>
+# include <stddef.h>
+# include "fingerprint.h"
+
+/*
+ * Content-addressed store of sealed stream chunks, shared by all the
+ * sessions : chunks holding the same bytes share one buffer, found by its
+ * fingerprint. Fingerprints only find the candidate, its bytes are compared
+ * before it is shared.
+ *
+ * Blocks are refcounted, their buffer goes back to the buffer pool with the
+ * last reference. Their bytes are accounted here rather than to any of the
+ * chunks sharing them, and leave memory once spilled, for all of them.
+ * The index is an open addressing table of block pointers, doubled when
+ * 3/4 full.
+ */
+# define BLOCKSTORE_INDEX_MIN 1024	/* A power of 2 */
+
+struct blockstore_block {
+	struct fingerprint fingerprint;
+	uint8_t *buffer;	/* NULL once spilled */
+	uint64_t spill_offset;
+	uint32_t size;		/* Bytes of the chunk */
+	uint32_t compressed;	/* Bytes held in buffer when compressed, 0 while raw */
+	uint32_t refs;
+};
+
+/*
+ * Candidate block for these bytes, NULL if none. No reference is taken
+ * until its bytes are found to be the same.
+ */
+struct blockstore_block *blockstore_find(const struct fingerprint *fp, const size_t size);
+void blockstore_take(struct blockstore_block *block);
+
+/*
+ * The block takes the buffer, with a first reference
+ */
+struct blockstore_block *blockstore_add(const struct fingerprint *fp, uint8_t *buffer, const size_t size, const size_t compressed);
+void blockstore_release(struct blockstore_block *block);
+void blockstore_free(void);
+
+/*
+ * Bytes held by the block, compressed or not, in memory or spilled
+ */
+const uint8_t *blockstore_data(const struct blockstore_block *block);
+int blockstore_spill(struct blockstore_block *block);
+int blockstore_spill_all(void);
+size_t blockstore_held(void);
+size_t blockstore_spilled(void);
+
+static inline size_t blockstore_stored(const struct blockstore_block *block)
+{
+	return block->compressed != 0 ? block->compressed : block->size;
+}
+
+int blockstore_dump(FILE *file, const int depth);
+
+#endif
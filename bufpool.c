@@ -0,0 +1,328 @@
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+
+#include "bufpool.h"
+#include "pagemem.h"
+
+/*
+ * Classes are sized after usual payloads : ACKs and small requests, MTU
+ * sized segments, and up to TSO super-frames. Stream chunks then grow by
+ * 1.5x steps up to 4MB : their buffers are reused like any other, instead of
+ * faulting fresh pages in after every spill.
+ */
+static const uint32_t class_size[] = {
+	64, 128, 256, 512, 1024, 1536, 2048, 3072, 4096, 6144, 8192, 12288, 16384, 24576, 32768, 49152, 65536,
+	98304, 131072, 196608, 262144, 393216, 524288, 786432, 1048576, 1572864, 2097152, 3145728, 4194304,
+};
+
+#define CLASS_COUNT (sizeof class_size / sizeof class_size[0])
+#define CLASS_LARGE UINT16_MAX
+#define SIZE_FREE UINT32_MAX
+
+struct bufpool_hdr {
+	uint16_t class;
+	uint16_t reserved;
+	uint32_t size;		/* Requested size, SIZE_FREE while the buffer is free */
+	uint64_t pad;		/* Keeps buffers 16-byte aligned */
+};
+
+struct bufpool_free_node {
+	struct bufpool_free_node *next;
+};
+
+struct bufpool_list {
+	struct bufpool_free_node *first;
+	size_t count;
+};
+
+struct bufpool_slab {
+	uint8_t *data;
+	uint16_t class;
+	uint32_t objects;
+};
+
+static struct {
+	pthread_mutex_t lock;
+	int pagemem_flags;
+	struct bufpool_list depot[CLASS_COUNT];
+	struct bufpool_slab *slab;
+	size_t slab_count;
+	size_t slab_max;
+	size_t large_count;
+	size_t large_size;
+} pool = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+};
+
+static __thread struct bufpool_list cache[CLASS_COUNT];
+
+static inline size_t object_size(const size_t class)
+{
+	return sizeof(struct bufpool_hdr) + class_size[class];
+}
+
+/*
+ * Slabs of the largest classes hold a single buffer
+ */
+static inline size_t slab_size(const size_t class)
+{
+	const size_t size = object_size(class);
+
+	if (size * 8 <= BUFPOOL_SLAB_SIZE)
+		return BUFPOOL_SLAB_SIZE;
+	return (size + BUFPOOL_PAGE_SIZE - 1) / BUFPOOL_PAGE_SIZE * BUFPOOL_PAGE_SIZE;
+}
+
+static inline size_t get_class(const size_t size)
+{
+	size_t class;
+
+	for (class = 0 ; class < CLASS_COUNT ; class ++) {
+		if (size <= class_size[class])
+			break;
+	}
+	return class;
+}
+
+void bufpool_set_flags(const int pagemem_flags)
+{
+	pool.pagemem_flags = pagemem_flags;
+}
+
+static inline void list_push(struct bufpool_list *list, struct bufpool_hdr *hdr)
+{
+	struct bufpool_free_node *node = (struct bufpool_free_node *)(hdr + 1);
+
+	hdr->size = SIZE_FREE;
+	node->next = list->first;
+	list->first = node;
+	list->count ++;
+}
+
+static inline struct bufpool_hdr *list_pop(struct bufpool_list *list)
+{
+	struct bufpool_free_node *node = list->first;
+
+	list->first = node->next;
+	list->count --;
+	return (struct bufpool_hdr *)node - 1;
+}
+
+/*
+ * Called with the pool lock held
+ */
+static int slab_new(const size_t class)
+{
+	struct bufpool_slab *slab;
+	const size_t size = object_size(class);
+
+	if (pool.slab_count >= pool.slab_max) {
+		const size_t max = pool.slab_max > 0 ? pool.slab_max * 2 : 64;
+
+		slab = realloc(pool.slab, max * sizeof slab[0]);
+		if (slab == NULL) {
+			fprintf(stderr, "Failed to extend bufpool slab table : %s\n", strerror(errno));
+			goto err;
+		}
+		pool.slab = slab;
+		pool.slab_max = max;
+	}
+
+	slab = &pool.slab[pool.slab_count];
+	slab->data = pagemem_map(slab_size(class), pool.pagemem_flags);
+	if (slab->data == NULL)
+		goto err;
+	slab->class = class;
+	slab->objects = slab_size(class) / size;
+	pool.slab_count ++;
+
+	for (size_t i = slab->objects ; i > 0 ; i --) {
+		struct bufpool_hdr *hdr = (struct bufpool_hdr *)(slab->data + (i - 1) * size);
+
+		hdr->class = class;
+		list_push(&pool.depot[class], hdr);
+	}
+	return 0;
+
+err:
+	return -1;
+}
+
+static int cache_refill(const size_t class)
+{
+	int ret = -1;
+
+	pthread_mutex_lock(&pool.lock);
+
+	if (pool.depot[class].count == 0 && slab_new(class) < 0)
+		goto unlock;
+
+	while (pool.depot[class].count > 0 && cache[class].count < BUFPOOL_BATCH)
+		list_push(&cache[class], list_pop(&pool.depot[class]));
+	ret = 0;
+
+unlock:
+	pthread_mutex_unlock(&pool.lock);
+	return ret;
+}
+
+static void cache_drain(const size_t class, const size_t keep)
+{
+	pthread_mutex_lock(&pool.lock);
+	while (cache[class].count > keep)
+		list_push(&pool.depot[class], list_pop(&cache[class]));
+	pthread_mutex_unlock(&pool.lock);
+}
+
+/*
+ * Bytes actually reserved for a buffer of size bytes
+ */
+size_t bufpool_room(const size_t size)
+{
+	const size_t class = get_class(size);
+
+	return class < CLASS_COUNT ? class_size[class] : size;
+}
+
+void *bufpool_alloc(const size_t size)
+{
+	struct bufpool_hdr *hdr;
+	const size_t class = get_class(size);
+
+	if (class >= CLASS_COUNT) {
+		hdr = malloc(sizeof hdr[0] + size);
+		if (hdr == NULL)
+			goto err;
+		hdr->class = CLASS_LARGE;
+		pthread_mutex_lock(&pool.lock);
+		pool.large_count ++;
+		pool.large_size += size;
+		pthread_mutex_unlock(&pool.lock);
+	} else {
+		if (cache[class].count == 0 && cache_refill(class) < 0)
+			goto err;
+		hdr = list_pop(&cache[class]);
+	}
+
+	hdr->size = size;
+	return hdr + 1;
+
+err:
+	errno = ENOMEM;
+	return NULL;
+}
+
+/*
+ * Size ptr was allocated with
+ */
+size_t bufpool_size(const void *ptr)
+{
+	return ((const struct bufpool_hdr *)ptr - 1)->size;
+}
+
+void bufpool_free(void *ptr)
+{
+	struct bufpool_hdr *hdr;
+
+	if (ptr == NULL)
+		return;
+
+	hdr = (struct bufpool_hdr *)ptr - 1;
+	if (hdr->size == SIZE_FREE)
+		abort(); /* Double free */
+
+	if (hdr->class == CLASS_LARGE) {
+		pthread_mutex_lock(&pool.lock);
+		pool.large_count --;
+		pool.large_size -= hdr->size;
+		pthread_mutex_unlock(&pool.lock);
+		free(hdr);
+		return;
+	}
+
+	list_push(&cache[hdr->class], hdr);
+	if (cache[hdr->class].count >= 2 * BUFPOOL_BATCH)
+		cache_drain(hdr->class, BUFPOOL_BATCH);
+}
+
+void bufpool_thread_flush(void)
+{
+	for (size_t class = 0 ; class < CLASS_COUNT ; class ++)
+		cache_drain(class, 0);
+}
+
+void bufpool_destroy(void)
+{
+	pthread_mutex_lock(&pool.lock);
+	for (size_t i = 0 ; i < pool.slab_count ; i ++)
+		pagemem_unmap(pool.slab[i].data, slab_size(pool.slab[i].class));
+	free(pool.slab);
+	pool.slab = NULL;
+	pool.slab_count = 0;
+	pool.slab_max = 0;
+	memset(pool.depot, 0, sizeof pool.depot);
+	memset(cache, 0, sizeof cache);
+	pthread_mutex_unlock(&pool.lock);
+}
+
+int bufpool_dump(FILE *file, const int depth)
+{
+	int done = 0;
+	size_t total_mapped = 0;
+	size_t total_used = 0;
+	size_t total_requested = 0;
+
+	pthread_mutex_lock(&pool.lock);
+
+	done += fprintf(file, "%*s%-8s %8s %12s %12s %10s %10s\n", depth, "", "class", "slabs", "objects", "in use", "occupancy", "frag");
+
+	for (size_t class = 0 ; class < CLASS_COUNT ; class ++) {
+		size_t slabs = 0;
+		size_t objects = 0;
+		size_t used = 0;
+		size_t requested = 0;
+
+		/*
+		 * Walking the slabs costs nothing on the alloc / free paths, and
+		 * sees the buffers cached by every thread
+		 */
+		for (size_t i = 0 ; i < pool.slab_count ; i ++) {
+			const struct bufpool_slab *slab = &pool.slab[i];
+
+			if (slab->class != class)
+				continue;
+
+			slabs ++;
+			objects += slab->objects;
+			for (size_t obj = 0 ; obj < slab->objects ; obj ++) {
+				const struct bufpool_hdr *hdr = (const struct bufpool_hdr *)(slab->data + obj * object_size(class));
+
+				if (hdr->size == SIZE_FREE)
+					continue;
+				used ++;
+				requested += hdr->size;
+			}
+		}
+
+		if (slabs == 0)
+			continue;
+
+		total_mapped += slabs * slab_size(class);
+		total_used += used * class_size[class];
+		total_requested += requested;
+
+		done += fprintf(file, "%*s%-8u %8zd %12zd %12zd %9.1f%% %9.1f%%\n", depth, "", class_size[class], slabs, objects, used,
+				100.0 * used / objects, used > 0 ? 100.0 - 100.0 * requested / (used * class_size[class]) : 0.0);
+	}
+
+	done += fprintf(file, "%*sLarge buffers : %zd (%zdb)\n", depth, "", pool.large_count, pool.large_size);
+	done += fprintf(file, "%*sMapped %zdb, in use %zdb, requested %zdb\n", depth, "", total_mapped, total_used, total_requested);
+
+	pthread_mutex_unlock(&pool.lock);
+	return done;
+}
@@ -0,0 +1,28 @@
+
+#ifndef __bufpool_h_666__
+# define __bufpool_h_666__
+
+# include <stdio.h>
+# include <stddef.h>
+
+/*
+ * Size-class allocator for frame payloads and stream buffers.
+ *
+ * Every thread keeps a small cache of free buffers per class, and only goes
+ * to the shared depot (under a lock) to exchange a batch of them.
+ */
+# define BUFPOOL_SLAB_SIZE (2 * 1024 * 1024)
+# define BUFPOOL_PAGE_SIZE 4096
+# define BUFPOOL_BATCH 32
+
+void bufpool_set_flags(const int pagemem_flags);
+size_t bufpool_room(const size_t size);
+void *bufpool_alloc(const size_t size);
+void bufpool_free(void *ptr);
+size_t bufpool_size(const void *ptr);
+void bufpool_thread_flush(void);
+void bufpool_destroy(void);
+
+int bufpool_dump(FILE *file, const int depth);
+
+#endif
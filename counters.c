@@ -0,0 +1,166 @@
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <inttypes.h>
+#include <time.h>
+
+#include "counters.h"
+#include "rawprint.h"
+
+static const char *counter_name[counter_max] = {
+	[counter_pcap_truncated] = "pcap : packet not fully captured",
+	[counter_eth_short] = "eth : truncated header",
+	[counter_eth_type] = "eth : unexpected type",
+	[counter_sll_short] = "sll : truncated header",
+	[counter_sll_hatype] = "sll : unexpected hatype",
+	[counter_sll_halen] = "sll : unexpected halen",
+	[counter_sll_pkttype] = "sll : unexpected pkttype",
+	[counter_sll_protocol] = "sll : unexpected protocol",
+	[counter_arp_invalid] = "arp : invalid header",
+	[counter_ip_short] = "ip : truncated header",
+	[counter_ip_ihl] = "ip : invalid ihl",
+	[counter_ip_tot_len] = "ip : invalid tot_len",
+	[counter_ip_protocol] = "ip : unexpected protocol",
+	[counter_ipv6_short] = "ipv6 : truncated header",
+	[counter_ipv6_plen] = "ipv6 : invalid payload length",
+	[counter_ipv6_ext] = "ipv6 : invalid extension header",
+	[counter_ipv6_fragment] = "ipv6 : fragment",
+	[counter_ipv6_next_header] = "ipv6 : unexpected next header",
+	[counter_tcp_short] = "tcp : truncated header",
+	[counter_tcp_doff] = "tcp : invalid header size",
+	[counter_udp_short] = "udp : truncated header",
+	[counter_udp_len] = "udp : invalid length",
+	[counter_reorder_late] = "reorder : frame older than the window",
+	[counter_tcp_port] = "tcp : invalid port",
+	[counter_tcp_side] = "tcp : unexpected source / dest",
+	[counter_tcp_cnx_flags] = "tcp : unexpected flags in cnx stage",
+	[counter_tcp_syn_ack] = "tcp : invalid SYN ACK",
+	[counter_tcp_ack] = "tcp : invalid ACK",
+	[counter_tcp_data] = "tcp : data not saved",
+};
+
+static struct {
+	uint64_t count;
+	uint64_t suppressed;
+	unsigned int tokens;
+	time_t last_refill;
+} counter_table[counter_max];
+
+static struct {
+	struct counter_ring_entry entry[COUNTERS_RING_SIZE];
+	uint64_t count;
+} counter_ring;
+
+static struct {
+	struct timeval ts;
+	const void *data;
+	uint32_t len;
+} counter_packet;
+
+void counters_set_packet(const struct timeval *ts, const void *data, const uint32_t len)
+{
+	counter_packet.ts = *ts;
+	counter_packet.data = data;
+	counter_packet.len = len;
+}
+
+static void ring_add(const enum counter_id id)
+{
+	struct counter_ring_entry *entry = &counter_ring.entry[counter_ring.count % COUNTERS_RING_SIZE];
+
+	entry->id = id;
+	entry->ts = counter_packet.ts;
+	entry->len = counter_packet.len;
+	entry->caplen = counter_packet.len < sizeof entry->data ? counter_packet.len : sizeof entry->data;
+	if (entry->caplen > 0)
+		memcpy(entry->data, counter_packet.data, entry->caplen);
+	counter_ring.count ++;
+}
+
+static int log_allowed(const enum counter_id id)
+{
+	struct timespec now;
+
+	/*
+	 * Token bucket : COUNTERS_LOG_BURST tokens at start, one more per second
+	 */
+	clock_gettime(CLOCK_MONOTONIC_COARSE, &now);
+
+	if (counter_table[id].count == 1) {
+		counter_table[id].tokens = COUNTERS_LOG_BURST;
+		counter_table[id].last_refill = now.tv_sec;
+	} else if (now.tv_sec != counter_table[id].last_refill) {
+		if (counter_table[id].tokens < COUNTERS_LOG_BURST)
+			counter_table[id].tokens ++;
+		counter_table[id].last_refill = now.tv_sec;
+	}
+
+	if (counter_table[id].tokens == 0) {
+		counter_table[id].suppressed ++;
+		return 0;
+	}
+
+	counter_table[id].tokens --;
+	return 1;
+}
+
+void counters_error(const enum counter_id id, const char *fmt, ...)
+{
+	va_list ap;
+
+	counter_table[id].count ++;
+	ring_add(id);
+
+	if (!log_allowed(id))
+		return;
+
+	if (counter_table[id].suppressed > 0) {
+		fprintf(stderr, "(%" PRIu64 " similar messages suppressed)\n", counter_table[id].suppressed);
+		counter_table[id].suppressed = 0;
+	}
+
+	va_start(ap, fmt);
+	vfprintf(stderr, fmt, ap);
+	va_end(ap);
+}
+
+uint64_t counters_total(void)
+{
+	uint64_t total = 0;
+
+	for (size_t id = 0 ; id < counter_max ; id ++)
+		total += counter_table[id].count;
+
+	return total;
+}
+
+int counters_dump(FILE *file, const int depth)
+{
+	int done = 0;
+
+	for (size_t id = 0 ; id < counter_max ; id ++) {
+		if (counter_table[id].count == 0)
+			continue;
+		done += fprintf(file, "%*s%-40s %" PRIu64 "\n", depth, "", counter_name[id], counter_table[id].count);
+	}
+
+	return done;
+}
+
+int counters_ring_dump(FILE *file, const int depth)
+{
+	int done = 0;
+	uint64_t idx;
+
+	idx = counter_ring.count > COUNTERS_RING_SIZE ? counter_ring.count - COUNTERS_RING_SIZE : 0;
+	for ( ; idx < counter_ring.count ; idx ++) {
+		const struct counter_ring_entry *entry = &counter_ring.entry[idx % COUNTERS_RING_SIZE];
+
+		done += fprintf(file, "%*s[%lds, %ldus] %s (%ub)\n", depth, "", entry->ts.tv_sec, entry->ts.tv_usec, counter_name[entry->id], entry->len);
+		if (entry->caplen > 0)
+			done += rawprint(file, depth + 1, entry->data, entry->caplen, 8, 4);
+	}
+
+	return done;
+}
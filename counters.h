@@ -0,0 +1,70 @@
+
+#ifndef __counters_h_666__
+# define __counters_h_666__
+
+# include <stdio.h>
+# include <stdint.h>
+# include <sys/time.h>
+
+/*
+ * Number of offending frames kept for inspection, and how many bytes of
+ * each one are kept
+ */
+# define COUNTERS_RING_SIZE 64
+# define COUNTERS_RING_SNAPLEN 128
+
+/*
+ * Rate limiter for the error logger : every reason may log a burst of
+ * messages, then one message per second
+ */
+# define COUNTERS_LOG_BURST 10
+
+enum counter_id {
+	counter_pcap_truncated,
+	counter_eth_short,
+	counter_eth_type,
+	counter_sll_short,
+	counter_sll_hatype,
+	counter_sll_halen,
+	counter_sll_pkttype,
+	counter_sll_protocol,
+	counter_arp_invalid,
+	counter_ip_short,
+	counter_ip_ihl,
+	counter_ip_tot_len,
+	counter_ip_protocol,
+	counter_ipv6_short,
+	counter_ipv6_plen,
+	counter_ipv6_ext,
+	counter_ipv6_fragment,
+	counter_ipv6_next_header,
+	counter_tcp_short,
+	counter_tcp_doff,
+	counter_udp_short,
+	counter_udp_len,
+	counter_reorder_late,
+	counter_tcp_port,
+	counter_tcp_side,
+	counter_tcp_cnx_flags,
+	counter_tcp_syn_ack,
+	counter_tcp_ack,
+	counter_tcp_data,
+	counter_max,
+};
+
+struct counter_ring_entry {
+	enum counter_id id;
+	struct timeval ts;
+	uint32_t len;
+	uint32_t caplen;
+	uint8_t data[COUNTERS_RING_SNAPLEN];
+};
+
+void counters_set_packet(const struct timeval *ts, const void *data, const uint32_t len);
+void counters_error(const enum counter_id id, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+uint64_t counters_total(void);
+
+int counters_dump(FILE *file, const int depth);
+int counters_ring_dump(FILE *file, const int depth);
+
+#endif
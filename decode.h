@@ -5,6 +5,10 @@
 # include <stdint.h>
 # include "frame.h"
 
+/*
+ * private is the struct frame_cold receiving what only printing needs, it
+ * may be NULL
+ */
 typedef int (*decode_fun_t)(struct frame *frame, const int depth, const void *data, const uint32_t len, void *private);
 decode_fun_t decode_get(const char *from, const int type);
 
@@ -6,63 +6,68 @@
 #include <arpa/inet.h>
 
 #include "decode_arp.h"
+#include "counters.h"
 
 int decode_arp(struct frame *frame, const int depth, const void *data, const uint32_t len, void *private)
 {
 	const struct ether_arp *hdr = data;
+	struct frame_cold *cold = private;
 	int ret = -1;
-	(void)private;
 	(void)depth;
 
 	if (len < sizeof hdr[0]) {
-		fprintf(stderr, "Invalid ARP pload size : %d (%zd at least)\n", len, sizeof hdr[0]);
+		counters_error(counter_arp_invalid, "Invalid ARP pload size : %d (%zd at least)\n", len, sizeof hdr[0]);
 		goto err;
 	}
 
 	if (htons(hdr->arp_hrd) != ARPHRD_ETHER) {
-		fprintf(stderr, "Unexpected ARP hw address format : %d (%d expected)\n", htons(hdr->arp_hrd), ARPHRD_ETHER);
+		counters_error(counter_arp_invalid, "Unexpected ARP hw address format : %d (%d expected)\n", htons(hdr->arp_hrd), ARPHRD_ETHER);
 		goto err;
 	}
 
 	if (htons(hdr->arp_pro) != ETHERTYPE_IP) {
-		fprintf(stderr, "Unexpected ARP protocol address format : %#06x (%#06x expected)\n", htons(hdr->arp_pro), ETHERTYPE_IP);
+		counters_error(counter_arp_invalid, "Unexpected ARP protocol address format : %#06x (%#06x expected)\n", htons(hdr->arp_pro), ETHERTYPE_IP);
 		goto err;
 	}
 
 	if (hdr->arp_hln != sizeof hdr->arp_sha || hdr->arp_hln != sizeof hdr->arp_tha) {
-		fprintf(stderr, "Unexpected ARP hw address length : %d (%zd expected)\n", hdr->arp_hln, sizeof hdr->arp_sha);
+		counters_error(counter_arp_invalid, "Unexpected ARP hw address length : %d (%zd expected)\n", hdr->arp_hln, sizeof hdr->arp_sha);
 		goto err;
 	}
 
 	if (hdr->arp_pln != sizeof hdr->arp_spa || hdr->arp_pln != sizeof hdr->arp_tpa) {
-		fprintf(stderr, "Unexpected ARP protocol address length : %d (%zd expected)\n", hdr->arp_hln, sizeof hdr->arp_spa);
+		counters_error(counter_arp_invalid, "Unexpected ARP protocol address length : %d (%zd expected)\n", hdr->arp_hln, sizeof hdr->arp_spa);
 		goto err;
 	}
 
 
-	if (hdr->arp_hln != sizeof frame->net.arp.hw_source) {
-		fprintf(stderr, "Unexpected ARP protocol address length : %d (%zd expected)\n", hdr->arp_hln, sizeof hdr->arp_spa);
+	if (hdr->arp_hln != sizeof cold->arp.hw_source) {
+		counters_error(counter_arp_invalid, "Unexpected ARP protocol address length : %d (%zd expected)\n", hdr->arp_hln, sizeof hdr->arp_spa);
 		goto err;
 	}
 
-	if (sizeof hdr->arp_sha != sizeof frame->net.arp.hw_source)
+	if (sizeof hdr->arp_sha != sizeof cold->arp.hw_source)
 		abort();
 
-	if (sizeof hdr->arp_tha != sizeof frame->net.arp.hw_dest)
+	if (sizeof hdr->arp_tha != sizeof cold->arp.hw_dest)
 		abort();
 
-	if (sizeof hdr->arp_spa != sizeof frame->net.arp.ip_source)
+	if (sizeof hdr->arp_spa != sizeof cold->arp.ip_source)
 		abort();
 
-	if (sizeof hdr->arp_tpa != sizeof frame->net.arp.ip_dest)
+	if (sizeof hdr->arp_tpa != sizeof cold->arp.ip_dest)
 		abort();
 
-	frame->net.type = frame_net_type_arp;
-	frame->net.arp.opcode = htons(hdr->arp_op);
-	memcpy(frame->net.arp.hw_source, hdr->arp_sha, sizeof frame->net.arp.hw_source);
-	memcpy(frame->net.arp.hw_dest, hdr->arp_tha, sizeof frame->net.arp.hw_dest);
-	memcpy(&frame->net.arp.ip_source, hdr->arp_spa, sizeof frame->net.arp.ip_source);
-	memcpy(&frame->net.arp.ip_dest, hdr->arp_tpa, sizeof frame->net.arp.ip_dest);
+	frame->net_type = frame_net_type_arp;
+	if (cold == NULL)
+		goto done;
+
+	cold->arp.opcode = htons(hdr->arp_op);
+	memcpy(cold->arp.hw_source, hdr->arp_sha, sizeof cold->arp.hw_source);
+	memcpy(cold->arp.hw_dest, hdr->arp_tha, sizeof cold->arp.hw_dest);
+	memcpy(&cold->arp.ip_source, hdr->arp_spa, sizeof cold->arp.ip_source);
+	memcpy(&cold->arp.ip_dest, hdr->arp_tpa, sizeof cold->arp.ip_dest);
+done:
 	ret = 0;
 err:
 	return ret;
@@ -9,32 +9,36 @@
 
 #include "decode_eth.h"
 #include "decode_ip.h"
+#include "decode_ipv6.h"
 #include "decode_arp.h"
 #include "frame.h"
+#include "counters.h"
 
 int decode_eth(struct frame *frame, const int depth, const void *data, const uint32_t len, void *private)
 {
 	const struct ether_header *hdr = data;
+	struct frame_cold *cold = private;
 	int ret = -1;
-	(void)private;
 
 	if (len < sizeof hdr[0]) {
-		fprintf(stderr, "Invalid ETHERNET pload size : %d (%zd at least)\n", len, sizeof hdr[0]);
+		counters_error(counter_eth_short, "Invalid ETHERNET pload size : %d (%zd at least)\n", len, sizeof hdr[0]);
 		goto err;
 	}
 
-	if (sizeof hdr->ether_shost != sizeof frame->hw.source)
+	if (sizeof hdr->ether_shost != sizeof cold->hw.source)
 		abort();
 
-	if (sizeof hdr->ether_dhost != sizeof frame->hw.dest)
+	if (sizeof hdr->ether_dhost != sizeof cold->hw.dest)
 		abort();
 
-	memcpy(frame->hw.dest, hdr->ether_dhost, sizeof hdr->ether_dhost);
-	memcpy(frame->hw.source, hdr->ether_shost, sizeof hdr->ether_shost);
+	if (cold != NULL) {
+		memcpy(cold->hw.dest, hdr->ether_dhost, sizeof hdr->ether_dhost);
+		memcpy(cold->hw.source, hdr->ether_shost, sizeof hdr->ether_shost);
+	}
 
 	switch (htons(hdr->ether_type)) {
 	default:
-		fprintf(stderr, "!!! Unexpected ETHERNET type : %#06x\n", htons(hdr->ether_type));
+		counters_error(counter_eth_type, "!!! Unexpected ETHERNET type : %#06x\n", htons(hdr->ether_type));
 		goto err;
 
 	case ETHERTYPE_ARP:
@@ -44,6 +48,10 @@ int decode_eth(struct frame *frame, const int depth, const void *data, const uin
 	case ETHERTYPE_IP:
 		ret = decode_ip(frame, depth + 1, data + sizeof hdr[0], len - sizeof hdr[0], private);
 		break;
+
+	case ETHERTYPE_IPV6:
+		ret = decode_ipv6(frame, depth + 1, data + sizeof hdr[0], len - sizeof hdr[0], private);
+		break;
 	}
 
 err:
@@ -7,6 +7,7 @@
 #include "decode_ip.h"
 #include "decode_tcp.h"
 #include "decode_udp.h"
+#include "counters.h"
 
 int decode_ip(struct frame *frame, const int depth, const void *data, const uint32_t len, void *private)
 {
@@ -14,33 +15,27 @@ int decode_ip(struct frame *frame, const int depth, const void *data, const uint
 	int ret = -1;
 
 	if (len < sizeof iphdr[0]) {
-		fprintf(stderr, "Invalid IP pload size : %d (%zd at least)\n", len, sizeof iphdr[0]);
+		counters_error(counter_ip_short, "Invalid IP pload size : %d (%zd at least)\n", len, sizeof iphdr[0]);
 		goto err;
 	}
 
 	if (iphdr->ihl < sizeof iphdr[0] / 4) {
-		fprintf(stderr, "Invalid IP ihl : %d (%zd at least)\n", len, sizeof iphdr[0] / 4);
+		counters_error(counter_ip_ihl, "Invalid IP ihl : %d (%zd at least)\n", len, sizeof iphdr[0] / 4);
 		goto err;
 	}
 
 	if (htons(iphdr->tot_len) > len) {
-		fprintf(stderr, "Invalid IP tot_len : %d (%d at least)\n", htons(iphdr->tot_len), len);
+		counters_error(counter_ip_tot_len, "Invalid IP tot_len : %d (%d at least)\n", htons(iphdr->tot_len), len);
 		goto err;
 	}
 
-	if (sizeof frame->net.ip.source != sizeof iphdr->saddr)
-		abort();
-
-	if (sizeof frame->net.ip.dest != sizeof iphdr->daddr)
-		abort();
-
-	frame->net.type = frame_net_type_ip;
-	frame->net.ip.source = (struct in_addr){.s_addr = iphdr->saddr};
-	frame->net.ip.dest = (struct in_addr){.s_addr = iphdr->daddr};
+	frame->net_type = frame_net_type_ip;
+	frame_addr_set_ipv4(&frame->ip.source, iphdr->saddr);
+	frame_addr_set_ipv4(&frame->ip.dest, iphdr->daddr);
 
 	switch (iphdr->protocol) {
 	default:
-		fprintf(stderr, "Unexpected IP protocol : %d\n", iphdr->protocol);
+		counters_error(counter_ip_protocol, "Unexpected IP protocol : %d\n", iphdr->protocol);
 		goto err;
 
 	case IPPROTO_TCP:
@@ -0,0 +1,105 @@
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <netinet/ip6.h>
+#include <arpa/inet.h>
+
+#include "decode_ipv6.h"
+#include "decode_tcp.h"
+#include "decode_udp.h"
+#include "counters.h"
+
+int decode_ipv6(struct frame *frame, const int depth, const void *data, const uint32_t len, void *private)
+{
+	const struct ip6_hdr *hdr = data;
+	uint32_t plen;
+	uint32_t offset;
+	uint8_t next;
+	int ret = -1;
+
+	if (len < sizeof hdr[0]) {
+		counters_error(counter_ipv6_short, "Invalid IPv6 pload size : %d (%zd at least)\n", len, sizeof hdr[0]);
+		goto err;
+	}
+
+	plen = htons(hdr->ip6_plen);
+	if (plen == 0 || sizeof hdr[0] + plen > len) {
+		/* plen == 0 is a jumbogram, which would not fit in a frame anyway */
+		counters_error(counter_ipv6_plen, "Invalid IPv6 payload length : %d (%zd at most)\n", plen, len - sizeof hdr[0]);
+		goto err;
+	}
+
+	if (sizeof frame->ip.source != sizeof hdr->ip6_src)
+		abort();
+
+	if (sizeof frame->ip.dest != sizeof hdr->ip6_dst)
+		abort();
+
+	frame->net_type = frame_net_type_ipv6;
+	memcpy(&frame->ip.source, &hdr->ip6_src, sizeof frame->ip.source);
+	memcpy(&frame->ip.dest, &hdr->ip6_dst, sizeof frame->ip.dest);
+
+	/*
+	 * Walk the extension headers up to the upper layer one
+	 */
+	data += sizeof hdr[0];
+	next = hdr->ip6_nxt;
+	offset = 0;
+	for (;;) {
+		const struct ip6_ext *ext = data + offset;
+		const struct ip6_frag *frag = data + offset;
+
+		switch (next) {
+		default:
+			counters_error(counter_ipv6_next_header, "Unexpected IPv6 next header : %d\n", next);
+			goto err;
+
+		case IPPROTO_TCP:
+			ret = decode_tcp(frame, depth + 1, data + offset, plen - offset, private);
+			goto decoded;
+
+		case IPPROTO_UDP:
+			ret = decode_udp(frame, depth + 1, data + offset, plen - offset, private);
+			goto decoded;
+
+		case IPPROTO_HOPOPTS:
+		case IPPROTO_ROUTING:
+		case IPPROTO_DSTOPTS:
+			if (offset + sizeof ext[0] > plen || offset + (ext->ip6e_len + 1) * 8 > plen) {
+				counters_error(counter_ipv6_ext, "Invalid IPv6 extension header %d\n", next);
+				goto err;
+			}
+			next = ext->ip6e_nxt;
+			offset += (ext->ip6e_len + 1) * 8;
+			break;
+
+		case IPPROTO_AH:
+			if (offset + sizeof ext[0] > plen || offset + (ext->ip6e_len + 2) * 4 > plen) {
+				counters_error(counter_ipv6_ext, "Invalid IPv6 extension header %d\n", next);
+				goto err;
+			}
+			next = ext->ip6e_nxt;
+			offset += (ext->ip6e_len + 2) * 4;
+			break;
+
+		case IPPROTO_FRAGMENT:
+			if (offset + sizeof frag[0] > plen) {
+				counters_error(counter_ipv6_ext, "Invalid IPv6 extension header %d\n", next);
+				goto err;
+			}
+
+			if ((frag->ip6f_offlg & (IP6F_OFF_MASK | IP6F_MORE_FRAG)) != 0) {
+				/* Only atomic fragments can be decoded, reassembly is not managed */
+				counters_error(counter_ipv6_fragment, "IPv6 fragment (id = %#x)\n", htonl(frag->ip6f_ident));
+				goto err;
+			}
+			next = frag->ip6f_nxt;
+			offset += sizeof frag[0];
+			break;
+		}
+	}
+
+decoded:
+err:
+	return ret;
+}
@@ -0,0 +1,8 @@
+
+#ifndef __decode_ipv6_h_666__
+# define __decode_ipv6_h_666__
+
+# include "frame.h"
+int decode_ipv6(struct frame *frame, const int depth, const void *data, const uint32_t len, void *private);
+
+#endif
@@ -8,21 +8,28 @@
 #include <string.h>
 
 #include "decode_ip.h"
+#include "decode_ipv6.h"
 #include "decode_arp.h"
+#include "counters.h"
 
 int decode_sll(struct frame *frame, const int depth, const void *data, const uint32_t len, void *private)
 {
 	int ret = -1;
 	const struct sll_header *hdr = data;
+	struct frame_cold *cold = private;
+	struct frame_hw hw;
 
 	if (len < sizeof hdr[0]) {
-		fprintf(stderr, "Invalid SLL pload size : %d (%zd at least)\n", len, sizeof hdr[0]);
+		counters_error(counter_sll_short, "Invalid SLL pload size : %d (%zd at least)\n", len, sizeof hdr[0]);
 		goto err;
 	}
 
+	/* Address bytes past halen stay zero */
+	memset(&hw, 0, sizeof hw);
+
 	switch (htons(hdr->sll_hatype))  {
 	default:
-		fprintf(stderr, "Unexpected sll_pkttype : %#06x\n", hdr->sll_hatype);
+		counters_error(counter_sll_hatype, "Unexpected sll_hatype : %#06x\n", htons(hdr->sll_hatype));
 		goto err;
 
 	case ARPHRD_ETHER:
@@ -30,57 +37,65 @@ int decode_sll(struct frame *frame, const int depth, const void *data, const uin
 		const uint32_t halen = htons(hdr->sll_halen);
 
 		if (halen > sizeof hdr->sll_addr) {
-			fprintf(stderr, "Unexpected sll_halen : %d (sll max = %zd)\n", halen, sizeof hdr->sll_addr);
+			counters_error(counter_sll_halen, "Unexpected sll_halen : %d (sll max = %zd)\n", halen, sizeof hdr->sll_addr);
 			goto err;
 		}
 
-		if (halen > sizeof frame->hw.dest) {
-			fprintf(stderr, "Unexpected sll_halen : %d (hw dest max = %zd)\n", halen, sizeof frame->hw.dest);
+		if (halen > sizeof hw.dest) {
+			counters_error(counter_sll_halen, "Unexpected sll_halen : %d (hw dest max = %zd)\n", halen, sizeof hw.dest);
 			goto err;
 		}
 
-		if (halen > sizeof frame->hw.source) {
-			fprintf(stderr, "Unexpected sll_halen : %d (hw source max = %zd)\n", halen, sizeof frame->hw.source);
+		if (halen > sizeof hw.source) {
+			counters_error(counter_sll_halen, "Unexpected sll_halen : %d (hw source max = %zd)\n", halen, sizeof hw.source);
 			goto err;
 		}
 
 		switch (htons(hdr->sll_pkttype)) {
 		default:
-			fprintf(stderr, "Unexpected sll_pkttype : %#06x\n", hdr->sll_pkttype);
+			counters_error(counter_sll_pkttype, "Unexpected sll_pkttype : %#06x\n", htons(hdr->sll_pkttype));
 			goto err;
 
 		case LINUX_SLL_HOST: /* RX */
-			memcpy(frame->hw.source, hdr->sll_addr, halen);
-			memset(frame->hw.dest, 0x00, sizeof frame->hw.dest);
+			memcpy(hw.source, hdr->sll_addr, halen);
+			memset(hw.dest, 0x00, sizeof hw.dest);
 			break;
 
 		case LINUX_SLL_OUTGOING: /* TX */
-			memcpy(frame->hw.dest, hdr->sll_addr, halen);
-			memset(frame->hw.source, 0x00, sizeof frame->hw.source);
+			memcpy(hw.dest, hdr->sll_addr, halen);
+			memset(hw.source, 0x00, sizeof hw.source);
 			break;
 
 		case LINUX_SLL_BROADCAST:
-			memcpy(frame->hw.source, hdr->sll_addr, halen);
-			memset(frame->hw.dest, 0xFF, sizeof frame->hw.dest);
+			memcpy(hw.source, hdr->sll_addr, halen);
+			memset(hw.dest, 0xFF, sizeof hw.dest);
 			break;
 		}
 		break;
 	}
 
 	case ARPHRD_LOOPBACK:
-		memset(frame->hw.dest, 0x00, sizeof frame->hw.dest);
-		memset(frame->hw.source, 0x00, sizeof frame->hw.source);
+		memset(hw.dest, 0x00, sizeof hw.dest);
+		memset(hw.source, 0x00, sizeof hw.source);
 		break;
 	}
 
+	if (cold != NULL)
+		cold->hw = hw;
+
 	switch (htons(hdr->sll_protocol)) {
 	default:
+		counters_error(counter_sll_protocol, "Unexpected sll_protocol : %#06x\n", htons(hdr->sll_protocol));
 		goto err;
 
 	case ETHERTYPE_IP:
 		ret = decode_ip(frame, depth + 1, data + sizeof hdr[0], len - sizeof hdr[0], private);
 		break;
 
+	case ETHERTYPE_IPV6:
+		ret = decode_ipv6(frame, depth + 1, data + sizeof hdr[0], len - sizeof hdr[0], private);
+		break;
+
 	case ETHERTYPE_ARP:
 		ret = decode_arp(frame, depth + 1, data + sizeof hdr[0], len - sizeof hdr[0], private);
 		break;
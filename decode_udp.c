@@ -7,6 +7,8 @@
 
 #include "decode_udp.h"
 #include "rawprint.h"
+#include "counters.h"
+#include "bufpool.h"
 
 int decode_udp(struct frame *frame, const int depth, const void *data, const uint32_t len, void *private)
 {
@@ -17,18 +19,18 @@ int decode_udp(struct frame *frame, const int depth, const void *data, const uin
 	(void)private;
 
 	if (len < sizeof hdr[0]) {
-		fprintf(stderr, "Invalid UDP pload size : %d (%zd at least)\n", len, sizeof hdr[0]);
+		counters_error(counter_udp_short, "Invalid UDP pload size : %d (%zd at least)\n", len, sizeof hdr[0]);
 		goto err;
 	}
 
 	app_data_size = htons(hdr->len);
 	if (app_data_size > len) {
-		fprintf(stderr, "Invalid UDP length : %d (%d at least)\n", app_data_size, len);
+		counters_error(counter_udp_len, "Invalid UDP length : %d (%d at least)\n", app_data_size, len);
 		goto err;
 	}
 
 	if (app_data_size < sizeof hdr[0]) {
-		fprintf(stderr, "Unexpected UDP pload size : %d (at least %zd expected)\n", app_data_size, sizeof hdr[0]);
+		counters_error(counter_udp_short, "Unexpected UDP pload size : %d (at least %zd expected)\n", app_data_size, sizeof hdr[0]);
 		goto err;
 	}
 
@@ -37,7 +39,7 @@ int decode_udp(struct frame *frame, const int depth, const void *data, const uin
 	if (app_data_size == 0)
 		app_data = NULL;
 	else {
-		app_data = malloc(app_data_size);
+		app_data = bufpool_alloc(app_data_size);
 		if (app_data == NULL) {
 			fprintf(stderr, "Failed to allocate UDP data : %s\n", strerror(errno));
 			goto err;
@@ -45,10 +47,10 @@ int decode_udp(struct frame *frame, const int depth, const void *data, const uin
 		memcpy(app_data, data + sizeof hdr[0], app_data_size);
 	}
 
-	frame->proto.type = frame_proto_type_udp;
-	frame->proto.udp.hdr = *hdr;
-	frame->app.size = app_data_size;
-	frame->app.data = app_data;
+	frame->proto_type = frame_proto_type_udp;
+	frame->source = hdr->source;
+	frame->dest = hdr->dest;
+	frame->app_data = app_data;
 	return 0;
 
 err:
@@ -0,0 +1,124 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "endpoint.h"
+
+static void key_set(struct endpoint_key *key, const enum endpoint_kind kind, const struct frame_addr *addr, const uint16_t port)
+{
+	memset(key, 0, sizeof key[0]);
+	key->kind = kind;
+	if (kind != endpoint_kind_port)
+		key->addr = *addr;
+	if (kind != endpoint_kind_addr)
+		key->port = port;
+}
+
+static inline int key_equal(const struct endpoint_key *key1, const struct endpoint_key *key2)
+{
+	return key1->kind == key2->kind && key1->port == key2->port && frame_addr_equal(&key1->addr, &key2->addr);
+}
+
+static inline size_t key_hash(const struct endpoint_key *key)
+{
+	uint64_t h = key->addr.u64[0] ^ (key->addr.u64[1] * 0x9e3779b97f4a7c15ULL) ^ ((uint64_t)key->port << 32 | key->kind);
+
+	h ^= h >> 33;
+	h *= 0xff51afd7ed558ccdULL;
+	h ^= h >> 33;
+	return h;
+}
+
+static struct endpoint_bucket *bucket_get(const struct endpoint_bucket *bucket, const size_t capacity, const struct endpoint_key *key)
+{
+	for (size_t idx = key_hash(key) & (capacity - 1) ; ; idx = (idx + 1) & (capacity - 1)) {
+		if (bucket[idx].key.kind == 0 || key_equal(&bucket[idx].key, key))
+			return (struct endpoint_bucket *)&bucket[idx];
+	}
+}
+
+static int index_resize(struct endpoint_index *index, const size_t capacity)
+{
+	struct endpoint_bucket *bucket;
+
+	bucket = calloc(capacity, sizeof bucket[0]);
+	if (bucket == NULL) {
+		fprintf(stderr, "Failed to allocate a %zd buckets endpoint index : %s\n", capacity, strerror(errno));
+		goto err;
+	}
+
+	for (size_t idx = 0 ; idx < index->capacity ; idx ++) {
+		if (index->bucket[idx].key.kind != 0)
+			*bucket_get(bucket, capacity, &index->bucket[idx].key) = index->bucket[idx];
+	}
+
+	free(index->bucket);
+	index->bucket = bucket;
+	index->capacity = capacity;
+	return 0;
+
+err:
+	return -1;
+}
+
+int endpoint_index_init(struct endpoint_index *index, struct region *region)
+{
+	memset(index, 0, sizeof index[0]);
+	index->region = region;
+	return 0;
+}
+
+void endpoint_index_free(struct endpoint_index *index)
+{
+	free(index->bucket);
+	memset(index, 0, sizeof index[0]);
+}
+
+int endpoint_index_add(struct endpoint_index *index, const enum endpoint_kind kind, const struct frame_addr *addr, const uint16_t port, struct session_entry *entry)
+{
+	struct endpoint_key key;
+	struct endpoint_bucket *bucket;
+	struct endpoint_link *link;
+
+	if ((index->count + 1) * 4 > index->capacity * 3 && index_resize(index, index->capacity > 0 ? index->capacity * 2 : ENDPOINT_INDEX_MIN_CAPACITY) < 0)
+		goto err;
+
+	link = region_alloc(index->region, sizeof link[0]);
+	if (link == NULL) {
+		fprintf(stderr, "Failed to allocate endpoint link\n");
+		goto err;
+	}
+	link->entry = entry;
+
+	key_set(&key, kind, addr, port);
+	bucket = bucket_get(index->bucket, index->capacity, &key);
+	if (bucket->key.kind == 0) {
+		bucket->key = key;
+		index->count ++;
+	}
+
+	if (bucket->last != NULL)
+		bucket->last->next = link;
+	else
+		bucket->first = link;
+	bucket->last = link;
+	bucket->count ++;
+	return 0;
+
+err:
+	return -1;
+}
+
+const struct endpoint_bucket *endpoint_index_find(const struct endpoint_index *index, const enum endpoint_kind kind, const struct frame_addr *addr, const uint16_t port)
+{
+	struct endpoint_key key;
+	const struct endpoint_bucket *bucket;
+
+	if (index->capacity == 0)
+		return NULL;
+
+	key_set(&key, kind, addr, port);
+	bucket = bucket_get(index->bucket, index->capacity, &key);
+	return bucket->key.kind != 0 ? bucket : NULL;
+}
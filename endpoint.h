@@ -0,0 +1,55 @@
+
+#ifndef __endpoint_h_666__
+# define __endpoint_h_666__
+
+# include <stdint.h>
+# include <stddef.h>
+# include "frame.h"
+# include "region.h"
+
+/*
+ * Secondary index of the sessions touching an endpoint : an exact address
+ * and port, a whole host, or a port on any host. Every bucket lists its
+ * sessions in creation order, links come from the session table region.
+ */
+# define ENDPOINT_INDEX_MIN_CAPACITY 256
+
+enum endpoint_kind {
+	endpoint_kind_addr_port = 1,
+	endpoint_kind_addr,
+	endpoint_kind_port,
+};
+
+struct endpoint_key {
+	struct frame_addr addr;	/* Zero for endpoint_kind_port */
+	uint16_t port;		/* Network order, zero for endpoint_kind_addr */
+	uint16_t kind;		/* Zero for an empty slot */
+};
+
+struct session_entry;
+
+struct endpoint_link {
+	struct session_entry *entry;
+	struct endpoint_link *next;
+};
+
+struct endpoint_bucket {
+	struct endpoint_key key;
+	size_t count;
+	struct endpoint_link *first;
+	struct endpoint_link *last;
+};
+
+struct endpoint_index {
+	struct endpoint_bucket *bucket;
+	size_t capacity;	/* A power of 2 */
+	size_t count;
+	struct region *region;
+};
+
+int endpoint_index_init(struct endpoint_index *index, struct region *region);
+void endpoint_index_free(struct endpoint_index *index);
+int endpoint_index_add(struct endpoint_index *index, const enum endpoint_kind kind, const struct frame_addr *addr, const uint16_t port, struct session_entry *entry);
+const struct endpoint_bucket *endpoint_index_find(const struct endpoint_index *index, const enum endpoint_kind kind, const struct frame_addr *addr, const uint16_t port);
+
+#endif
@@ -0,0 +1,310 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "fingerprint.h"
+#include "bufpool.h"
+
+#define FINGERPRINT_C1 0x87c37b91114253d5ULL
+#define FINGERPRINT_C2 0x4cf5ad432745937fULL
+#define FINGERPRINT_GEAR_WINDOW 64	/* Bytes a gear hash depends on */
+#define FINGERPRINT_SPAN_MASK (~0ULL << (64 - FINGERPRINT_SPAN_BITS))
+#define FINGERPRINT_SPAN_ALLOC 16
+
+static uint64_t gear[256];
+
+static inline uint64_t rotl64(const uint64_t x, const int r)
+{
+	return x << r | x >> (64 - r);
+}
+
+static inline uint64_t fmix64(uint64_t k)
+{
+	k ^= k >> 33;
+	k *= 0xff51afd7ed558ccdULL;
+	k ^= k >> 33;
+	k *= 0xc4ceb9fe1a85ec53ULL;
+	k ^= k >> 33;
+	return k;
+}
+
+static inline uint64_t mix_k1(uint64_t k1)
+{
+	k1 *= FINGERPRINT_C1;
+	k1 = rotl64(k1, 31);
+	return k1 * FINGERPRINT_C2;
+}
+
+static inline uint64_t mix_k2(uint64_t k2)
+{
+	k2 *= FINGERPRINT_C2;
+	k2 = rotl64(k2, 33);
+	return k2 * FINGERPRINT_C1;
+}
+
+/*
+ * Words are read little-endian, as the reference implementation does on
+ * x86 : the tail is padded with zeroes into a last block
+ */
+static inline void mix_block(struct fingerprint_state *state, const uint8_t *data)
+{
+	uint64_t k[2];
+
+	memcpy(k, data, sizeof k);
+
+	state->h1 ^= mix_k1(k[0]);
+	state->h1 = rotl64(state->h1, 27);
+	state->h1 += state->h2;
+	state->h1 = state->h1 * 5 + 0x52dce729;
+
+	state->h2 ^= mix_k2(k[1]);
+	state->h2 = rotl64(state->h2, 31);
+	state->h2 += state->h1;
+	state->h2 = state->h2 * 5 + 0x38495ab5;
+}
+
+void fingerprint_init(struct fingerprint_state *state)
+{
+	memset(state, 0, sizeof state[0]);
+}
+
+void fingerprint_update(struct fingerprint_state *state, const void *data, size_t size)
+{
+	const uint8_t *ptr = data;
+	const size_t pending = state->size % 16;
+
+	state->size += size;
+
+	if (pending > 0) {
+		const size_t count = size < 16 - pending ? size : 16 - pending;
+
+		memcpy(state->tail + pending, ptr, count);
+		if (pending + count < 16)
+			return;
+		mix_block(state, state->tail);
+		ptr += count;
+		size -= count;
+	}
+
+	for ( ; size >= 16 ; ptr += 16, size -= 16)
+		mix_block(state, ptr);
+	memcpy(state->tail, ptr, size);
+}
+
+void fingerprint_final(const struct fingerprint_state *state, struct fingerprint *fp)
+{
+	const size_t tail = state->size % 16;
+	uint64_t h1 = state->h1;
+	uint64_t h2 = state->h2;
+	uint64_t k[2];
+
+	if (tail > 0) {
+		memset(k, 0, sizeof k);
+		memcpy(k, state->tail, tail);
+		if (tail > 8)
+			h2 ^= mix_k2(k[1]);
+		h1 ^= mix_k1(k[0]);
+	}
+
+	h1 ^= state->size;
+	h2 ^= state->size;
+	h1 += h2;
+	h2 += h1;
+	h1 = fmix64(h1);
+	h2 = fmix64(h2);
+	h1 += h2;
+	h2 += h1;
+
+	fp->h1 = h1;
+	fp->h2 = h2;
+}
+
+void fingerprint_block(const uint8_t *data, const size_t size, struct fingerprint *fp)
+{
+	struct fingerprint_state state;
+
+	fingerprint_init(&state);
+	fingerprint_update(&state, data, size);
+	fingerprint_final(&state, fp);
+}
+
+/*
+ * Gear values only need to look random : splitmix64 of the byte
+ */
+static void gear_init(void)
+{
+	uint64_t x = 0;
+
+	for (size_t i = 0 ; i < 256 ; i ++) {
+		uint64_t z = (x += 0x9e3779b97f4a7c15ULL);
+
+		z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+		z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+		gear[i] = z ^ (z >> 31);
+	}
+}
+
+void fingerprint_stream_init(struct fingerprint_stream *stream)
+{
+	if (gear[0] == 0)
+		gear_init();
+
+	memset(stream, 0, sizeof stream[0]);
+}
+
+void fingerprint_stream_free(struct fingerprint_stream *stream)
+{
+	bufpool_free(stream->spans);
+	fingerprint_stream_init(stream);
+}
+
+/*
+ * A span ends after in_span bytes when the gear hash of its last bytes says
+ * so, or once it is that long
+ */
+static inline int span_cut(const uint64_t hash, const uint64_t in_span)
+{
+	return in_span >= FINGERPRINT_SPAN_MIN && ((hash & FINGERPRINT_SPAN_MASK) == 0 || in_span >= FINGERPRINT_SPAN_MAX);
+}
+
+static inline uint64_t span_start(const struct fingerprint_stream *stream)
+{
+	return stream->span_count > 0 ? stream->spans[stream->span_count - 1].end : 0;
+}
+
+static int span_close(struct fingerprint_stream *stream)
+{
+	struct fingerprint_span *span;
+
+	if (stream->span_count == stream->span_alloc) {
+		const size_t alloc = stream->span_alloc > 0 ? 2 * stream->span_alloc : FINGERPRINT_SPAN_ALLOC;
+		struct fingerprint_span *spans = bufpool_alloc(alloc * sizeof spans[0]);
+
+		if (spans == NULL) {
+			fprintf(stderr, "Failed to allocate %zd fingerprint spans\n", alloc);
+			return -1;
+		}
+
+		if (stream->span_count > 0)
+			memcpy(spans, stream->spans, stream->span_count * sizeof spans[0]);
+		bufpool_free(stream->spans);
+		stream->spans = spans;
+		stream->span_alloc = alloc;
+	}
+
+	span = &stream->spans[stream->span_count ++];
+	span->end = stream->size;
+	fingerprint_final(&stream->span, &span->fingerprint);
+	fingerprint_update(&stream->whole, &span->fingerprint, sizeof span->fingerprint);
+
+	fingerprint_init(&stream->span);
+	stream->gear = 0;
+	return 0;
+}
+
+int fingerprint_stream_update(struct fingerprint_stream *stream, const uint8_t *data, const size_t size)
+{
+	const uint8_t *ptr = data;
+	const uint8_t *end = data + size;
+
+	while (ptr < end) {
+		const uint8_t *start = ptr;
+		uint64_t in_span = stream->size - span_start(stream);
+		int cut = 0;
+
+		/* No cut before the minimum : the gear hash starts rolling just in time */
+		if (in_span < FINGERPRINT_SPAN_MIN - FINGERPRINT_GEAR_WINDOW) {
+			uint64_t skip = FINGERPRINT_SPAN_MIN - FINGERPRINT_GEAR_WINDOW - in_span;
+
+			if (skip > (uint64_t)(end - ptr))
+				skip = end - ptr;
+			ptr += skip;
+			in_span += skip;
+		}
+
+		while (ptr < end) {
+			stream->gear = (stream->gear << 1) + gear[*ptr ++];
+			in_span ++;
+			if (span_cut(stream->gear, in_span)) {
+				cut = 1;
+				break;
+			}
+		}
+
+		fingerprint_update(&stream->span, start, ptr - start);
+		stream->size += ptr - start;
+		if (cut && span_close(stream) < 0)
+			return -1;
+	}
+
+	return 0;
+}
+
+/*
+ * The hash only depends on the last FINGERPRINT_GEAR_WINDOW bytes : it is
+ * rolled again over the ones before the first position checked
+ */
+size_t fingerprint_span_cut(const uint8_t *data, const size_t scanned, const size_t size)
+{
+	const size_t end = size < FINGERPRINT_SPAN_MAX ? size : FINGERPRINT_SPAN_MAX;
+	size_t pos = scanned + 1 > FINGERPRINT_SPAN_MIN ? scanned + 1 : FINGERPRINT_SPAN_MIN;
+	uint64_t hash = 0;
+
+	if (gear[0] == 0)
+		gear_init();
+
+	if (pos > end)
+		return 0;
+
+	for (size_t i = pos - FINGERPRINT_GEAR_WINDOW ; i < pos - 1 ; i ++)
+		hash = (hash << 1) + gear[data[i]];
+
+	for ( ; pos <= end ; pos ++) {
+		hash = (hash << 1) + gear[data[pos - 1]];
+		if ((hash & FINGERPRINT_SPAN_MASK) == 0)
+			return pos;
+	}
+
+	return end == FINGERPRINT_SPAN_MAX ? end : 0;
+}
+
+void fingerprint_stream_final(const struct fingerprint_stream *stream, struct fingerprint *fp)
+{
+	struct fingerprint_state whole = stream->whole;
+
+	if (stream->size > span_start(stream)) {
+		struct fingerprint last;
+
+		fingerprint_final(&stream->span, &last);
+		fingerprint_update(&whole, &last, sizeof last);
+	}
+
+	fingerprint_final(&whole, fp);
+}
+
+int fingerprint_stream_equal(const struct fingerprint_stream *stream1, const struct fingerprint_stream *stream2)
+{
+	struct fingerprint fp1;
+	struct fingerprint fp2;
+
+	if (stream1->size != stream2->size)
+		return 0;
+
+	fingerprint_stream_final(stream1, &fp1);
+	fingerprint_stream_final(stream2, &fp2);
+	return fingerprint_equal(&fp1, &fp2);
+}
+
+uint64_t fingerprint_stream_diverge(const struct fingerprint_stream *stream1, const struct fingerprint_stream *stream2)
+{
+	size_t i;
+
+	for (i = 0 ; i < stream1->span_count && i < stream2->span_count ; i ++) {
+		const struct fingerprint_span *span1 = &stream1->spans[i];
+		const struct fingerprint_span *span2 = &stream2->spans[i];
+
+		if (span1->end != span2->end || !fingerprint_equal(&span1->fingerprint, &span2->fingerprint))
+			break;
+	}
+
+	return i > 0 ? stream1->spans[i - 1].end : 0;
+}
@@ -0,0 +1,79 @@
+#ifndef __fingerprint_h_666__
+# define __fingerprint_h_666__
+
+# include <stdint.h>
+# include <stddef.h>
+
+/*
+ * 128-bit fingerprints of payload bytes, MurmurHash3 x64_128 : fast, and
+ * wide enough that distinct blocks of a capture never collide in practice.
+ * They are not meant to resist crafted inputs. The incremental form gives
+ * the same result however the bytes are split.
+ *
+ * A fingerprint_stream also cuts its bytes into content-defined spans with
+ * a gear rolling hash : a span ends where the hash of the last 64 bytes
+ * has its top FINGERPRINT_SPAN_BITS bits clear, between
+ * FINGERPRINT_SPAN_MIN and FINGERPRINT_SPAN_MAX bytes. Streams sharing
+ * content share their cuts there, even at different offsets. The whole
+ * stream fingerprint is the one of its span fingerprints.
+ */
+# define FINGERPRINT_SPAN_MIN 2048
+# define FINGERPRINT_SPAN_MAX (64 * 1024)
+# define FINGERPRINT_SPAN_BITS 13	/* 8KB spans on average past the minimum */
+
+struct fingerprint {
+	uint64_t h1;
+	uint64_t h2;
+};
+
+struct fingerprint_state {
+	uint64_t h1;
+	uint64_t h2;
+	uint64_t size;
+	uint8_t tail[16];	/* size % 16 bytes not mixed yet */
+};
+
+struct fingerprint_span {
+	uint64_t end;		/* Stream offset after its last byte */
+	struct fingerprint fingerprint;
+};
+
+struct fingerprint_stream {
+	struct fingerprint_state whole;	/* Fingerprints of the spans */
+	struct fingerprint_state span;	/* Bytes of the current span */
+	uint64_t gear;
+	uint64_t size;
+	struct fingerprint_span *spans;
+	size_t span_count;
+	size_t span_alloc;
+};
+
+void fingerprint_init(struct fingerprint_state *state);
+void fingerprint_update(struct fingerprint_state *state, const void *data, const size_t size);
+void fingerprint_final(const struct fingerprint_state *state, struct fingerprint *fp);
+void fingerprint_block(const uint8_t *data, const size_t size, struct fingerprint *fp);
+
+void fingerprint_stream_init(struct fingerprint_stream *stream);
+void fingerprint_stream_free(struct fingerprint_stream *stream);
+int fingerprint_stream_update(struct fingerprint_stream *stream, const uint8_t *data, const size_t size);
+void fingerprint_stream_final(const struct fingerprint_stream *stream, struct fingerprint *fp);
+int fingerprint_stream_equal(const struct fingerprint_stream *stream1, const struct fingerprint_stream *stream2);
+
+/*
+ * Offset up to which both streams are known to be equal : the end of their
+ * last common span before the first different one
+ */
+uint64_t fingerprint_stream_diverge(const struct fingerprint_stream *stream1, const struct fingerprint_stream *stream2);
+
+/*
+ * Length of the first span of data, 0 if it does not end within size
+ * bytes. Its first scanned bytes are known to hold no cut.
+ */
+size_t fingerprint_span_cut(const uint8_t *data, const size_t scanned, const size_t size);
+
+static inline int fingerprint_equal(const struct fingerprint *fp1, const struct fingerprint *fp2)
+{
+	return fp1->h1 == fp2->h1 && fp1->h2 == fp2->h2;
+}
+
+#endif
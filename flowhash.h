@@ -0,0 +1,82 @@
+
+#ifndef __flowhash_h_666__
+# define __flowhash_h_666__
+
+# include <stdint.h>
+# include <stddef.h>
+# if defined(__x86_64__)
+#  include <nmmintrin.h>
+# endif
+
+/*
+ * Hashes of fixed size flow keys, given as FLOWHASH_WORDS 64-bit words so
+ * that the compiler unrolls everything : a CRC32C one on x86-64 CPUs with
+ * SSE4.2, and a portable multiply / xorshift one.
+ *
+ * The 32-bit result is mixed all over, callers mask the bits they need.
+ *
+ * CRC32C is linear over GF(2) : keys colliding under one seed collide under
+ * every seed, whatever the final mix. Only the multiply / xorshift one keeps
+ * a seeded table safe from crafted keys, the CRC32C one is left for trusted
+ * keys and benches.
+ */
+# define FLOWHASH_WORDS 6
+
+# define FLOWHASH_K1 0x9e3779b97f4a7c15ULL
+# define FLOWHASH_K2 0xff51afd7ed558ccdULL
+
+static inline uint32_t flowhash_mix(const uint64_t *w, const uint32_t seed)
+{
+	uint64_t h = seed ^ FLOWHASH_K2;
+
+	for (size_t i = 0 ; i < FLOWHASH_WORDS ; i ++) {
+		h = (h ^ w[i]) * FLOWHASH_K1;
+		h ^= h >> 32;
+	}
+
+	h *= FLOWHASH_K2;
+	h ^= h >> 29;
+	return h >> 32;
+}
+
+# if defined(__x86_64__)
+
+/*
+ * Two independent CRC lanes keep both CRC units busy, a final multiply
+ * spreads them over the upper bits
+ */
+__attribute__((target("sse4.2")))
+static inline uint32_t flowhash_crc(const uint64_t *w, const uint32_t seed)
+{
+	uint64_t c0 = seed;
+	uint64_t c1 = ~seed;
+
+	for (size_t i = 0 ; i < FLOWHASH_WORDS ; i += 2) {
+		c0 = _mm_crc32_u64(c0, w[i]);
+		if (i + 1 < FLOWHASH_WORDS)
+			c1 = _mm_crc32_u64(c1, w[i + 1]);
+	}
+
+	return ((c1 << 32 | c0) * FLOWHASH_K1) >> 32;
+}
+
+static inline int flowhash_crc_supported(void)
+{
+	return __builtin_cpu_supports("sse4.2");
+}
+
+# else
+
+static inline uint32_t flowhash_crc(const uint64_t *w, const uint32_t seed)
+{
+	return flowhash_mix(w, seed);
+}
+
+static inline int flowhash_crc_supported(void)
+{
+	return 0;
+}
+
+# endif
+
+#endif
@@ -4,6 +4,7 @@
 
 #include "frame.h"
 #include "rawprint.h"
+#include "bufpool.h"
 
 int frame_print_hw(FILE *file, const int depth, const struct frame_hw *hw)
 {
@@ -20,12 +21,35 @@ int frame_print_hw(FILE *file, const int depth, const struct frame_hw *hw)
 	return done;
 }
 
-static int print_net_ip(FILE *file, const int depth, const struct frame_net_ip *ip)
+const char *frame_addr_ntop(const struct frame_addr *addr, char *str, const size_t size)
+{
+	if (frame_addr_is_ipv4(addr))
+		return inet_ntop(AF_INET, &addr->u32[3], str, size);
+	return inet_ntop(AF_INET6, &addr->in6, str, size);
+}
+
+int frame_addr_pton(const char *str, struct frame_addr *addr)
+{
+	struct in_addr in;
+
+	if (inet_pton(AF_INET, str, &in) == 1) {
+		frame_addr_set_ipv4(addr, in.s_addr);
+		return 0;
+	}
+
+	if (inet_pton(AF_INET6, str, &addr->in6) == 1)
+		return 0;
+
+	return -1;
+}
+
+static int print_net_ip(FILE *file, const int depth, const char *name, const struct frame_net_ip *ip)
 {
 	int done = 0;
+	char str[INET6_ADDRSTRLEN];
 
-	done += fprintf(file, "%*sIP %s -> ", depth, "", inet_ntoa(ip->source));
-	done += fprintf(file, "%s\n", inet_ntoa(ip->dest));
+	done += fprintf(file, "%*s%s %s -> ", depth, "", name, frame_addr_ntop(&ip->source, str, sizeof str));
+	done += fprintf(file, "%s\n", frame_addr_ntop(&ip->dest, str, sizeof str));
 
 	return done;
 }
@@ -50,57 +74,58 @@ static int print_net_arp(FILE *file, const int depth, const struct frame_net_arp
 }
 
 
-int frame_print_net(FILE *file, const int depth, const struct frame_net *net)
+int frame_print_net(FILE *file, const int depth, const struct frame *frame, const struct frame_cold *cold)
 {
-	int done = 0;
-
-	switch (net->type) {
+	switch (frame->net_type) {
 	default:
 		return fprintf(file, "%*sNo net layer\n", depth, "");
 
 	case frame_net_type_arp:
-		return print_net_arp(file, depth, &net->arp);
+		if (cold == NULL)
+			return fprintf(file, "%*sARP\n", depth, "");
+		return print_net_arp(file, depth, &cold->arp);
 
 	case frame_net_type_ip:
-		return print_net_ip(file, depth, &net->ip);
-	}
-
-	return done;
+		return print_net_ip(file, depth, "IP", &frame->ip);
 
+	case frame_net_type_ipv6:
+		return print_net_ip(file, depth, "IPv6", &frame->ip);
+	}
 }
 
-int frame_print_app(FILE *file, const int depth, const struct frame_app *app)
+int frame_print_app(FILE *file, const int depth, const struct frame *frame)
 {
+	const uint32_t app_size = frame_app_size(frame);
 	int done = 0;
-	done += fprintf(file, "%*sData (%db)\n", depth, "", app->size);
-	if (app->size > 0)
-		done += rawprint(file, depth + 1, app->data, app->size, 8, 4);
+	done += fprintf(file, "%*sData (%ub)\n", depth, "", app_size);
+	if (app_size > 0)
+		done += rawprint(file, depth + 1, frame->app_data, app_size, 8, 4);
 	return done;
 }
 
-static int print_proto_udp(FILE *file, const int depth, const struct frame_proto_udp *udp)
+static int print_proto_udp(FILE *file, const int depth, const struct frame *frame)
 {
 	int done = 0;
-	done += fprintf(file, "%*sUDP %d -> %d\n", depth, "", htons(udp->hdr.source), htons(udp->hdr.dest));
+	done += fprintf(file, "%*sUDP %d -> %d\n", depth, "", htons(frame->source), htons(frame->dest));
 	return done;
 }
 
-static int print_proto_tcp(FILE *file, const int depth, const struct frame_proto_tcp *tcp, const int full)
+static int print_proto_tcp(FILE *file, const int depth, const struct frame *frame, const struct frame_cold *cold, const int full)
 {
 	int done = 0;
-	const struct tcphdr *hdr = &tcp->hdr;
+	const uint8_t flags = frame->tcp_flags;
 
-	done += fprintf(file, "%*sTCP %d -> %d ", depth, "", htons(hdr->source), htons(hdr->dest));
-	done += fprintf(file, "flags = [ %s%s%s%s%s%s], [seq = %u, sack_seq = %u]\n", hdr->urg ? "URG " : "", hdr->syn ? "SYN " : "", hdr->fin ? "FIN " : "", hdr->ack ? "ACK " : "", hdr->psh ? "PSH " : "", hdr->rst ? "RST " : "", htonl(hdr->seq), htonl(hdr->ack_seq));
+	done += fprintf(file, "%*sTCP %d -> %d ", depth, "", htons(frame->source), htons(frame->dest));
+	done += fprintf(file, "flags = [ %s%s%s%s%s%s], [seq = %u, sack_seq = %u]\n", (flags & TH_URG) ? "URG " : "", (flags & TH_SYN) ? "SYN " : "", (flags & TH_FIN) ? "FIN " : "", (flags & TH_ACK) ? "ACK " : "", (flags & TH_PUSH) ? "PSH " : "", (flags & TH_RST) ? "RST " : "", htonl(frame->seq), htonl(frame->ack_seq));
 
-	if (full) {
-		for (uint16_t idx = 0 ; idx < tcp->opt_size ; ) {
+	if (full && cold != NULL) {
+		for (uint16_t idx = 0 ; idx < cold->tcp_opt_size ; ) {
 			uint8_t opt_val_len;
 
-			switch (tcp->opt[idx]) {
+			switch (cold->tcp_opt[idx]) {
 			case 0:
 				/* End */
-				idx = tcp->opt_size;
+				idx = cold->tcp_opt_size;
 				break;
 
 			case 1:
@@ -109,14 +134,14 @@ static int print_proto_tcp(FILE *file, const int depth, const struct frame_proto
 				break;
 
 			default:
-				opt_val_len = tcp->opt[idx + 1];
+				opt_val_len = cold->tcp_opt[idx + 1];
 				if (opt_val_len == 0) {
 					fprintf(stderr, "Invalid TCP option len");
 					break;
 				}
 
-				done += fprintf(file, "%*sOPCODE  = %#02x (%db)\n", depth + 1, "", tcp->opt[idx], opt_val_len);
-				rawprint(stdout, depth + 2, tcp->opt + idx, opt_val_len, 4, 1);
+				done += fprintf(file, "%*sOPCODE  = %#02x (%db)\n", depth + 1, "", cold->tcp_opt[idx], opt_val_len);
+				rawprint(stdout, depth + 2, cold->tcp_opt + idx, opt_val_len, 4, 1);
 				idx += opt_val_len;
 				break;
 			}
@@ -126,62 +151,59 @@ static int print_proto_tcp(FILE *file, const int depth, const struct frame_proto
 	return done;
 }
 
-int frame_print_proto(FILE *file, const int depth, const struct frame_proto *proto, const int full)
+int frame_print_proto(FILE *file, const int depth, const struct frame *frame, const struct frame_cold *cold, const int full)
 {
-	switch (proto->type) {
+	switch (frame->proto_type) {
 	default:
 		return fprintf(file, "%*sNo proto layer\n", depth, "");
 
 	case frame_proto_type_udp:
-		return print_proto_udp(file, depth, &proto->udp);
+		return print_proto_udp(file, depth, frame);
 
 	case frame_proto_type_tcp:
-		return print_proto_tcp(file, depth, &proto->tcp, full);
+		return print_proto_tcp(file, depth, frame, cold, full);
 	}
 }
 
-int frame_print(FILE *file, const int depth, const struct frame *frame, const int full)
+int frame_print(FILE *file, const int depth, const struct frame *frame, const struct frame_cold *cold, const int full)
 {
 	int done = 0;
+	const struct timeval ts = frame_ts(frame);
 
-	done += fprintf(file, "%*s[%lds, %ldus]\n", depth, "", frame->ts.tv_sec, frame->ts.tv_usec);
-	done += frame_print_hw(file, depth + 1, &frame->hw);
-	done += frame_print_net(file, depth + 2, &frame->net);
-	done += frame_print_proto(file, depth + 3, &frame->proto, full);
-	done += frame_print_app(file, depth + 4, &frame->app);
+	done += fprintf(file, "%*s[%lds, %ldus]\n", depth, "", ts.tv_sec, ts.tv_usec);
+	if (cold != NULL)
+		done += frame_print_hw(file, depth + 1, &cold->hw);
+	done += frame_print_net(file, depth + 2, frame, cold);
+	done += frame_print_proto(file, depth + 3, frame, cold, full);
+	done += frame_print_app(file, depth + 4, frame);
 
 	return done;
 }
 
-int frame_init(struct frame *frame, const struct timeval *ts)
+int frame_init(struct frame *frame, struct frame_cold *cold, const struct timeval *ts)
 {
 	memset(frame, 0, sizeof frame[0]);
-	if (ts != NULL) {
-
-		memset(&frame->ts, 0, sizeof frame->ts);
-		timeradd(&frame->ts, ts, &frame->ts); /* Normalize timestamps */
-		frame->ts = *ts;
-	}
+	if (cold != NULL)
+		memset(cold, 0, sizeof cold[0]);
+	if (ts != NULL)
+		frame->ts = (uint64_t)ts->tv_sec * 1000000 + ts->tv_usec;
 	return 0;
 }
 
-void frame_deinit(struct frame *frame)
+void frame_deinit(struct frame *frame, struct frame_cold *cold)
 {
-	if (frame->proto.type == frame_proto_type_tcp)
-		free(frame->proto.tcp.opt);
-	free(frame->app.data);
-	frame_init(frame, NULL);
+	bufpool_free(frame->app_data);
+	frame_init(frame, cold, NULL);
 }
 
 size_t frame_steal_app(struct frame *frame, uint8_t **data_ptr)
 {
 	size_t ret;
 
-	if (frame->app.size > 0 && frame->app.data != NULL) {
-		*data_ptr = frame->app.data;
-		ret = frame->app.size;
-		frame->app.data = NULL;
-		frame->app.size = 0;
+	if (frame->app_data != NULL) {
+		*data_ptr = frame->app_data;
+		ret = frame_app_size(frame);
+		frame->app_data = NULL;
 	} else {
 		*data_ptr = NULL;
 		ret = 0;
@@ -190,10 +212,12 @@ size_t frame_steal_app(struct frame *frame, uint8_t **data_ptr)
 	return ret;
 }
 
-void frame_update_app(struct frame *frame, uint8_t *data, size_t size)
+/*
+ * data comes from the buffer pool, its size goes with it
+ */
+void frame_update_app(struct frame *frame, uint8_t *data)
 {
-	if (frame->app.data != NULL)
-		free(frame->app.data);
-	frame->app.data = data;
-	frame->app.size = size;
+	if (frame->app_data != NULL)
+		bufpool_free(frame->app_data);
+	frame->app_data = data;
 }
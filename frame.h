@@ -7,16 +7,32 @@
 # include <netinet/tcp.h>
 # include <arpa/inet.h>
 # include <stdio.h>
+# include <string.h>
 # include <sys/time.h>
 
+# include "bufpool.h"
+
 struct frame_hw {
 	uint8_t  source[ETH_ALEN]; /* source ether addr	*/
 	uint8_t  dest[ETH_ALEN];   /* destination eth addr	*/
 };
 
+/*
+ * IPv4 and IPv6 addresses share the same 128-bit layout, IPv4 ones being
+ * stored as IPv4-mapped IPv6 addresses (::ffff:a.b.c.d)
+ */
+struct frame_addr {
+	union {
+		uint8_t u8[16];
+		uint32_t u32[4];
+		uint64_t u64[2];
+		struct in6_addr in6;
+	};
+};
+
 struct frame_net_ip {
-	struct in_addr source;	/* source IP addr	*/
-	struct in_addr dest;	/* destination IP addr	*/
+	struct frame_addr source;	/* source IP addr	*/
+	struct frame_addr dest;		/* destination IP addr	*/
 };
 
 struct frame_net_arp {
@@ -30,24 +46,7 @@ struct frame_net_arp {
 enum frame_net_type {
 	frame_net_type_arp = 1,
 	frame_net_type_ip,
-};
-
-struct frame_net {
-	enum frame_net_type type;
-	union {
-		struct frame_net_ip ip;
-		struct frame_net_arp arp;
-	};
-};
-
-struct frame_proto_udp {
-	struct udphdr hdr;
-};
-
-struct frame_proto_tcp {
-	struct tcphdr hdr;
-	uint16_t opt_size;
-	uint8_t *opt;
+	frame_net_type_ipv6,
 };
 
 enum frame_proto_type {
@@ -55,36 +54,87 @@ enum frame_proto_type {
 	frame_proto_type_tcp,
 };
 
-struct frame_proto {
-	enum frame_proto_type type;
-	union {
-		struct frame_proto_udp udp;
-		struct frame_proto_tcp tcp;
-	};
-};
-
-struct frame_app {
-	uint8_t *data;
-	uint32_t size;
-};
-
+/*
+ * Hot part of a frame : everything the session stage reads fits in a single
+ * cache line. Header fields are kept in network order.
+ */
 struct frame {
+	struct frame_net_ip ip;		/* Both IPv4 and IPv6 */
+	uint64_t ts;			/* Capture time (us) */
+	uint8_t *app_data;
+	uint32_t seq;			/* TCP only */
+	uint32_t ack_seq;		/* TCP only */
+	uint16_t source;		/* source port		*/
+	uint16_t dest;			/* destination port	*/
+	uint8_t tcp_flags;
+	uint8_t net_type : 3;		/* enum frame_net_type */
+	uint8_t proto_type : 3;		/* enum frame_proto_type */
+	uint8_t tcp_zero_window : 1;	/* TCP only, advertised window is 0 */
+} __attribute__((aligned(64)));
+
+_Static_assert(sizeof(struct frame) == 64, "struct frame must fit in a cache line");
+
+/*
+ * Payloads are bufpool buffers : their length is kept in the buffer header,
+ * next to the bytes, rather than in the cache line
+ */
+static inline uint32_t frame_app_size(const struct frame *frame)
+{
+	return frame->app_data == NULL ? 0 : bufpool_size(frame->app_data);
+}
+
+/* TCP options fit in the 40 bytes a data offset of 15 leaves */
+# define FRAME_TCP_OPT_MAX	40
+
+/*
+ * Cold part of a frame, only read when printing it
+ */
+struct frame_cold {
 	struct frame_hw hw;
-	struct frame_net net;
-	struct frame_proto proto;
-	struct frame_app app;
-	struct timeval ts;
+	struct frame_net_arp arp;	/* When net_type is frame_net_type_arp */
+	uint16_t tcp_opt_size;
+	uint8_t tcp_opt[FRAME_TCP_OPT_MAX];
 };
 
+static inline void frame_addr_set_ipv4(struct frame_addr *addr, const uint32_t s_addr)
+{
+	addr->u64[0] = 0;
+	addr->u32[2] = htonl(0xffff);
+	addr->u32[3] = s_addr;
+}
+
+static inline int frame_addr_is_ipv4(const struct frame_addr *addr)
+{
+	return addr->u64[0] == 0 && addr->u32[2] == htonl(0xffff);
+}
+
+static inline int frame_addr_is_any(const struct frame_addr *addr)
+{
+	return (addr->u64[0] | addr->u64[1]) == 0 || (frame_addr_is_ipv4(addr) && addr->u32[3] == INADDR_ANY);
+}
+
+static inline struct timeval frame_ts(const struct frame *frame)
+{
+	return (struct timeval){ .tv_sec = frame->ts / 1000000, .tv_usec = frame->ts % 1000000 };
+}
+
+static inline int frame_addr_equal(const struct frame_addr *addr1, const struct frame_addr *addr2)
+{
+	return ((addr1->u64[0] ^ addr2->u64[0]) | (addr1->u64[1] ^ addr2->u64[1])) == 0;
+}
+
+const char *frame_addr_ntop(const struct frame_addr *addr, char *str, const size_t size);
+int frame_addr_pton(const char *str, struct frame_addr *addr);
+
 int frame_print_hw(FILE *file, const int depth, const struct frame_hw *hw);
-int frame_print_net(FILE *file, const int depth, const struct frame_net *net);
-int frame_print_proto(FILE *file, const int depth, const struct frame_proto *proto, const int full);
-int frame_print_app(FILE *file, const int depth, const struct frame_app *app);
-int frame_print(FILE *file, const int depth, const struct frame *frame, const int full);
+int frame_print_net(FILE *file, const int depth, const struct frame *frame, const struct frame_cold *cold);
+int frame_print_proto(FILE *file, const int depth, const struct frame *frame, const struct frame_cold *cold, const int full);
+int frame_print_app(FILE *file, const int depth, const struct frame *frame);
+int frame_print(FILE *file, const int depth, const struct frame *frame, const struct frame_cold *cold, const int full);
 
-int frame_init(struct frame *frame, const struct timeval *ts);
-void frame_deinit(struct frame *frame);
+int frame_init(struct frame *frame, struct frame_cold *cold, const struct timeval *ts);
+void frame_deinit(struct frame *frame, struct frame_cold *cold);
 size_t frame_steal_app(struct frame *frame, uint8_t **data_ptr);
-void frame_update_app(struct frame *frame, uint8_t *data, size_t size);
+void frame_update_app(struct frame *frame, uint8_t *data);
 
 #endif
@@ -1,168 +1,56 @@
 
 #include <stdlib.h>
 #include <string.h>
-#include <errno.h>
 
 #include "frame_list.h"
+#include "pagemem.h"
 
-enum {
-	pool_inc = 16,
-};
-
-int frame_list_init(struct frame_list *list)
-{
-	memset(list, 0, sizeof list[0]);
-	return 0;
-}
-
-static void list_link_first(struct frame_list *list, struct frame_node *node)
-{
-	node->prev = NULL;
-	node->next = list->first;
-
-	if (list->first != NULL)
-		list->first->prev = node;
-	else
-		list->last = node;
-	list->first = node;
-	list->count ++;
-	if (list->count == 0)
-		abort();
-}
-
-static void list_link_last(struct frame_list *list, struct frame_node *node)
-{
-	node->prev = list->last;
-	node->next = NULL;
-
-	if (list->last != NULL)
-		list->last->next = node;
-	else
-		list->first = node;
-	list->last = node;
-	list->count ++;
-	if (list->count == 0)
-		abort();
-}
-
-static void list_link_after(struct frame_list *list, struct frame_node *after, struct frame_node *node)
-{
-	node->prev = after;
-	node->next = after->next;
-
-	if (after->next != NULL)
-		after->next->prev = node;
-	else
-		list->last = node;
-	after->next = node;
-	list->count ++;
-	if (list->count == 0)
-		abort();
-}
-
-void frame_list_unlink(struct frame_list *list, struct frame_node *node)
-{
-	if (list->count == 0)
-		abort();
-
-	if (node->prev != NULL)
-		node->prev->next = node->next;
-	else
-		list->first = node->next;
-
-	if (node->next != NULL)
-		node->next->prev = node->prev;
-	else
-		list->last = node->prev;
-	node->next = NULL;
-	node->prev = NULL;
-	list->count --;
-}
-
-void frame_list_link_ordered_ext(struct frame_list *list, struct frame_node *node, frame_node_cmp_fun_t cmp_fun)
-{
-	struct frame_node *node_after;
-
-	for (node_after = list->last ; node_after != NULL ; node_after = node_after->prev) {
-		if (cmp_fun(node, node_after) >= 0)
-			break;
-	}
-
-	if (node_after != NULL)
-		list_link_after(list, node_after, node);
-	else
-		list_link_first(list, node);
-}
-
-static int frame_node_cmp_ts(const struct frame_node *node1, const struct frame_node *node2)
-{
-	if (timercmp(&node1->frame.ts, &node2->frame.ts, <))
-		return -1;
-
-	if (timercmp(&node1->frame.ts, &node2->frame.ts, >))
-		return 1;
-
-	return 0;
-}
-
-void frame_list_link_ordered(struct frame_list *list, struct frame_node *node)
-{
-	frame_list_link_ordered_ext(list, node, frame_node_cmp_ts);
-}
-
-void frame_list_free(struct frame_list *list)
+int frame_table_init(struct frame_table *table, const size_t max_nodes, const int pagemem_flags)
 {
-	struct frame_node *node;
-
-	node = list->first;
-	while (node != NULL) {
-		struct frame_node *next = node->next;
-
-		if (list->count == 0)
-			abort();
-
-		frame_deinit(&node->frame);
-		free(node);
-		node = next;
+	memset(table, 0, sizeof table[0]);
 
-		list->count --;
+	/* Nodes are indexed on 32 bits, FRAME_NODE_NONE excluded */
+	if (max_nodes == 0 || max_nodes >= FRAME_NODE_NONE) {
+		fprintf(stderr, "Invalid frame table size : %zd (1 to %u)\n", max_nodes, FRAME_NODE_NONE - 1);
+		goto err;
 	}
-	if (list->count != 0)
-		abort();
-}
-
-int frame_table_init(struct frame_table *table)
-{
-	memset(table, 0, sizeof table[0]);
 
-	if (frame_list_init(&table->free_list) < 0)
+	table->reserved = max_nodes;
+	table->nodes = pagemem_map(table->reserved * sizeof table->nodes[0], pagemem_flags | PAGEMEM_FLAGS_RESERVE);
+	if (table->nodes == NULL)
 		goto err;
 
-	if (frame_list_init(&table->used_list) < 0)
-		goto free_free_list_err;
+	table->cold = pagemem_map(table->reserved * sizeof table->cold[0], PAGEMEM_FLAGS_RESERVE);
+	if (table->cold == NULL)
+		goto unmap_err;
+
+	table->free_first = FRAME_NODE_NONE;
 	return 0;
 
-free_free_list_err:
-	frame_list_free(&table->free_list);
+unmap_err:
+	pagemem_unmap(table->nodes, table->reserved * sizeof table->nodes[0]);
 err:
 	return -1;
 }
 
 void frame_node_recycle(struct frame_table *table, struct frame_node *node)
 {
-	/*
-	 * Move this node from used_list to free_list
-	 */
-	frame_list_unlink(&table->used_list, node);
-	list_link_last(&table->free_list, node);
-	frame_deinit(&node->frame);
+	frame_deinit(&node->frame, frame_node_cold(table, node));
+	node->free_next = table->free_first;
+	table->free_first = node - table->nodes;
+	table->free_count ++;
 }
 
+/*
+ * Free nodes were deinit when recycled : deinit them again is harmless
+ */
 void frame_table_free(struct frame_table *table)
 {
+	for (uint32_t idx = 0 ; idx < table->carved ; idx ++)
+		frame_deinit(&table->nodes[idx].frame, &table->cold[idx]);
 
-	frame_list_free(&table->used_list);
-	frame_list_free(&table->free_list);
+	pagemem_unmap(table->cold, table->reserved * sizeof table->cold[0]);
+	pagemem_unmap(table->nodes, table->reserved * sizeof table->nodes[0]);
 	memset(table, 0, sizeof table[0]);
 }
 
@@ -170,45 +58,23 @@ struct frame_node *frame_node_new(struct frame_table *table, const struct timeva
 {
 	struct frame_node *node;
 
-	if (table->free_list.first == NULL) {
-
-		for (size_t i = 0 ; i < pool_inc ; i++) {
-			node = calloc(1, sizeof node[0]);
-			if (node == NULL) {
-				fprintf(stderr, "Failed to extend pool : %s\n", strerror(errno));
-				if (i == 0) {
-					fprintf(stderr, "Cannot add a single new frame\n");
-					goto err;
-				}
-				break;
-			}
-			list_link_last(&table->free_list, node);
+	if (table->free_first != FRAME_NODE_NONE) {
+		node = &table->nodes[table->free_first];
+		table->free_first = node->free_next;
+		table->free_count --;
+	} else {
+		if (table->carved >= table->reserved) {
+			fprintf(stderr, "Frame table full : all %zd frames are in use, raise -max-frames\n", table->reserved);
+			goto err;
 		}
+		node = &table->nodes[table->carved ++];
 	}
 
-	/*
-	 * Get the first node from free_list
-	 */
-	node = table->free_list.first;
-	if (node == NULL)
-		abort();
-	if (frame_init(&node->frame, ts) < 0)
+	if (frame_init(&node->frame, frame_node_cold(table, node), ts) < 0)
 		goto err;
-	frame_list_unlink(&table->free_list, node);
-	frame_list_link_ordered(&table->used_list, node);
 	return node;
 
 err:
 	return NULL;
 
 }
-
-int frame_list_dump(FILE *file, const int depth, const struct frame_list *list, const int full)
-{
-	int done = 0;
-
-	for (const struct frame_node *node = list->first ; node != NULL ; node = node->next)
-		done += frame_print(file, depth + 1, &node->frame, full);
-
-	return done;
-}
@@ -4,38 +4,41 @@
 
 # include "frame.h"
 
+/*
+ * Address space reserved for the frame nodes by default, pages are only
+ * backed when nodes are first used
+ */
+# define FRAME_TABLE_DEFAULT_NODES (1 << 26)
+# define FRAME_NODE_NONE UINT32_MAX
+
+/*
+ * Nodes only hold the hot part of their frame, the cold part sits at the
+ * same index in a separate array
+ */
 struct frame_node {
-	struct frame frame;
-	struct frame_node *next;
-	struct frame_node *prev;
-};
-
-struct frame_list {
-	struct frame_node *first;
-	struct frame_node *last;
-	size_t count;
+	union {
+		struct frame frame;
+		uint32_t free_next; /* Index of the next free node, while on the free list */
+	};
 };
 
 struct frame_table {
-	struct frame_list free_list;
-	struct frame_list used_list;
+	struct frame_node *nodes;
+	struct frame_cold *cold;
+	size_t reserved;	/* Nodes reserved in nodes and cold */
+	uint32_t carved;	/* Nodes handed out at least once */
+	uint32_t free_first;	/* Free list head, FRAME_NODE_NONE if empty */
+	size_t free_count;
 };
 
-typedef int (*frame_node_cmp_fun_t)(const struct frame_node *node1, const struct frame_node *node2);
-
-int frame_table_init(struct frame_table *table);
+int frame_table_init(struct frame_table *table, const size_t max_nodes, const int pagemem_flags);
 void frame_table_free(struct frame_table *table);
 struct frame_node *frame_node_new(struct frame_table *table, const struct timeval *ts);
 void frame_node_recycle(struct frame_table *table, struct frame_node *node);
 
-int frame_list_init(struct frame_list *list);
-void frame_list_free(struct frame_list *list);
-
-void frame_list_unlink(struct frame_list *list, struct frame_node *node);
-
-void frame_list_link_ordered_ext(struct frame_list *list, struct frame_node *node, frame_node_cmp_fun_t cmd_fun);
-void frame_list_link_ordered(struct frame_list *list, struct frame_node *node);
-
-int frame_list_dump(FILE *file, const int depth, const struct frame_list *list, const int full);
+static inline struct frame_cold *frame_node_cold(const struct frame_table *table, const struct frame_node *node)
+{
+	return &table->cold[node - table->nodes];
+}
 
 #endif
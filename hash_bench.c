@@ -0,0 +1,247 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <arpa/inet.h>
+
+#include "session_hash.h"
+#include "flowhash.h"
+
+/*
+ * Distribution and throughput of the session key hashes, against the
+ * MurmurHash_32 / modulo 1021 pair they replaced
+ */
+
+#define DEFAULT_COUNT (1024 * 1024)
+#define ROUNDS 16
+#define OLD_BUCKETS 1021
+
+static uint32_t MurmurHash_32(const void *key, uint32_t len, const uint32_t seed)
+{
+	const uint32_t m = 0x5bd1e995;
+	const int r = 24;
+	uint32_t h = seed ^ len;
+	const uint8_t *data = key;
+
+	while (len >= 4) {
+		uint32_t k;
+
+		memcpy(&k, data, sizeof k);
+		k *= m;
+		k ^= k >> r;
+		k *= m;
+
+		h *= m;
+		h ^= k;
+
+		data += 4;
+		len -= 4;
+	}
+
+	switch (len) {
+	case 3:
+		h ^= data[2] << 16; // fall through
+	case 2:
+		h ^= data[1] << 8; // fall through
+	case 1:
+		h ^= data[0];
+		h *= m;
+	};
+
+	h ^= h >> 13;
+	h *= m;
+	h ^= h >> 15;
+
+	return h;
+}
+
+static uint32_t hash_murmur(const struct session_key *key, const uint32_t seed)
+{
+	return MurmurHash_32(key, sizeof key[0], seed) % OLD_BUCKETS;
+}
+
+static uint32_t hash_mix(const struct session_key *key, const uint32_t seed)
+{
+	return flowhash_mix(key->w, seed);
+}
+
+static uint32_t hash_crc(const struct session_key *key, const uint32_t seed)
+{
+	return flowhash_crc(key->w, seed);
+}
+
+static const struct {
+	const char *name;
+	uint32_t (*fun)(const struct session_key *key, const uint32_t seed);
+	int modulo;	/* Result is already a bucket */
+} hash_table[] = {
+	{ "murmur % 1021", hash_murmur, 1 },
+	{ "multiply-xorshift", hash_mix, 0 },
+	{ "crc32c", hash_crc, 0 },
+};
+
+enum key_set {
+	key_set_ports,	/* One client, one server, every client port */
+	key_set_hosts,	/* Sequential IPv4 clients to one server port */
+	key_set_ipv6,	/* Random IPv6 endpoints */
+	key_set_max,
+};
+
+static const char *key_set_name[key_set_max] = {
+	[key_set_ports] = "client ports",
+	[key_set_hosts] = "ipv4 hosts",
+	[key_set_ipv6] = "random ipv6",
+};
+
+static void key_set(struct session_key *key, const struct frame_addr *a1, const uint16_t p1, const struct frame_addr *a2, const uint16_t p2)
+{
+	memset(key, 0, sizeof key[0]);
+	key->a1 = *a1;
+	key->a2 = *a2;
+	key->p1 = p1;
+	key->p2 = p2;
+}
+
+static void keys_fill(struct session_key *keys, const size_t count, const enum key_set set)
+{
+	struct frame_addr client;
+	struct frame_addr server;
+
+	frame_addr_set_ipv4(&server, htonl(0x0aff0001));
+
+	for (size_t i = 0 ; i < count ; i ++) {
+		switch (set) {
+		case key_set_ports:
+			frame_addr_set_ipv4(&client, htonl(0x0a000001 + (uint32_t)(i / 64512)));
+			key_set(&keys[i], &client, htons(1024 + i % 64512), &server, htons(80));
+			break;
+
+		case key_set_hosts:
+			frame_addr_set_ipv4(&client, htonl(0x0a000001 + (uint32_t)i));
+			key_set(&keys[i], &client, htons(40000), &server, htons(443));
+			break;
+
+		case key_set_ipv6:
+		default:
+			for (size_t j = 0 ; j < 4 ; j ++) {
+				client.u32[j] = rand();
+				server.u32[j] = rand();
+			}
+			key_set(&keys[i], &client, rand(), &server, rand());
+			break;
+		}
+	}
+}
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*
+ * Chi-square of the bucket loads divided by its degrees of freedom : close to
+ * 1 for a uniform hash, the worst bucket load is given next to it
+ */
+static void distribution(const struct session_key *keys, const size_t count, const size_t h, double *chi2_ptr, uint32_t *max_ptr)
+{
+	size_t buckets = OLD_BUCKETS;
+	uint32_t *load;
+	uint32_t max = 0;
+	double expected;
+	double chi2 = 0;
+
+	/* As many groups as a session_hash holding count keys */
+	if (!hash_table[h].modulo) {
+		buckets = 1;
+		while (buckets * SESSION_HASH_GROUP < count)
+			buckets *= 2;
+	}
+	expected = (double)count / buckets;
+
+	load = calloc(buckets, sizeof load[0]);
+	if (load == NULL)
+		abort();
+
+	for (size_t i = 0 ; i < count ; i ++) {
+		uint32_t v = hash_table[h].fun(&keys[i], 0x5eed);
+
+		if (!hash_table[h].modulo)
+			v = (v >> 7) & (buckets - 1); /* The group bits of session_hash */
+		load[v] ++;
+	}
+
+	for (size_t b = 0 ; b < buckets ; b ++) {
+		chi2 += (load[b] - expected) * (load[b] - expected) / expected;
+		if (load[b] > max)
+			max = load[b];
+	}
+
+	free(load);
+	*chi2_ptr = chi2 / (buckets - 1);
+	*max_ptr = max;
+}
+
+static double throughput(const struct session_key *keys, const size_t count, const size_t h)
+{
+	volatile uint32_t sink = 0;
+	uint32_t acc = 0;
+	double t0;
+
+	t0 = now();
+	for (int round = 0 ; round < ROUNDS ; round ++) {
+		for (size_t i = 0 ; i < count ; i ++)
+			acc += hash_table[h].fun(&keys[i], round);
+	}
+	sink = acc;
+	(void)sink;
+
+	return (now() - t0) * 1e9 / ((double)count * ROUNDS);
+}
+
+int main(int ac, char **av)
+{
+	struct session_key *keys;
+	size_t count = DEFAULT_COUNT;
+
+	if (ac > 1) {
+		char *end;
+
+		count = strtoul(av[1], &end, 0);
+		if (*end != 0 || count < 2) {
+			fprintf(stderr, "Usage: %s [ key count (%d) ]\n", av[0], DEFAULT_COUNT);
+			return 1;
+		}
+	}
+
+	keys = aligned_alloc(sizeof keys[0], count * sizeof keys[0]);
+	if (keys == NULL) {
+		fprintf(stderr, "Failed to allocate %zd keys\n", count);
+		return 1;
+	}
+
+	if (!flowhash_crc_supported())
+		printf("No SSE4.2, crc32c falls back to multiply-xorshift\n");
+
+	printf("%-14s %-20s %10s %10s %10s\n", "keys", "hash", "chi2/df", "max load", "ns/hash");
+	for (int set = 0 ; set < key_set_max ; set ++) {
+		keys_fill(keys, count, set);
+
+		for (size_t h = 0 ; h < sizeof hash_table / sizeof hash_table[0] ; h ++) {
+			double chi2;
+			uint32_t max;
+
+			if (hash_table[h].fun == hash_crc && !flowhash_crc_supported())
+				continue;
+
+			distribution(keys, count, h, &chi2, &max);
+			printf("%-14s %-20s %10.3f %10u %10.2f\n", key_set_name[set], hash_table[h].name, chi2, max, throughput(keys, count, h));
+		}
+	}
+
+	free(keys);
+	return 0;
+}
@@ -0,0 +1,231 @@
+#include <string.h>
+
+#include "lz.h"
+
+#define LZ_HASH_MIN_BITS 8
+#define LZ_SKIP_SHIFT 6		/* Search faster through incompressible data */
+#define LZ_FAST_COPY 16
+
+static inline uint32_t load32(const uint8_t *p)
+{
+	uint32_t v;
+
+	memcpy(&v, p, sizeof v);
+	return v;
+}
+
+static inline uint64_t load64(const uint8_t *p)
+{
+	uint64_t v;
+
+	memcpy(&v, p, sizeof v);
+	return v;
+}
+
+static inline uint32_t hash32(const uint32_t v, const unsigned bits)
+{
+	return (v * 2654435761U) >> (32 - bits);
+}
+
+/*
+ * Lengths above 14 go on in bytes of 255, then the remainder
+ */
+static uint8_t *put_length(uint8_t *op, const uint8_t *oend, size_t len)
+{
+	while (len >= 255) {
+		if (op >= oend)
+			return NULL;
+		*op ++ = 255;
+		len -= 255;
+	}
+
+	if (op >= oend)
+		return NULL;
+	*op ++ = len;
+	return op;
+}
+
+/*
+ * match_len is 0 for the last sequence, literals only
+ */
+static uint8_t *put_sequence(uint8_t *op, const uint8_t *oend, const uint8_t *literal, const size_t literal_len, const size_t offset, size_t match_len)
+{
+	uint8_t *token;
+
+	if (op >= oend)
+		return NULL;
+	token = op ++;
+
+	*token = (literal_len < 15 ? literal_len : 15) << 4;
+	if (literal_len >= 15 && (op = put_length(op, oend, literal_len - 15)) == NULL)
+		return NULL;
+
+	if ((size_t)(oend - op) < literal_len)
+		return NULL;
+	memcpy(op, literal, literal_len);
+	op += literal_len;
+
+	if (match_len == 0)
+		return op;
+
+	if (oend - op < 2)
+		return NULL;
+	*op ++ = offset;
+	*op ++ = offset >> 8;
+
+	match_len -= LZ_MIN_MATCH;
+	*token |= match_len < 15 ? match_len : 15;
+	if (match_len >= 15 && (op = put_length(op, oend, match_len - 15)) == NULL)
+		return NULL;
+
+	return op;
+}
+
+size_t lz_compress(const uint8_t *src, const size_t size, uint8_t *dst, const size_t capacity)
+{
+	uint32_t table[1 << LZ_HASH_BITS];
+	const uint8_t *end = src + size;
+	const uint8_t *anchor = src;
+	const uint8_t *ip = src;
+	const uint8_t *oend = dst + capacity;
+	uint8_t *op = dst;
+	unsigned bits = LZ_HASH_MIN_BITS;
+
+	while (bits < LZ_HASH_BITS && (1U << bits) < size)
+		bits ++;
+	memset(table, 0, sizeof table[0] << bits);
+
+	while (size >= LZ_MIN_MATCH && ip <= end - LZ_MIN_MATCH) {
+		const uint32_t seq = load32(ip);
+		const uint32_t h = hash32(seq, bits);
+		const uint8_t *ref = src + table[h];
+		const uint8_t *match;
+
+		table[h] = ip - src;
+		if (ref >= ip || ip - ref > LZ_MAX_OFFSET || load32(ref) != seq) {
+			ip += 1 + ((ip - anchor) >> LZ_SKIP_SHIFT);
+			continue;
+		}
+
+		/* Extend the match a word at a time, the first differing byte ends it */
+		match = ip + LZ_MIN_MATCH;
+		ref += LZ_MIN_MATCH;
+		while (match + sizeof(uint64_t) <= end) {
+			const uint64_t diff = load64(match) ^ load64(ref);
+
+			if (diff != 0) {
+				match += __builtin_ctzll(diff) / 8;
+				ref += __builtin_ctzll(diff) / 8;
+				break;
+			}
+			match += sizeof(uint64_t);
+			ref += sizeof(uint64_t);
+		}
+		if (match + sizeof(uint64_t) > end) {
+			while (match < end && *match == *ref) {
+				match ++;
+				ref ++;
+			}
+		}
+
+		op = put_sequence(op, oend, anchor, ip - anchor, match - ref, match - ip);
+		if (op == NULL)
+			return 0;
+		ip = match;
+		anchor = ip;
+	}
+
+	op = put_sequence(op, oend, anchor, end - anchor, 0, 0);
+	if (op == NULL)
+		return 0;
+	return op - dst;
+}
+
+static int get_length(const uint8_t **ip_ptr, const uint8_t *iend, size_t *len_ptr)
+{
+	const uint8_t *ip = *ip_ptr;
+	uint8_t byte;
+
+	do {
+		if (ip >= iend)
+			return -1;
+		byte = *ip ++;
+		*len_ptr += byte;
+	} while (byte == 255);
+
+	*ip_ptr = ip;
+	return 0;
+}
+
+ssize_t lz_decompress(const uint8_t *src, const size_t size, uint8_t *dst, const size_t capacity)
+{
+	const uint8_t *ip = src;
+	const uint8_t *iend = src + size;
+	uint8_t *op = dst;
+	uint8_t *oend = dst + capacity;
+
+	while (ip < iend) {
+		const uint8_t token = *ip ++;
+		const uint8_t *ref;
+		size_t offset;
+		size_t len;
+
+		len = token >> 4;
+		if (len == 15 && get_length(&ip, iend, &len) < 0)
+			goto err;
+		if ((size_t)(iend - ip) < len || (size_t)(oend - op) < len)
+			goto err;
+
+		/* Short literals : a fixed size copy is cheaper, when room allows */
+		if (len <= LZ_FAST_COPY && iend - ip >= LZ_FAST_COPY && oend - op >= LZ_FAST_COPY)
+			memcpy(op, ip, LZ_FAST_COPY);
+		else
+			memcpy(op, ip, len);
+		op += len;
+		ip += len;
+
+		if (ip == iend)
+			break;
+
+		if (iend - ip < 2)
+			goto err;
+		offset = ip[0] | ip[1] << 8;
+		ip += 2;
+		if (offset == 0 || offset > (size_t)(op - dst))
+			goto err;
+
+		len = token & 15;
+		if (len == 15 && get_length(&ip, iend, &len) < 0)
+			goto err;
+		len += LZ_MIN_MATCH;
+		if ((size_t)(oend - op) < len)
+			goto err;
+
+		/*
+		 * A match overlapping its output repeats a pattern : each copy
+		 * doubles the bytes available behind
+		 */
+		ref = op - offset;
+		if (offset >= sizeof(uint64_t) && (size_t)(oend - op) >= len + sizeof(uint64_t)) {
+			/* Words never read bytes not written yet */
+			for (size_t i = 0 ; i < len ; i += sizeof(uint64_t))
+				memcpy(op + i, ref + i, sizeof(uint64_t));
+			op += len;
+			continue;
+		}
+
+		while (len > offset) {
+			memcpy(op, ref, offset);
+			op += offset;
+			len -= offset;
+			offset *= 2;
+		}
+		memcpy(op, ref, len);
+		op += len;
+	}
+
+	return op - dst;
+
+err:
+	return -1;
+}
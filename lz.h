@@ -0,0 +1,32 @@
+#ifndef __lz_h_666__
+# define __lz_h_666__
+
+# include <stdint.h>
+# include <stddef.h>
+# include <sys/types.h>
+
+/*
+ * Byte-oriented LZ77 codec, after the LZ4 block format : a sequence is a
+ * token (literal count in the high nibble, match length - LZ_MIN_MATCH in
+ * the low one, 15 meaning more length bytes follow), its literals, and a
+ * 16-bit little-endian match offset. The last sequence only has literals.
+ *
+ * Matches are found through a hash table of 4-byte prefixes, sized after
+ * the input so that small buffers stay cheap. No entropy coding : it trades
+ * ratio for speed, text-heavy payloads still shrink several times.
+ */
+# define LZ_MIN_MATCH 4
+# define LZ_MAX_OFFSET 65535
+# define LZ_HASH_BITS 14
+
+/*
+ * Returns the compressed size, 0 when it would not fit in capacity
+ */
+size_t lz_compress(const uint8_t *src, const size_t size, uint8_t *dst, const size_t capacity);
+
+/*
+ * Returns the decompressed size, -1 on corrupted input or overflow
+ */
+ssize_t lz_decompress(const uint8_t *src, const size_t size, uint8_t *dst, const size_t capacity);
+
+#endif
@@ -0,0 +1,207 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/mman.h>
+
+#include "pagemem.h"
+
+enum {
+	range_plain,
+	range_hugetlb,
+	range_advised,
+};
+
+struct pagemem_range {
+	uintptr_t start;
+	uintptr_t end;
+	int type;
+};
+
+static struct {
+	pthread_mutex_t lock;
+	int hugetlb_failed;	/* Do not try again once the pool was found empty */
+	int madvise_failed;
+	size_t mapped;
+	size_t hugetlb;
+	size_t advised;
+	size_t count;
+	size_t max;
+	struct pagemem_range *range;
+} pagemem = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+};
+
+static void range_add(void *ptr, const size_t size, const int type)
+{
+	struct pagemem_range *range;
+
+	pthread_mutex_lock(&pagemem.lock);
+
+	pagemem.mapped += size;
+	if (type == range_hugetlb)
+		pagemem.hugetlb += size;
+	if (type == range_advised)
+		pagemem.advised += size;
+
+	if (pagemem.count >= pagemem.max) {
+		const size_t max = pagemem.max > 0 ? pagemem.max * 2 : 64;
+
+		range = realloc(pagemem.range, max * sizeof range[0]);
+		if (range == NULL)
+			goto unlock; /* Only statistics are lost */
+		pagemem.range = range;
+		pagemem.max = max;
+	}
+
+	range = &pagemem.range[pagemem.count ++];
+	range->start = (uintptr_t)ptr;
+	range->end = (uintptr_t)ptr + size;
+	range->type = type;
+
+unlock:
+	pthread_mutex_unlock(&pagemem.lock);
+}
+
+static void range_del(void *ptr, const size_t size)
+{
+	pthread_mutex_lock(&pagemem.lock);
+
+	pagemem.mapped -= size;
+	for (size_t i = pagemem.count ; i > 0 ; i --) {
+		struct pagemem_range *range = &pagemem.range[i - 1];
+
+		if (range->start != (uintptr_t)ptr)
+			continue;
+
+		if (range->type == range_hugetlb)
+			pagemem.hugetlb -= size;
+		if (range->type == range_advised)
+			pagemem.advised -= size;
+		*range = pagemem.range[-- pagemem.count];
+		break;
+	}
+
+	pthread_mutex_unlock(&pagemem.lock);
+}
+
+static void *map_hugetlb(const size_t size)
+{
+	void *ptr;
+
+	if (__atomic_load_n(&pagemem.hugetlb_failed, __ATOMIC_RELAXED))
+		goto err;
+
+	ptr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+	if (ptr == MAP_FAILED) {
+		if (!__atomic_exchange_n(&pagemem.hugetlb_failed, 1, __ATOMIC_RELAXED))
+			fprintf(stderr, "No hugetlb pages, falling back to transparent huge pages : %s\n", strerror(errno));
+		goto err;
+	}
+
+	return ptr;
+
+err:
+	return NULL;
+}
+
+void *pagemem_map(const size_t size, const int flags)
+{
+	void *ptr;
+	int mmap_flags = MAP_PRIVATE | MAP_ANONYMOUS;
+
+	if ((flags & PAGEMEM_FLAGS_HUGE) != 0 && (flags & PAGEMEM_FLAGS_RESERVE) == 0 && size % PAGEMEM_HUGE_SIZE == 0) {
+		ptr = map_hugetlb(size);
+		if (ptr != NULL) {
+			range_add(ptr, size, range_hugetlb);
+			return ptr;
+		}
+	}
+
+	if ((flags & PAGEMEM_FLAGS_RESERVE) != 0)
+		mmap_flags |= MAP_NORESERVE;
+
+	ptr = mmap(NULL, size, PROT_READ | PROT_WRITE, mmap_flags, -1, 0);
+	if (ptr == MAP_FAILED) {
+		fprintf(stderr, "Failed to map %zdb : %s\n", size, strerror(errno));
+		goto err;
+	}
+
+	if ((flags & PAGEMEM_FLAGS_HUGE) != 0) {
+		if (madvise(ptr, size, MADV_HUGEPAGE) == 0) {
+			range_add(ptr, size, range_advised);
+			return ptr;
+		}
+
+		if (!__atomic_exchange_n(&pagemem.madvise_failed, 1, __ATOMIC_RELAXED))
+			fprintf(stderr, "Transparent huge pages not available : %s\n", strerror(errno));
+	}
+
+	range_add(ptr, size, range_plain);
+	return ptr;
+
+err:
+	return NULL;
+}
+
+void pagemem_unmap(void *ptr, const size_t size)
+{
+	if (ptr == NULL)
+		return;
+
+	range_del(ptr, size);
+	munmap(ptr, size);
+}
+
+static int range_known(const uintptr_t start, const uintptr_t end)
+{
+	for (size_t i = 0 ; i < pagemem.count ; i ++) {
+		if (pagemem.range[i].start < end && start < pagemem.range[i].end)
+			return 1;
+	}
+	return 0;
+}
+
+/*
+ * Transparent huge pages actually backing our mappings, as seen by the
+ * kernel. The kernel merges neighbour mappings, so this is an upper bound.
+ */
+static size_t thp_backed(void)
+{
+	FILE *smaps;
+	char line[256];
+	int known = 0;
+	size_t total = 0;
+
+	smaps = fopen("/proc/self/smaps", "r");
+	if (smaps == NULL)
+		return 0;
+
+	while (fgets(line, sizeof line, smaps) != NULL) {
+		unsigned long start, end;
+		size_t kb;
+
+		if (sscanf(line, "%lx-%lx ", &start, &end) == 2)
+			known = range_known(start, end);
+		else if (known && sscanf(line, "AnonHugePages: %zu kB", &kb) == 1)
+			total += kb * 1024;
+	}
+
+	fclose(smaps);
+	return total;
+}
+
+int pagemem_dump(FILE *file, const int depth)
+{
+	int done = 0;
+
+	pthread_mutex_lock(&pagemem.lock);
+	done += fprintf(file, "%*sMapped %zdb in %zd mapping(s)\n", depth, "", pagemem.mapped, pagemem.count);
+	done += fprintf(file, "%*sHugetlb pages %zdb\n", depth, "", pagemem.hugetlb);
+	done += fprintf(file, "%*sTransparent huge pages asked for %zdb, backing %zdb\n", depth, "", pagemem.advised, thp_backed());
+	pthread_mutex_unlock(&pagemem.lock);
+
+	return done;
+}
@@ -0,0 +1,24 @@
+
+#ifndef __pagemem_h_666__
+# define __pagemem_h_666__
+
+# include <stdio.h>
+# include <stddef.h>
+
+# define PAGEMEM_HUGE_SIZE (2 * 1024 * 1024)
+
+# define PAGEMEM_FLAGS_HUGE (1 << 0)	/* Ask for huge pages */
+# define PAGEMEM_FLAGS_RESERVE (1 << 1)	/* Reserve address space only, pages are backed on first touch */
+
+/*
+ * With PAGEMEM_FLAGS_HUGE, mappings of a multiple of PAGEMEM_HUGE_SIZE first
+ * try the hugetlb pool (MAP_HUGETLB). When it is empty, or for reserved
+ * mappings which could not be backed later on, transparent huge pages are
+ * asked instead (MADV_HUGEPAGE).
+ */
+void *pagemem_map(const size_t size, const int flags);
+void pagemem_unmap(void *ptr, const size_t size);
+
+int pagemem_dump(FILE *file, const int depth);
+
+#endif
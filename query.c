@@ -0,0 +1,575 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <ctype.h>
+
+#include "query.h"
+
+#define QUERY_TOKEN_MAX 64
+
+enum query_kind {
+	query_kind_count = 1,
+	query_kind_size,	/* Bytes, k, m or g suffix */
+	query_kind_time,	/* Seconds, or us, ms, s, min suffix */
+	query_kind_port,
+	query_kind_proto,	/* tcp or udp */
+};
+
+static const struct {
+	const char *name;
+	enum query_column column;
+	enum query_kind kind;
+} field_table[] = {
+	{ "proto", query_column_proto, query_kind_proto },
+	{ "port", query_column_port, query_kind_port },
+	{ "client_port", query_column_client_port, query_kind_port },
+	{ "bytes", query_column_bytes, query_kind_size },
+	{ "client_bytes", query_column_client_bytes, query_kind_size },
+	{ "server_bytes", query_column_server_bytes, query_kind_size },
+	{ "packets", query_column_packets, query_kind_count },
+	{ "duration", query_column_duration, query_kind_time },
+	{ "rtt", query_column_rtt, query_kind_time },
+	{ "retransmits", query_column_retransmits, query_kind_count },
+	{ "out_of_order", query_column_out_of_order, query_kind_count },
+	{ "zero_windows", query_column_zero_windows, query_kind_count },
+	{ "in_flight", query_column_in_flight, query_kind_size },
+	{ "start", query_column_start, query_kind_time },
+};
+
+/*
+ * One filter per operator : rows of in (every row when in is NULL) whose
+ * value matches are written to out, which may be in itself
+ */
+#define QUERY_FILTER(name, op)											\
+static size_t filter_##name(const uint64_t *column, const uint64_t value, const uint32_t *in, const size_t count, uint32_t *out)	\
+{														\
+	size_t done = 0;											\
+														\
+	if (in == NULL) {											\
+		for (size_t i = 0 ; i < count ; i ++) {								\
+			out[done] = i;										\
+			done += column[i] op value;								\
+		}												\
+	} else {												\
+		for (size_t i = 0 ; i < count ; i ++) {								\
+			const uint32_t row = in[i];								\
+														\
+			out[done] = row;									\
+			done += column[row] op value;								\
+		}												\
+	}													\
+														\
+	return done;												\
+}
+
+QUERY_FILTER(eq, ==)
+QUERY_FILTER(ne, !=)
+QUERY_FILTER(lt, <)
+QUERY_FILTER(le, <=)
+QUERY_FILTER(gt, >)
+QUERY_FILTER(ge, >=)
+
+static const struct {
+	const char *name;
+	query_filter_t filter;
+} op_table[] = {
+	{ "=", filter_eq },
+	{ "==", filter_eq },
+	{ "!=", filter_ne },
+	{ "<", filter_lt },
+	{ "<=", filter_le },
+	{ ">", filter_gt },
+	{ ">=", filter_ge },
+};
+
+static int field_get(const char *name)
+{
+	for (size_t i = 0 ; i < sizeof field_table / sizeof field_table[0] ; i ++) {
+		if (strcmp(name, field_table[i].name) == 0)
+			return i;
+	}
+
+	fprintf(stderr, "Query : unknown field <%s>\n", name);
+	return -1;
+}
+
+static int value_parse(const char *str, const enum query_kind kind, uint64_t *value)
+{
+	unsigned long long ull;
+	double d;
+	char *end;
+
+	switch (kind) {
+	case query_kind_proto:
+		if (strcasecmp(str, "tcp") == 0)
+			*value = IPPROTO_TCP;
+		else if (strcasecmp(str, "udp") == 0)
+			*value = IPPROTO_UDP;
+		else
+			goto err;
+		return 0;
+
+	case query_kind_time:
+		errno = 0;
+		d = strtod(str, &end);
+		if (errno != 0 || end == str || !(d >= 0))
+			goto err;
+
+		if (*end == 0 || strcmp(end, "s") == 0)
+			d *= 1000000;
+		else if (strcmp(end, "ms") == 0)
+			d *= 1000;
+		else if (strcmp(end, "min") == 0)
+			d *= 60 * 1000000.0;
+		else if (strcmp(end, "us") != 0)
+			goto err;
+
+		if (d >= 18446744073709551615.0)
+			goto err;
+		*value = (uint64_t)d;
+		return 0;
+
+	case query_kind_size:
+	case query_kind_count:
+	case query_kind_port:
+	default:
+		errno = 0;
+		ull = strtoull(str, &end, 0);
+		if (errno != 0 || end == str || str[0] == '-')
+			goto err;
+
+		if (kind == query_kind_size && *end != 0) {
+			int shift = 0;
+
+			switch (*end) {
+			case 'k': case 'K': shift = 10; end ++; break;
+			case 'm': case 'M': shift = 20; end ++; break;
+			case 'g': case 'G': shift = 30; end ++; break;
+			}
+			if (*end == 'b' || *end == 'B')
+				end ++;
+			if (ull > (UINT64_MAX >> shift))
+				goto err;
+			ull <<= shift;
+		}
+
+		if (*end != 0 || (kind == query_kind_port && ull > UINT16_MAX))
+			goto err;
+
+		*value = ull;
+		return 0;
+	}
+
+err:
+	fprintf(stderr, "Query : invalid value <%s>\n", str);
+	return -1;
+}
+
+/*
+ * Words, numbers with their unit, and comparison operators : spaces and
+ * commas only separate them, so that "bytes>1m,port=443" is accepted
+ */
+static int tokenize(const int ac, char **av, char (*token)[QUERY_TOKEN_MAX], const size_t max)
+{
+	size_t count = 0;
+
+	for (int i = 0 ; i < ac ; i ++) {
+		const char *ptr = av[i];
+
+		while (*ptr != 0) {
+			size_t len = 0;
+
+			if (isspace((unsigned char)*ptr) || *ptr == ',') {
+				ptr ++;
+				continue;
+			}
+
+			if (strchr("<>=!", *ptr) != NULL) {
+				while (ptr[len] != 0 && strchr("<>=!", ptr[len]) != NULL)
+					len ++;
+			} else {
+				while (ptr[len] != 0 && !isspace((unsigned char)ptr[len]) && strchr("<>=!,", ptr[len]) == NULL)
+					len ++;
+			}
+
+			if (count >= max || len >= QUERY_TOKEN_MAX) {
+				fprintf(stderr, "Query : too long\n");
+				return -1;
+			}
+
+			memcpy(token[count], ptr, len);
+			token[count][len] = 0;
+			count ++;
+			ptr += len;
+		}
+	}
+
+	return count;
+}
+
+int query_compile(struct query *query, const int ac, char **av)
+{
+	char token[4 * QUERY_MAX_PREDICATES + 8][QUERY_TOKEN_MAX];
+	int count;
+	int idx = 0;
+
+	memset(query, 0, sizeof query[0]);
+	query->sort = query_column_max;
+
+	count = tokenize(ac, av, token, sizeof token / sizeof token[0]);
+	if (count < 0)
+		goto err;
+
+	if (idx < count && strcmp(token[idx], "where") == 0)
+		idx ++;
+
+	while (idx < count && strcmp(token[idx], "sort") != 0 && strcmp(token[idx], "top") != 0) {
+		struct query_predicate *predicate;
+		int field;
+		size_t op;
+
+		if (query->predicate_count > 0) {
+			if (strcmp(token[idx], "and") == 0)
+				idx ++;
+		}
+
+		if (idx + 3 > count) {
+			fprintf(stderr, "Query : incomplete condition\n");
+			goto err;
+		}
+
+		if (query->predicate_count >= QUERY_MAX_PREDICATES) {
+			fprintf(stderr, "Query : %d conditions at most\n", QUERY_MAX_PREDICATES);
+			goto err;
+		}
+
+		field = field_get(token[idx]);
+		if (field < 0)
+			goto err;
+
+		for (op = 0 ; op < sizeof op_table / sizeof op_table[0] ; op ++) {
+			if (strcmp(token[idx + 1], op_table[op].name) == 0)
+				break;
+		}
+		if (op == sizeof op_table / sizeof op_table[0]) {
+			fprintf(stderr, "Query : unknown operator <%s>\n", token[idx + 1]);
+			goto err;
+		}
+
+		predicate = &query->predicate[query->predicate_count ++];
+		predicate->filter = op_table[op].filter;
+		predicate->column = field_table[field].column;
+		if (value_parse(token[idx + 2], field_table[field].kind, &predicate->value) < 0)
+			goto err;
+
+		idx += 3;
+	}
+
+	if (idx < count && strcmp(token[idx], "sort") == 0) {
+		int field;
+
+		if (idx + 1 >= count) {
+			fprintf(stderr, "Query : no sort field\n");
+			goto err;
+		}
+
+		field = field_get(token[idx + 1]);
+		if (field < 0)
+			goto err;
+		query->sort = field_table[field].column;
+		idx += 2;
+
+		if (idx < count && strcmp(token[idx], "asc") == 0) {
+			query->ascending = 1;
+			idx ++;
+		} else if (idx < count && strcmp(token[idx], "desc") == 0)
+			idx ++;
+	}
+
+	if (idx < count && strcmp(token[idx], "top") == 0) {
+		uint64_t top;
+
+		if (idx + 1 >= count) {
+			fprintf(stderr, "Query : no top count\n");
+			goto err;
+		}
+
+		if (value_parse(token[idx + 1], query_kind_count, &top) < 0 || top == 0)
+			goto err;
+		query->top = top;
+		idx += 2;
+	}
+
+	if (idx < count) {
+		fprintf(stderr, "Query : unexpected <%s>\n", token[idx]);
+		goto err;
+	}
+
+	return 0;
+
+err:
+	return -1;
+}
+
+static uint64_t column_value(const struct session_entry *entry, const enum query_column column)
+{
+	const struct session_stats *stats = &entry->stats;
+	const struct session_tcp_info *tcp = entry->tcp_info;
+	const int client = (tcp != NULL && tcp->client != NULL && tcp->client != &tcp->side1) ? 1 : 0;
+	const uint16_t server_port = tcp != NULL ? (tcp->server != NULL ? tcp->server->port : tcp->side2.port) : entry->udp_info->side2.port;
+	const uint16_t client_port = tcp != NULL ? (tcp->client != NULL ? tcp->client->port : tcp->side1.port) : entry->udp_info->side1.port;
+
+	switch (column) {
+	case query_column_proto:
+		return tcp != NULL ? IPPROTO_TCP : IPPROTO_UDP;
+	case query_column_port:
+		return ntohs(server_port);
+	case query_column_client_port:
+		return ntohs(client_port);
+	case query_column_bytes:
+		return stats->dir[0].bytes + stats->dir[1].bytes;
+	case query_column_client_bytes:
+		return stats->dir[client].bytes;
+	case query_column_server_bytes:
+		return stats->dir[!client].bytes;
+	case query_column_packets:
+		return stats->dir[0].packets + stats->dir[1].packets;
+	case query_column_duration:
+		return stats->last_ts - stats->first_ts;
+	case query_column_rtt:
+		return stats->rtt;
+	case query_column_retransmits:
+		return stats->dir[0].retransmits + stats->dir[1].retransmits;
+	case query_column_out_of_order:
+		return stats->dir[0].out_of_order + stats->dir[1].out_of_order;
+	case query_column_zero_windows:
+		return stats->dir[0].zero_windows + stats->dir[1].zero_windows;
+	case query_column_in_flight:
+		return stats->dir[0].max_in_flight > stats->dir[1].max_in_flight ? stats->dir[0].max_in_flight : stats->dir[1].max_in_flight;
+	case query_column_start:
+		return stats->first_ts;
+	case query_column_max:
+	default:
+		abort();
+	}
+}
+
+static size_t pool_count(const struct session_pool *pool)
+{
+	size_t count = 0;
+
+	if (pool != NULL) {
+		for (const struct session_entry *entry = pool->first ; entry != NULL ; entry = entry->next)
+			count ++;
+	}
+
+	return count;
+}
+
+static void pool_snapshot(struct query_snapshot *snapshot, const struct session_pool *pool)
+{
+	if (pool == NULL)
+		return;
+
+	for (const struct session_entry *entry = pool->first ; entry != NULL ; entry = entry->next) {
+		if (entry->tcp_info == NULL && entry->udp_info == NULL)
+			continue;
+
+		for (int column = 0 ; column < query_column_max ; column ++) {
+			if (snapshot->column[column] != NULL)
+				snapshot->column[column][snapshot->count] = column_value(entry, column);
+		}
+		snapshot->entry[snapshot->count ++] = entry;
+	}
+}
+
+/*
+ * Only the columns read by the query are filled
+ */
+int query_snapshot_init(struct query_snapshot *snapshot, const struct query *query, const struct session_table *table, const char *type)
+{
+	const int tcp = type == NULL || strcasecmp(type, "any") == 0 || strcasecmp(type, "tcp") == 0;
+	const int udp = type == NULL || strcasecmp(type, "any") == 0 || strcasecmp(type, "udp") == 0;
+	int used[query_column_max] = { 0 };
+	size_t max = 0;
+
+	memset(snapshot, 0, sizeof snapshot[0]);
+
+	for (size_t i = 0 ; i < query->predicate_count ; i ++)
+		used[query->predicate[i].column] = 1;
+	if (query->sort != query_column_max)
+		used[query->sort] = 1;
+
+	if (tcp)
+		max += pool_count(table->tcp);
+	if (udp)
+		max += pool_count(table->udp);
+	if (max >= UINT32_MAX) {
+		fprintf(stderr, "Query : too many sessions (%zd)\n", max);
+		goto err;
+	}
+
+	snapshot->entry = malloc((max + 1) * sizeof snapshot->entry[0]);
+	if (snapshot->entry == NULL)
+		goto alloc_err;
+
+	for (int column = 0 ; column < query_column_max ; column ++) {
+		if (!used[column])
+			continue;
+
+		snapshot->column[column] = malloc((max + 1) * sizeof snapshot->column[column][0]);
+		if (snapshot->column[column] == NULL)
+			goto alloc_err;
+	}
+
+	if (tcp)
+		pool_snapshot(snapshot, table->tcp);
+	if (udp)
+		pool_snapshot(snapshot, table->udp);
+	return 0;
+
+alloc_err:
+	fprintf(stderr, "Failed to allocate a %zd sessions query snapshot : %s\n", max, strerror(errno));
+	query_snapshot_free(snapshot);
+err:
+	return -1;
+}
+
+void query_snapshot_free(struct query_snapshot *snapshot)
+{
+	for (int column = 0 ; column < query_column_max ; column ++)
+		free(snapshot->column[column]);
+	free(snapshot->entry);
+	memset(snapshot, 0, sizeof snapshot[0]);
+}
+
+/*
+ * Equal values keep the creation order
+ */
+static inline int rank_before(const uint64_t *column, const int ascending, const uint32_t row1, const uint32_t row2)
+{
+	if (column[row1] != column[row2])
+		return ascending ? column[row1] < column[row2] : column[row1] > column[row2];
+	return row1 < row2;
+}
+
+/*
+ * The heap root is the row ranking last
+ */
+static void heap_sift_down(uint32_t *heap, const size_t size, size_t idx, const uint64_t *column, const int ascending)
+{
+	for (;;) {
+		size_t last = idx;
+		const size_t left = 2 * idx + 1;
+		const size_t right = left + 1;
+		uint32_t tmp;
+
+		if (left < size && rank_before(column, ascending, heap[last], heap[left]))
+			last = left;
+		if (right < size && rank_before(column, ascending, heap[last], heap[right]))
+			last = right;
+		if (last == idx)
+			return;
+
+		tmp = heap[idx];
+		heap[idx] = heap[last];
+		heap[last] = tmp;
+		idx = last;
+	}
+}
+
+static void heap_sift_up(uint32_t *heap, size_t idx, const uint64_t *column, const int ascending)
+{
+	while (idx > 0) {
+		const size_t parent = (idx - 1) / 2;
+		uint32_t tmp;
+
+		if (!rank_before(column, ascending, heap[parent], heap[idx]))
+			return;
+
+		tmp = heap[idx];
+		heap[idx] = heap[parent];
+		heap[parent] = tmp;
+		idx = parent;
+	}
+}
+
+/*
+ * Keep the best top rows of count in a heap built at the start of rows, then
+ * sort them in place. O(count log top).
+ */
+static size_t top_select(uint32_t *rows, const size_t count, const size_t top, const uint64_t *column, const int ascending)
+{
+	size_t size = 0;
+
+	for (size_t i = 0 ; i < count ; i ++) {
+		const uint32_t row = rows[i];
+
+		if (size < top) {
+			rows[size] = row;
+			heap_sift_up(rows, size, column, ascending);
+			size ++;
+		} else if (rank_before(column, ascending, row, rows[0])) {
+			rows[0] = row;
+			heap_sift_down(rows, size, 0, column, ascending);
+		}
+	}
+
+	for (size_t last = size ; last > 1 ; last --) {
+		const uint32_t tmp = rows[0];
+
+		rows[0] = rows[last - 1];
+		rows[last - 1] = tmp;
+		heap_sift_down(rows, last - 1, 0, column, ascending);
+	}
+
+	return size;
+}
+
+ssize_t query_run(const struct query *query, const struct query_snapshot *snapshot, uint32_t **rows_ptr)
+{
+	const uint32_t *in = NULL;
+	uint32_t *rows;
+	size_t count = snapshot->count;
+
+	rows = malloc((snapshot->count + 1) * sizeof rows[0]);
+	if (rows == NULL) {
+		fprintf(stderr, "Failed to allocate query rows : %s\n", strerror(errno));
+		return -1;
+	}
+
+	for (size_t i = 0 ; i < query->predicate_count ; i ++) {
+		const struct query_predicate *predicate = &query->predicate[i];
+
+		count = predicate->filter(snapshot->column[predicate->column], predicate->value, in, count, rows);
+		in = rows;
+	}
+
+	if (in == NULL) {
+		for (size_t i = 0 ; i < count ; i ++)
+			rows[i] = i;
+	}
+
+	if (query->sort != query_column_max)
+		count = top_select(rows, count, query->top > 0 ? query->top : count, snapshot->column[query->sort], query->ascending);
+	else if (query->top > 0 && count > query->top)
+		count = query->top;
+
+	*rows_ptr = rows;
+	return count;
+}
+
+int query_usage(FILE *file, const int depth)
+{
+	int done = 0;
+
+	done += fprintf(file, "%*s[where] <field> <op> <value> [and ...] [sort <field> [asc | desc]] [top <n>]\n", depth, "");
+	done += fprintf(file, "%*sop : = == != < <= > >=\n", depth, "");
+	done += fprintf(file, "%*sfield :", depth, "");
+	for (size_t i = 0 ; i < sizeof field_table / sizeof field_table[0] ; i ++)
+		done += fprintf(file, " %s", field_table[i].name);
+	done += fprintf(file, "\n");
+	done += fprintf(file, "%*sSizes take k, m or g, times us, ms, s (default) or min\n", depth, "");
+	return done;
+}
@@ -0,0 +1,70 @@
+
+#ifndef __query_h_666__
+# define __query_h_666__
+
+# include <stdio.h>
+# include <stdint.h>
+# include <stddef.h>
+# include <sys/types.h>
+# include "session.h"
+
+/*
+ * Session queries :
+ *
+ *   [where] <field> <op> <value> [and <field> <op> <value> ...]
+ *   [sort <field> [asc | desc]] [top <n>]
+ *
+ * Conditions are compiled into a chain of column filters. Each one narrows
+ * a selection vector over a columnar snapshot of the session statistics,
+ * holding only the columns the query reads. Sorting keeps the top n rows
+ * in a heap.
+ */
+# define QUERY_MAX_PREDICATES 16
+
+enum query_column {
+	query_column_proto,
+	query_column_port,		/* Server port, destination of the first frame if unknown */
+	query_column_client_port,
+	query_column_bytes,
+	query_column_client_bytes,
+	query_column_server_bytes,
+	query_column_packets,
+	query_column_duration,		/* us */
+	query_column_rtt,		/* us */
+	query_column_retransmits,
+	query_column_out_of_order,
+	query_column_zero_windows,
+	query_column_in_flight,		/* Max of both directions */
+	query_column_start,		/* us */
+	query_column_max,
+};
+
+typedef size_t (*query_filter_t)(const uint64_t *column, const uint64_t value, const uint32_t *in, const size_t count, uint32_t *out);
+
+struct query_predicate {
+	query_filter_t filter;
+	enum query_column column;
+	uint64_t value;
+};
+
+struct query {
+	struct query_predicate predicate[QUERY_MAX_PREDICATES];
+	size_t predicate_count;
+	enum query_column sort;		/* query_column_max for creation order */
+	int ascending;
+	size_t top;			/* 0 for every match */
+};
+
+struct query_snapshot {
+	size_t count;
+	uint64_t *column[query_column_max];	/* NULL when not read */
+	const struct session_entry **entry;
+};
+
+int query_compile(struct query *query, const int ac, char **av);
+int query_snapshot_init(struct query_snapshot *snapshot, const struct query *query, const struct session_table *table, const char *type);
+void query_snapshot_free(struct query_snapshot *snapshot);
+ssize_t query_run(const struct query *query, const struct query_snapshot *snapshot, uint32_t **rows_ptr);
+int query_usage(FILE *file, const int depth);
+
+#endif
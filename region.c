@@ -0,0 +1,133 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "region.h"
+#include "pagemem.h"
+
+#define CHUNK_HDR_SIZE ((sizeof(struct region_chunk) + REGION_ALIGN - 1) & ~(size_t)(REGION_ALIGN - 1))
+
+static inline size_t size_align(const size_t size)
+{
+	return (size + REGION_ALIGN - 1) & ~(size_t)(REGION_ALIGN - 1);
+}
+
+int region_init(struct region *region, const int pagemem_flags)
+{
+	memset(region, 0, sizeof region[0]);
+	region->pagemem_flags = pagemem_flags;
+	return 0;
+}
+
+void region_free(struct region *region)
+{
+	struct region_chunk *chunk = region->chunk;
+
+	while (chunk != NULL) {
+		struct region_chunk *next = chunk->next;
+		pagemem_unmap(chunk, chunk->size);
+		chunk = next;
+	}
+
+	region->chunk = NULL;
+	region->ptr = NULL;
+	region->end = NULL;
+	region->used = 0;
+	region->mapped = 0;
+	region->recycled = 0;
+	memset(region->free_list, 0, sizeof region->free_list);
+}
+
+static struct region_chunk *chunk_new(struct region *region, const size_t size)
+{
+	struct region_chunk *chunk;
+
+	chunk = pagemem_map(size, region->pagemem_flags);
+	if (chunk == NULL)
+		goto err;
+
+	chunk->size = size;
+	region->mapped += size;
+	return chunk;
+
+err:
+	return NULL;
+}
+
+void *region_alloc(struct region *region, const size_t size)
+{
+	const size_t aligned = size_align(size);
+	struct region_chunk *chunk;
+	void *ptr;
+
+	if (aligned <= REGION_RECYCLE_MAX && region->free_list[aligned / REGION_ALIGN - 1] != NULL) {
+		ptr = region->free_list[aligned / REGION_ALIGN - 1];
+		region->free_list[aligned / REGION_ALIGN - 1] = *(void **)ptr;
+		region->recycled -= aligned;
+		region->used += aligned;
+		memset(ptr, 0, aligned);
+		return ptr;
+	}
+
+	if (aligned <= (size_t)(region->end - region->ptr)) {
+		ptr = region->ptr;
+		region->ptr += aligned;
+		region->used += aligned;
+		return ptr;
+	}
+
+	if (CHUNK_HDR_SIZE + aligned > REGION_CHUNK_SIZE / 4) {
+		/*
+		 * Too big to share a chunk : give it its own, behind the
+		 * current one so that its free space is not lost
+		 */
+		chunk = chunk_new(region, CHUNK_HDR_SIZE + aligned);
+		if (chunk == NULL)
+			goto err;
+
+		if (region->chunk != NULL) {
+			chunk->next = region->chunk->next;
+			region->chunk->next = chunk;
+		} else {
+			chunk->next = NULL;
+			region->chunk = chunk; /* ptr == end, nothing to share */
+		}
+
+		region->used += aligned;
+		return (uint8_t *)chunk + CHUNK_HDR_SIZE;
+	}
+
+	chunk = chunk_new(region, REGION_CHUNK_SIZE);
+	if (chunk == NULL)
+		goto err;
+
+	chunk->next = region->chunk;
+	region->chunk = chunk;
+	region->ptr = (uint8_t *)chunk + CHUNK_HDR_SIZE + aligned;
+	region->end = (uint8_t *)chunk + chunk->size;
+	region->used += aligned;
+	return (uint8_t *)chunk + CHUNK_HDR_SIZE;
+
+err:
+	return NULL;
+}
+
+/*
+ * size is the one given to region_alloc()
+ */
+void region_recycle(struct region *region, void *ptr, const size_t size)
+{
+	const size_t aligned = size_align(size);
+
+	if (ptr == NULL || aligned > REGION_RECYCLE_MAX)
+		return;
+
+	*(void **)ptr = region->free_list[aligned / REGION_ALIGN - 1];
+	region->free_list[aligned / REGION_ALIGN - 1] = ptr;
+	region->recycled += aligned;
+	region->used -= aligned;
+}
+
+int region_dump(FILE *file, const int depth, const struct region *region)
+{
+	return fprintf(file, "%*sUsed %zdb, recycled %zdb, mapped %zdb\n", depth, "", region->used, region->recycled, region->mapped);
+}
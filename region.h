@@ -0,0 +1,44 @@
+
+#ifndef __region_h_666__
+# define __region_h_666__
+
+# include <stdio.h>
+# include <stdint.h>
+# include <stddef.h>
+
+/*
+ * Bump allocator for objects sharing the lifetime of their owner : all the
+ * chunks are unmapped at once by region_free(). Memory comes zeroed.
+ *
+ * Small objects of a finished session may be handed back with
+ * region_recycle(), they are kept on a free list per size and served again
+ * before the bump pointer. Larger ones stay until region_free().
+ */
+# define REGION_CHUNK_SIZE (2 * 1024 * 1024)
+# define REGION_ALIGN 16
+# define REGION_RECYCLE_MAX 512
+
+struct region_chunk {
+	struct region_chunk *next;
+	size_t size;
+};
+
+struct region {
+	struct region_chunk *chunk;	/* Current one, followed by the full ones */
+	uint8_t *ptr;
+	uint8_t *end;
+	size_t used;		/* Handed out and not recycled */
+	size_t mapped;
+	size_t recycled;	/* Sitting on the free lists */
+	void *free_list[REGION_RECYCLE_MAX / REGION_ALIGN];
+	int pagemem_flags;
+};
+
+int region_init(struct region *region, const int pagemem_flags);
+void region_free(struct region *region);
+void *region_alloc(struct region *region, const size_t size);
+void region_recycle(struct region *region, void *ptr, const size_t size);
+
+int region_dump(FILE *file, const int depth, const struct region *region);
+
+#endif
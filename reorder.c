@@ -0,0 +1,120 @@
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "reorder.h"
+
+int reorder_init(struct reorder *reorder, const size_t window, const enum reorder_late_policy late_policy)
+{
+	memset(reorder, 0, sizeof reorder[0]);
+
+	reorder->window = window;
+	reorder->late_policy = late_policy;
+
+	if (window > 0) {
+		reorder->heap = calloc(window + 1, sizeof reorder->heap[0]);
+		if (reorder->heap == NULL) {
+			fprintf(stderr, "Failed to allocate reorder window : %s\n", strerror(errno));
+			goto err;
+		}
+	}
+
+	return 0;
+
+err:
+	return -1;
+}
+
+void reorder_free(struct reorder *reorder)
+{
+	free(reorder->heap);
+	memset(reorder, 0, sizeof reorder[0]);
+}
+
+static inline int slot_lower(const struct reorder_slot *slot1, const struct reorder_slot *slot2)
+{
+	if (slot1->ts != slot2->ts)
+		return slot1->ts < slot2->ts;
+	return slot1->seq < slot2->seq;
+}
+
+static void heap_push(struct reorder *reorder, const struct reorder_slot *slot)
+{
+	size_t idx = reorder->count ++;
+
+	while (idx > 0) {
+		const size_t parent = (idx - 1) / 2;
+
+		if (!slot_lower(slot, &reorder->heap[parent]))
+			break;
+		reorder->heap[idx] = reorder->heap[parent];
+		idx = parent;
+	}
+	reorder->heap[idx] = *slot;
+}
+
+static struct frame_node *heap_pop(struct reorder *reorder)
+{
+	struct frame_node *node = reorder->heap[0].node;
+	const struct reorder_slot *last;
+	size_t idx = 0;
+
+	reorder->last_ts = reorder->heap[0].ts;
+	reorder->emitted = 1;
+
+	reorder->count --;
+	last = &reorder->heap[reorder->count];
+
+	for (;;) {
+		size_t child = 2 * idx + 1;
+
+		if (child >= reorder->count)
+			break;
+		if (child + 1 < reorder->count && slot_lower(&reorder->heap[child + 1], &reorder->heap[child]))
+			child ++;
+		if (!slot_lower(&reorder->heap[child], last))
+			break;
+		reorder->heap[idx] = reorder->heap[child];
+		idx = child;
+	}
+	reorder->heap[idx] = *last;
+
+	return node;
+}
+
+enum reorder_res reorder_push(struct reorder *reorder, struct frame_node *node, struct frame_node **out_ptr)
+{
+	struct reorder_slot slot;
+
+	slot.ts = node->frame.ts;
+	slot.seq = reorder->seq ++;
+	slot.node = node;
+
+	if (reorder->emitted && slot.ts < reorder->last_ts) {
+		*out_ptr = node;
+		if (reorder->late_policy == reorder_late_drop)
+			return reorder_drop;
+		return reorder_late;
+	}
+
+	if (reorder->window == 0) {
+		*out_ptr = node;
+		return reorder_emit;
+	}
+
+	heap_push(reorder, &slot);
+	if (reorder->count <= reorder->window)
+		return reorder_buffered;
+
+	*out_ptr = heap_pop(reorder);
+	return reorder_emit;
+}
+
+struct frame_node *reorder_flush(struct reorder *reorder)
+{
+	if (reorder->count == 0)
+		return NULL;
+	return heap_pop(reorder);
+}
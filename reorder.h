@@ -0,0 +1,50 @@
+
+#ifndef __reorder_h_666__
+# define __reorder_h_666__
+
+# include <stdint.h>
+# include "frame_list.h"
+
+# define REORDER_DEFAULT_WINDOW 64
+
+/*
+ * What to do with a frame older than the last one already emitted, ie that
+ * arrived later than the window allows
+ */
+enum reorder_late_policy {
+	reorder_late_process = 1,	/* Emit it right away, out of order */
+	reorder_late_drop,		/* Hand it back to the caller to be recycled */
+};
+
+enum reorder_res {
+	reorder_buffered = 0,
+	reorder_emit,
+	reorder_late,	/* Late frame to be processed out of order */
+	reorder_drop,	/* Late frame to be recycled */
+};
+
+struct reorder_slot {
+	uint64_t ts;
+	uint64_t seq;	/* Arrival order, keeps frames with the same timestamp in order */
+	struct frame_node *node;
+};
+
+/*
+ * Min-heap of at most window frames keyed on their timestamp
+ */
+struct reorder {
+	struct reorder_slot *heap;
+	size_t count;
+	size_t window;
+	uint64_t seq;
+	uint64_t last_ts;
+	int emitted;
+	enum reorder_late_policy late_policy;
+};
+
+int reorder_init(struct reorder *reorder, const size_t window, const enum reorder_late_policy late_policy);
+void reorder_free(struct reorder *reorder);
+enum reorder_res reorder_push(struct reorder *reorder, struct frame_node *node, struct frame_node **out_ptr);
+struct frame_node *reorder_flush(struct reorder *reorder);
+
+#endif
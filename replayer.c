@@ -152,34 +152,82 @@ err:
 	return -1;
 }
 
+/*
+ * Start the replay at a transmission of the timeline, possibly in its
+ * middle, instead of the first one
+ */
+int replayer_seek(struct replayer *replayer, const size_t first_tx, const size_t first_skip)
+{
+	const struct session_tx_list *list = replayer->tx_list;
+
+	if (first_tx > list->count || (first_skip > 0 && (first_tx == list->count || first_skip >= list->tx[first_tx].size))) {
+		fprintf(stderr, "Failed to seek beyond the transmissions\n");
+		goto err;
+	}
+
+	replayer->first_tx = first_tx;
+	replayer->first_skip = first_skip;
+	return 0;
+
+err:
+	return -1;
+}
+
 static int replay_send(struct replayer *replayer, const struct timeval *now)
 {
+	const struct session_tx *txs = replayer->tx_list->tx;
 	struct timeval next_dt;
 	struct timeval real_dt;
-	uint8_t *data;
+	size_t last;
+	const uint8_t *data;
 	size_t size;
 
 	if (replayer->last_tx_ts.tv_sec == 0 && replayer->last_tx_ts.tv_usec == 0) {
-		replayer->next_tx = replayer->tx_list->first;
+		replayer->next_tx = replayer->first_tx;
 		replayer->last_tx_ts = (now != NULL) ? *now : (struct timeval){ -1, -1 };
 	}
 
-	if (replayer->next_tx == NULL)
+	if (replayer->next_tx >= replayer->tx_list->count)
 		goto done;
 
-	if (replayer->tx_list->first == NULL)
-		abort();
-
+	/* Transmissions are scheduled after their due time, which never decreases */
 	if (now != NULL) {
-		timersub(&replayer->next_tx->tx.ts, &replayer->tx_list->first->tx.ts, &next_dt);
+		const uint64_t dt = txs[replayer->next_tx].due - txs[replayer->first_tx].due;
+
+		next_dt = (struct timeval){ .tv_sec = dt / 1000000, .tv_usec = dt % 1000000 };
 		timersub(now, &replayer->last_tx_ts, &real_dt);
 		if (timercmp(&real_dt, &next_dt, <))
 			goto idle;
 	} else
-		next_dt = (struct timeval){ 0, 0 };
+		real_dt = (struct timeval){ 0, 0 };
 
-	data = replayer->next_tx->tx.buffer->data.stream;
-	size = replayer->next_tx->tx.buffer->to - replayer->next_tx->tx.buffer->from + 1;
+	data = streambuffer_chunk_data(txs[replayer->next_tx].chunk);
+	if (data == NULL)
+		goto err;
+	data += txs[replayer->next_tx].offset;
+	size = txs[replayer->next_tx].size;
+	if (replayer->next_tx == replayer->first_tx) {
+		data += replayer->first_skip;
+		size -= replayer->first_skip;
+	}
+
+	/*
+	 * Following transmissions already due and contiguous in the same
+	 * chunk go with this one, in a single write
+	 */
+	last = replayer->next_tx;
+	while (now != NULL && last + 1 < replayer->tx_list->count) {
+		const struct session_tx *tx = &txs[last + 1];
+		const uint64_t dt = tx->due - txs[replayer->first_tx].due;
+
+		if (tx->chunk != txs[last].chunk || tx->offset != txs[last].offset + txs[last].size)
+			break;
+		next_dt = (struct timeval){ .tv_sec = dt / 1000000, .tv_usec = dt % 1000000 };
+		if (timercmp(&real_dt, &next_dt, <))
+			break;
+		size += tx->size;
+		last ++;
+	}
 
 	printf("[%ld, %ld] Tx %s:%d\n", real_dt.tv_sec, real_dt.tv_usec, inet_ntoa(replayer->distant.sin_addr), htons(replayer->distant.sin_port));
 	rawprint(stdout, 1, data, size, 8, 4);
@@ -190,7 +238,7 @@ static int replay_send(struct replayer *replayer, const struct timeval *now)
 	}
 
 	replayer->last_tx_ts = (now != NULL) ? *now : (struct timeval){ -1, -1 };
-	replayer->next_tx = replayer->next_tx->next;
+	replayer->next_tx = last + 1;
 	return 1;
 
 idle:
@@ -19,7 +19,9 @@ struct replayer {
 	const struct session_tx_list *tx_list;
 	struct timeval first_rx_ts;
 	struct timeval last_tx_ts;
-	struct session_tx_node *next_tx;
+	size_t first_tx;	/* Where the replay starts */
+	size_t first_skip;	/* Bytes of the first transmission already there */
+	size_t next_tx;
 };
 
 int replayer_init(struct replayer *replayer, const int server_mode,
@@ -29,6 +31,8 @@ int replayer_init(struct replayer *replayer, const int server_mode,
 
 void replayer_deinit(struct replayer *replayer);
 
+int replayer_seek(struct replayer *replayer, const size_t first_tx, const size_t first_skip);
+
 int replayer_loop(struct replayer *replayer, const struct timeval *now);
 
 int replayer_connected(struct replayer *replayer);
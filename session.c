@@ -3,325 +3,850 @@
 #include <string.h>
 #include <stdlib.h>
 #include <errno.h>
+#include <inttypes.h>
 
 #include "frame.h"
 #include "session.h"
+#include "counters.h"
+#include "rawprint.h"
+#include "spill.h"
+#include "blockstore.h"
+#include "bufpool.h"
 
 #define error_stream stderr
 
-int session_table_init(struct session_table *table)
+int session_table_init(struct session_table *table, const int pagemem_flags)
 {
 	memset(table, 0, sizeof table[0]);
+	table->retain = session_retain_all;
+
+	if (region_init(&table->region, pagemem_flags) < 0)
+		goto err;
+
+	if (endpoint_index_init(&table->tcp_endpoints, &table->region) < 0)
+		goto free_region_err;
 	return 0;
+
+free_region_err:
+	region_free(&table->region);
+err:
+	return -1;
 }
 
-static inline uint32_t MurmurHash_32(const void *key, uint32_t len, const uint32_t seed)
+void session_table_set_mem_limit(struct session_table *table, const size_t mem_limit)
 {
-	// 'm' and 'r' are mixing constants generated offline.
-	// They're not really 'magic', they just happen to work well.
+	table->mem_limit = mem_limit;
+}
 
-	const uint32_t m = 0x5bd1e995;
-	const int r = 24;
+void session_table_set_overlap(struct session_table *table, const enum streambuffer_overlap overlap)
+{
+	table->reassembly.overlap = overlap;
+}
 
-	// Initialize the hash to a 'random' value
+void session_table_set_compress(struct session_table *table, const int compress)
+{
+	table->reassembly.compress = compress;
+}
 
-	uint32_t h = seed ^ len;
+void session_table_set_dedup(struct session_table *table, const int dedup)
+{
+	table->reassembly.dedup = dedup;
+}
 
-	// Mix 4 bytes at a time into the hash
+void session_table_set_fingerprint(struct session_table *table, const int fingerprint)
+{
+	table->reassembly.fingerprint = fingerprint;
+}
 
-	const uint8_t *data = key;
+void session_table_set_lifecycle(struct session_table *table, const enum session_retain retain, const uint64_t idle_timeout)
+{
+	table->retain = retain;
+	table->idle_timeout = idle_timeout;
+}
 
-	while (len >= 4) {
-		uint32_t k = *(uint32_t *)data;
+/*
+ * Most sessions only hold a few transmissions : the array starts with the
+ * room of the smallest buffer, and grows by 1.5x steps
+ */
+static int tx_list_grow(struct session_tx_list *list)
+{
+	const size_t want = list->alloc + list->alloc / 2 + 1;
+	const size_t alloc = bufpool_room(want * sizeof list->tx[0]) / sizeof list->tx[0];
+	struct session_tx *tx = bufpool_alloc(alloc * sizeof tx[0]);
 
-		k *= m;
-		k ^= k >> r;
-		k *= m;
+	if (tx == NULL) {
+		fprintf(stderr, "Failed to allocate %zd tx\n", alloc);
+		goto err;
+	}
 
-		h *= m;
-		h ^= k;
+	if (list->count > 0)
+		memcpy(tx, list->tx, list->count * sizeof tx[0]);
+	bufpool_free(list->tx);
+	list->tx = tx;
+	list->alloc = alloc;
+	return 0;
 
-		data += 4;
-		len -= 4;
-	}
+err:
+	return -1;
+}
 
-	// Handle the last few bytes of the input array
+/*
+ * Transmissions are appended as they come : the leading ones in stream
+ * order get their due time right away, a late fill leaves the rest to
+ * tx_list_seal()
+ */
+static int tx_list_add(struct session_tx_list *list, const uint64_t ts, const struct streambuffer_chunk *chunk, const size_t offset, const size_t size)
+{
+	const uint64_t from = chunk->from + offset;
+	struct session_tx *tx;
 
-	switch (len) {
-	case 3:
-		h ^= data[2] << 16; // fall through
-	case 2:
-		h ^= data[1] << 8; // fall through
-	case 1:
-		h ^= data[0];
-		h *= m;
-	};
+	if (list->count == list->alloc && tx_list_grow(list) < 0)
+		goto err;
 
-	// Do a few final mixes of the hash to ensure the last few
-	// bytes are well-incorporated.
+	tx = &list->tx[list->count ++];
+	tx->ts = ts;
+	tx->due = ts;
+	tx->from = from;
+	tx->chunk = chunk;
+	tx->offset = offset;
+	tx->size = size;
+
+	if (list->sorted == list->count - 1 && (list->sorted == 0 || tx[-1].from < from)) {
+		if (list->sorted > 0 && tx[-1].due > ts)
+			tx->due = tx[-1].due;
+		list->sorted ++;
+	}
 
-	h ^= h >> 13;
-	h *= m;
-	h ^= h >> 15;
+	return 0;
 
-	return h;
+err:
+	return -1;
 }
 
-static int tx_list_node_add(struct session_tx_list *list, const struct timeval *ts, const struct streambuffer_node *buffer)
+/*
+ * Bottom-up merge sort on the stream offset, between the array and a copy
+ * of the same size : returns the one holding the result. On equal offsets,
+ * the transmission added last comes first.
+ */
+static struct session_tx *tx_sort(struct session_tx *src, struct session_tx *dst, const size_t count)
 {
-	struct session_tx_node *after;
-	struct session_tx_node *node;
-
-	for (after = list->last ; after != NULL ; after = after->prev) {
-		if (timercmp(ts, &after->tx.ts, >))
-			break;
-		if (!timercmp(ts, &after->tx.ts, <))
-			break;
-	}
+	for (size_t width = 1 ; width < count ; width *= 2) {
+		struct session_tx *tmp;
+
+		for (size_t low = 0 ; low < count ; low += 2 * width) {
+			const size_t mid = low + width < count ? low + width : count;
+			const size_t high = low + 2 * width < count ? low + 2 * width : count;
+			size_t i = low;
+			size_t j = mid;
+
+			for (size_t k = low ; k < high ; k ++) {
+				if (i < mid && (j == high || src[i].from < src[j].from))
+					dst[k] = src[i ++];
+				else
+					dst[k] = src[j ++];
+			}
+		}
 
-	node = calloc(1, sizeof node[0]);
-	if (node == NULL) {
-		fprintf(stderr, "Failed to allocate tx_node : %s\n", strerror(errno));
-		goto err;
+		tmp = src;
+		src = dst;
+		dst = tmp;
 	}
-	node->tx.ts = *ts;
-	node->tx.buffer = buffer;
 
-	if (after != NULL) {
+	return src;
+}
 
-		node->prev = after;
-		node->next = after->next;
+/*
+ * No more transmission is expected : put late fills in stream order, the
+ * data after a hole is not due before its fill, and give back the room left
+ */
+static int tx_list_seal(struct session_tx_list *list)
+{
+	struct session_tx *tx;
+	struct session_tx *sorted;
 
-		if (after->next != NULL)
-			after->next->prev = node;
-		else
-			list->last = node;
-		after->next = node;
+	if (list->sorted == list->count && bufpool_room(list->count * sizeof tx[0]) >= list->alloc * sizeof tx[0])
+		return 0;
 
-	} else {
+	tx = bufpool_alloc(list->count * sizeof tx[0]);
+	if (tx == NULL) {
+		fprintf(stderr, "Failed to allocate %zd tx\n", list->count);
+		goto err;
+	}
 
-		node->prev = NULL;
-		node->next = list->first;
+	if (list->sorted < list->count) {
+		sorted = tx_sort(list->tx, tx, list->count);
+		if (sorted != tx)
+			memcpy(tx, sorted, list->count * sizeof tx[0]);
 
-		if (list->first != NULL)
-			list->first->prev = node;
-		else
-			list->last = node;
-		list->first = node;
-	}
+		for (size_t i = 1 ; i < list->count ; i ++) {
+			if (tx[i].due < tx[i - 1].due)
+				tx[i].due = tx[i - 1].due;
+		}
+		list->sorted = list->count;
+	} else
+		memcpy(tx, list->tx, list->count * sizeof tx[0]);
 
+	bufpool_free(list->tx);
+	list->tx = tx;
+	list->alloc = bufpool_room(list->count * sizeof tx[0]) / sizeof tx[0];
 	return 0;
 
 err:
 	return -1;
-
 }
 
-static int tx_list_init(struct session_tx_list *list)
+static void tx_list_free(struct session_tx_list *list)
 {
-	memset(list, 0, sizeof list[0]);
-	return 0;
+	bufpool_free(list->tx);
+	list->tx = NULL;
+	list->count = 0;
+	list->alloc = 0;
+	list->sorted = 0;
 }
 
-static void tx_list_free(struct session_tx_list *list)
+static struct session_tcp_info *session_tcp_info_alloc(struct region *region)
 {
-	struct session_tx_node *node;
+	struct session_tcp_info *info;
 
-	node = list->first;
-	while (node != NULL) {
-		struct session_tx_node *next = node->next;
-		free(node);
-		node = next;
+	info = region_alloc(region, sizeof info[0]);
+	if (info == NULL) {
+		fprintf(error_stream, "!!! Failed to create tcp_info\n");
+		goto err;
 	}
+	return info;
+
+err:
+	return NULL;
 }
 
-static struct session_tcp_info *session_tcp_info_alloc(void)
+/*
+ * Both sides at once, on the first payload of the session
+ */
+static int session_tcp_stream_alloc(struct session_table *table, struct session_tcp_info *info)
 {
-	struct session_tcp_info *info;
+	struct session_tcp_stream *stream;
 
-	info = calloc(1, sizeof info[0]);
-	if (info == NULL) {
-		fprintf(error_stream, "!!! Failed to create tcp_info : %s\n", strerror(errno));
+	stream = region_alloc(&table->region, 2 * sizeof stream[0]);
+	if (stream == NULL) {
+		fprintf(error_stream, "!!! Failed to create tcp streams\n");
 		goto err;
 	}
 
-	if (streambuffer_init(&info->side1.tx_buffer) < 0)
-		goto free_err;
+	streambuffer_init(&stream[0].tx_buffer, &table->region, &table->reassembly);
+	streambuffer_init(&stream[1].tx_buffer, &table->region, &table->reassembly);
+	info->side1.stream = &stream[0];
+	info->side2.stream = &stream[1];
+	return 0;
 
-	if (streambuffer_init(&info->side2.tx_buffer) < 0)
-		goto free_stream1_err;
+err:
+	return -1;
+}
 
-	if (tx_list_init(&info->side1.tx_list) < 0)
-		goto free_stream2_err;
+static struct session_udp_info *session_udp_info_alloc(struct region *region)
+{
+	struct session_udp_info *info;
 
-	if (tx_list_init(&info->side2.tx_list) < 0)
-		goto free_tx1_err;
+	info = region_alloc(region, sizeof info[0]);
+	if (info == NULL) {
+		fprintf(error_stream, "!!! Failed to create udp_info\n");
+		goto err;
+	}
 
+	udpstore_init(&info->store);
 	return info;
 
-free_tx1_err:
-	tx_list_free(&info->side1.tx_list);
-free_stream2_err:
-	streambuffer_free(&info->side2.tx_buffer);
-free_stream1_err:
-	streambuffer_free(&info->side1.tx_buffer);
-free_err:
-	free(info);
 err:
 	return NULL;
 }
 
-static void session_tcp_info_free(struct session_tcp_info *info)
-{
-	streambuffer_free(&info->side2.tx_buffer);
-	streambuffer_free(&info->side1.tx_buffer);
-	tx_list_free(&info->side1.tx_list);
-	tx_list_free(&info->side2.tx_list);
-	free(info);
-}
-
-static struct session_entry *session_entry_alloc(const struct session_key *key)
+static struct session_entry *session_entry_alloc(struct region *region, const struct session_key *key)
 {
 	struct session_entry *entry;
 
-	entry = calloc(1, sizeof entry[0]);
+	entry = region_alloc(region, sizeof entry[0]);
 	if (entry == NULL) {
-		fprintf(error_stream, "!!! Failed to create pool entry : %s\n", strerror(errno));
+		fprintf(error_stream, "!!! Failed to create pool entry\n");
 		goto err;
 	}
-	if (frame_list_init(&entry->frame_list) < 0)
-		goto free_entry_err;
 	entry->key = *key;
 	return entry;
 
-free_entry_err:
-	free(entry);
 err:
 	return NULL;
 }
 
-static void session_entry_free(struct session_entry *entry)
+/*
+ * Release what lives outside of the table region : payload buffers and UDP
+ * store arrays
+ */
+static void session_entry_release(struct session_entry *entry)
 {
-	if (entry->tcp_info != NULL)
-		session_tcp_info_free(entry->tcp_info);
-	frame_list_free(&entry->frame_list);
-	free(entry);
+	if (entry->tcp_info != NULL && entry->tcp_info->side1.stream != NULL) {
+		streambuffer_free(&entry->tcp_info->side1.stream->tx_buffer);
+		streambuffer_free(&entry->tcp_info->side2.stream->tx_buffer);
+	}
+	if (entry->udp_info != NULL)
+		udpstore_free(&entry->udp_info->store);
+	spill_reclaim();
+}
+
+static inline int addr_lower(const struct frame_addr *a1, const struct frame_addr *a2)
+{
+	if (a1->u64[0] != a2->u64[0])
+		return a1->u64[0] < a2->u64[0];
+	return a1->u64[1] < a2->u64[1];
 }
 
-static inline void get_key(struct session_key *key, const uint32_t a1, const uint32_t a2, const uint16_t p1, const uint16_t p2)
+static inline void get_key(struct session_key *key, const struct frame_addr *a1, const struct frame_addr *a2, const uint16_t p1, const uint16_t p2)
 {
-	key->a1 = a1 < a2 ? a1 : a2;
-	key->a2 = a1 < a2 ? a2 : a1;
+	const int lower = addr_lower(a1, a2);
+
+	key->w[4] = 0;
+	key->w[5] = 0;
+	key->a1 = lower ? *a1 : *a2;
+	key->a2 = lower ? *a2 : *a1;
 	key->p1 = p1 < p2 ? p1 : p2;
 	key->p2 = p1 < p2 ? p2 : p1;
 }
 
-static inline size_t get_hash(const struct session_key *key)
+static int key_print(FILE *file, const int depth, const struct session_key *key)
 {
-	const struct session_pool *null_pool = NULL;
-	return MurmurHash_32(key, sizeof key[0], 0) % (sizeof null_pool->session_hash_table / sizeof null_pool->session_hash_table[0]);
+	char str1[INET6_ADDRSTRLEN];
+	char str2[INET6_ADDRSTRLEN];
+
+	if (frame_addr_is_ipv4(&key->a1) && frame_addr_is_ipv4(&key->a2))
+		return fprintf(file, "%*sSession %#x-%#x-%#x-%#x\n", depth, "", key->a1.u32[3], key->p1, key->a2.u32[3], key->p2);
+
+	return fprintf(file, "%*sSession %s-%#x-%s-%#x\n", depth, "", frame_addr_ntop(&key->a1, str1, sizeof str1), key->p1, frame_addr_ntop(&key->a2, str2, sizeof str2), key->p2);
 }
 
-static struct session_entry *session_table_lookup(const struct session_pool *pool, const size_t hash, const struct session_key *key)
+static struct session_pool *session_pool_alloc(struct region *region)
 {
-	struct session_entry *entry = NULL;
+	struct session_pool *pool;
 
-	if (pool != NULL) {
-
-		for (entry = pool->session_hash_table[hash].last ; entry != NULL ; entry = entry->prev) {
-			if (memcmp(&entry->key, key, sizeof key[0]) == 0)
-				break;
-		}
+	pool = region_alloc(region, sizeof pool[0]);
+	if (pool == NULL) {
+		fprintf(error_stream, "!!! Failed to create pool\n");
+		goto err;
 	}
 
-	return entry;
+	if (session_hash_init(&pool->hash) < 0)
+		goto err;
+
+	return pool;
+
+err:
+	return NULL;
+}
+
+static void session_list_unlink(struct session_list *list, struct session_entry *entry)
+{
+	if (entry->idle_prev != NULL)
+		entry->idle_prev->idle_next = entry->idle_next;
+	else
+		list->first = entry->idle_next;
+
+	if (entry->idle_next != NULL)
+		entry->idle_next->idle_prev = entry->idle_prev;
+	else
+		list->last = entry->idle_prev;
+
+	entry->idle_prev = NULL;
+	entry->idle_next = NULL;
 }
 
-static struct session_entry *session_table_extend(struct session_pool **pool_ptr, const size_t hash, const struct session_key *key)
+static void session_list_link_last(struct session_list *list, struct session_entry *entry)
 {
+	entry->idle_prev = list->last;
+	entry->idle_next = NULL;
+
+	if (list->last != NULL)
+		list->last->idle_next = entry;
+	else
+		list->first = entry;
+	list->last = entry;
+}
+
+/*
+ * A frame of entry was seen : it becomes the most recently active session of
+ * its list, which stays sorted on last_ts
+ */
+static void session_entry_seen(struct session_table *table, struct session_entry *entry)
+{
+	struct session_list *list = entry->state == session_state_active ? &table->active : &table->closed;
+
+	entry->last_ts = table->now;
+	if (list->last != entry) {
+		session_list_unlink(list, entry);
+		session_list_link_last(list, entry);
+	}
+}
+
+static struct session_entry *session_entry_get(struct session_table *table, struct session_pool **pool_ptr, const struct frame_addr *saddr, const struct frame_addr *daddr, const uint16_t source, const uint16_t dest)
+{
+	struct session_entry *entry;
+	struct session_key key;
 	struct session_pool *pool = *pool_ptr;
-	struct session_entry *entry = NULL;
-	struct session_pool *new_pool = NULL;
+	uint32_t h;
 
 	if (pool == NULL) {
-		pool = calloc(1, sizeof pool[0]);
-		if (pool == NULL) {
-			fprintf(error_stream, "!!! Failed to create pool : %s\n", strerror(errno));
+		pool = session_pool_alloc(&table->region);
+		if (pool == NULL)
 			goto err;
-		}
 		*pool_ptr = pool;
-		new_pool = pool;
 	}
 
-	entry = session_entry_alloc(key);
+	get_key(&key, saddr, daddr, source, dest);
+	h = session_hash_key(&pool->hash, &key);
+
+	entry = session_hash_lookup(&pool->hash, h, &key);
+	if (entry != NULL) {
+		session_entry_seen(table, entry);
+		return entry;
+	}
+
+	entry = session_entry_alloc(&table->region, &key);
 	if (entry == NULL)
 		goto err;
 
-	entry->prev = pool->session_hash_table[hash].last;
-	pool->session_hash_table[hash].last = entry;
-	if (new_pool != NULL)
-		*pool_ptr = new_pool;
+	if (session_hash_insert(&pool->hash, h, &key, entry) < 0)
+		goto err;
+
+	entry->prev = pool->last;
+	if (pool->last != NULL)
+		pool->last->next = entry;
+	else
+		pool->first = entry;
+	pool->last = entry;
+
+	entry->last_ts = table->now;
+	session_list_link_last(&table->active, entry);
+	table->active_count ++;
 	return entry;
 
 err:
-	if (new_pool != NULL)
-		free(new_pool);
 	return NULL;
 }
 
-static struct session_entry *session_entry_get(struct session_pool **pool_ptr, const uint32_t saddr, const uint32_t daddr, const uint16_t source, const uint16_t dest)
+static void lru_unlink(struct session_table *table, struct session_entry *entry)
 {
-	struct session_entry *entry = NULL;
-	struct session_key key;
-	struct session_pool *pool = *pool_ptr;
-	size_t hash;
+	if (entry->lru_prev != NULL)
+		entry->lru_prev->lru_next = entry->lru_next;
+	else
+		table->lru_first = entry->lru_next;
 
-	get_key(&key, saddr, daddr, source, dest);
-	hash = get_hash(&key);
+	if (entry->lru_next != NULL)
+		entry->lru_next->lru_prev = entry->lru_prev;
+	else
+		table->lru_last = entry->lru_prev;
+
+	entry->lru_prev = NULL;
+	entry->lru_next = NULL;
+}
+
+static void lru_link_last(struct session_table *table, struct session_entry *entry)
+{
+	entry->lru_prev = table->lru_last;
+	entry->lru_next = NULL;
 
-	if (pool == NULL)
-		entry = NULL;
+	if (table->lru_last != NULL)
+		table->lru_last->lru_next = entry;
 	else
-		entry = session_table_lookup(pool, hash, &key);
+		table->lru_first = entry;
+	table->lru_last = entry;
+}
 
-	if (entry == NULL)
-		entry = session_table_extend(pool_ptr, hash, &key);
+static int session_entry_spill(struct session_entry *entry)
+{
+	size_t released;
+	int ret = 0;
 
-	return entry;
+	if (entry->tcp_info != NULL && entry->tcp_info->side1.stream != NULL) {
+		if (streambuffer_spill(&entry->tcp_info->side1.stream->tx_buffer, &released) < 0)
+			ret = -1;
+		entry->resident -= released;
+
+		if (streambuffer_spill(&entry->tcp_info->side2.stream->tx_buffer, &released) < 0)
+			ret = -1;
+		entry->resident -= released;
+	}
+
+	if (entry->udp_info != NULL) {
+		if (udpstore_spill(&entry->udp_info->store, &released) < 0)
+			ret = -1;
+		entry->resident -= released;
+	}
+
+	return ret;
+}
+
+/*
+ * Spill the coldest sessions until 1/8 of the budget is free again, so that
+ * the next few payloads do not trigger another round. Sessions spill the
+ * blocks they share too, the rest of the store goes once they are all out.
+ */
+static int session_table_spill(struct session_table *table)
+{
+	const size_t target = table->mem_limit - table->mem_limit / 8;
+
+	while (table->resident + blockstore_held() > target) {
+		struct session_entry *entry = table->lru_first;
+		size_t resident;
+
+		if (entry == NULL)
+			return blockstore_spill_all();
+
+		resident = entry->resident;
+		lru_unlink(table, entry);
+		if (session_entry_spill(entry) < 0)
+			goto err;
+
+		table->resident -= resident - entry->resident;
+		table->spilled += resident - entry->resident;
+		entry->spilled += resident - entry->resident;
+	}
+
+	return 0;
+
+err:
+	return -1;
+}
+
+/*
+ * Account for new payload held by entry, less what compression and the
+ * block store took over. It becomes the hottest session.
+ */
+static int session_entry_touch(struct session_table *table, struct session_entry *entry, const ssize_t size)
+{
+	if (table->mem_limit == 0)
+		return 0;
+
+	if (entry->resident > 0)
+		lru_unlink(table, entry);
+
+	entry->resident += size;
+	table->resident += size;
+
+	if (entry->resident > 0)
+		lru_link_last(table, entry);
+
+	if (table->resident + blockstore_held() > table->mem_limit)
+		return session_table_spill(table);
+	return 0;
+}
+
+/*
+ * Drop the payloads of a session, and the streams pointing to them
+ */
+static void session_entry_compact(struct session_table *table, struct session_entry *entry)
+{
+	struct session_tcp_info *info = entry->tcp_info;
+
+	if (entry->resident > 0) {
+		lru_unlink(table, entry);
+		table->resident -= entry->resident;
+		entry->resident = 0;
+	}
+	table->spilled -= entry->spilled;
+	entry->spilled = 0;
+
+	if (info != NULL && info->side1.stream != NULL) {
+		tx_list_free(&info->side1.stream->tx_list);
+		tx_list_free(&info->side2.stream->tx_list);
+	}
+	session_entry_release(entry);
+
+	if (info != NULL && info->side1.stream != NULL) {
+		region_recycle(&table->region, info->side1.stream, 2 * sizeof info->side1.stream[0]);
+		info->side1.stream = NULL;
+		info->side2.stream = NULL;
+	}
+}
+
+/*
+ * Only reached by sessions that were never indexed by endpoint
+ */
+static void session_entry_free(struct session_table *table, struct session_pool *pool, struct session_entry *entry)
+{
+	session_entry_compact(table, entry);
+
+	if (entry->prev != NULL)
+		entry->prev->next = entry->next;
+	else
+		pool->first = entry->next;
+
+	if (entry->next != NULL)
+		entry->next->prev = entry->prev;
+	else
+		pool->last = entry->prev;
+
+	region_recycle(&table->region, entry->tcp_info, sizeof entry->tcp_info[0]);
+	region_recycle(&table->region, entry->udp_info, sizeof entry->udp_info[0]);
+	region_recycle(&table->region, entry, sizeof entry[0]);
+}
+
+/*
+ * Streams and their transmissions give back their spare room, streams
+ * shrink once compressed
+ */
+static int session_entry_seal(struct session_table *table, struct session_entry *entry)
+{
+	struct streambuffer *buffer1 = &entry->tcp_info->side1.stream->tx_buffer;
+	struct streambuffer *buffer2 = &entry->tcp_info->side2.stream->tx_buffer;
+	const size_t resident = buffer1->resident + buffer2->resident;
+	size_t released;
+	int ret = 0;
+
+	if (streambuffer_seal(buffer1) < 0 || streambuffer_seal(buffer2) < 0)
+		ret = -1;
+	if (tx_list_seal(&entry->tcp_info->side1.stream->tx_list) < 0 || tx_list_seal(&entry->tcp_info->side2.stream->tx_list) < 0)
+		ret = -1;
+
+	released = resident - buffer1->resident - buffer2->resident;
+	if (table->mem_limit != 0 && entry->resident > 0) {
+		entry->resident -= released;
+		table->resident -= released;
+		if (entry->resident == 0)
+			lru_unlink(table, entry);
+	}
+
+	return ret;
+}
+
+/*
+ * Ingest is over : the streams of sessions still open are sealed too, their
+ * timelines put in stream order
+ */
+int session_table_seal(struct session_table *table)
+{
+	if (table->tcp == NULL)
+		return 0;
+
+	for (struct session_entry *entry = table->tcp->first ; entry != NULL ; entry = entry->next) {
+		if (entry->tcp_info == NULL || entry->tcp_info->side1.stream == NULL)
+			continue;
+		if (session_entry_seal(table, entry) < 0)
+			goto err;
+	}
+
+	return 0;
+
+err:
+	return -1;
+}
+
+/*
+ * No more payload is expected : what is not retained goes away now, the
+ * session itself stays in the lookup hash while it lingers
+ */
+static void session_entry_close(struct session_table *table, struct session_entry *entry)
+{
+	if (entry->state != session_state_active)
+		return;
+
+	session_list_unlink(&table->active, entry);
+	table->active_count --;
+
+	entry->state = session_state_closed;
+	session_list_link_last(&table->closed, entry);
+	table->closed_count ++;
+
+	if (entry->tcp_info != NULL)
+		entry->tcp_info->status |= TCP_CNX_CLOSED;
+
+	if (table->retain != session_retain_all)
+		session_entry_compact(table, entry);
+	else if (entry->tcp_info != NULL && entry->tcp_info->side1.stream != NULL && session_entry_seal(table, entry) < 0)
+		fprintf(error_stream, "Failed to seal a closed session\n");
+}
+
+static void session_entry_retire(struct session_table *table, struct session_entry *entry)
+{
+	struct session_pool *pool = entry->tcp_info != NULL ? table->tcp : table->udp;
+
+	session_hash_remove(&pool->hash, session_hash_key(&pool->hash, &entry->key), &entry->key);
+
+	session_list_unlink(&table->closed, entry);
+	table->closed_count --;
+	entry->state = session_state_retired;
+
+	if (table->retain == session_retain_none) {
+		session_entry_free(table, pool, entry);
+		table->released_count ++;
+	} else
+		table->retired_count ++;
+}
+
+/*
+ * Retire the sessions closed for long enough, and close the ones idle for
+ * longer than the timeout. Both lists are sorted on last_ts, only their heads
+ * are checked.
+ */
+static void session_table_expire(struct session_table *table)
+{
+	while (table->closed.first != NULL && table->closed.first->last_ts + SESSION_CLOSED_LINGER <= table->now)
+		session_entry_retire(table, table->closed.first);
+
+	if (table->idle_timeout == 0)
+		return;
+
+	while (table->active.first != NULL && table->active.first->last_ts + table->idle_timeout <= table->now) {
+		struct session_entry *entry = table->active.first;
+
+		session_entry_close(table, entry);
+		session_entry_retire(table, entry);
+		table->timed_out_count ++;
+	}
+}
+
+/*
+ * Both sides of a new TCP session go in the endpoint index, once if they
+ * share the same host or port
+ */
+static int session_index_tcp(struct session_table *table, struct session_entry *entry)
+{
+	struct endpoint_index *index = &table->tcp_endpoints;
+	const struct session_tcp_side *side1 = &entry->tcp_info->side1;
+	const struct session_tcp_side *side2 = &entry->tcp_info->side2;
+	const int same_addr = frame_addr_equal(&side1->addr, &side2->addr);
+	const int same_port = side1->port == side2->port;
+
+	if (endpoint_index_add(index, endpoint_kind_addr_port, &side1->addr, side1->port, entry) < 0)
+		goto err;
+	if (!(same_addr && same_port) && endpoint_index_add(index, endpoint_kind_addr_port, &side2->addr, side2->port, entry) < 0)
+		goto err;
+
+	if (endpoint_index_add(index, endpoint_kind_addr, &side1->addr, 0, entry) < 0)
+		goto err;
+	if (!same_addr && endpoint_index_add(index, endpoint_kind_addr, &side2->addr, 0, entry) < 0)
+		goto err;
+
+	if (endpoint_index_add(index, endpoint_kind_port, NULL, side1->port, entry) < 0)
+		goto err;
+	if (!same_port && endpoint_index_add(index, endpoint_kind_port, NULL, side2->port, entry) < 0)
+		goto err;
+
+	return 0;
+
+err:
+	return -1;
+}
+
+static void session_stats_frame(struct session_stats *stats, const int dir, const struct frame *frame)
+{
+	if ((stats->dir[0].packets == 0 && stats->dir[1].packets == 0) || frame->ts < stats->first_ts)
+		stats->first_ts = frame->ts;
+	if (frame->ts > stats->last_ts)
+		stats->last_ts = frame->ts;
+
+	stats->dir[dir].packets ++;
+	stats->dir[dir].bytes += frame_app_size(frame);
+}
+
+/*
+ * to sent the frame : follow its highest byte sent, and the acks it gives
+ * to the bytes of from
+ */
+static void session_stats_tcp(struct session_stats_dir *dir, struct session_tcp_side *to, struct session_tcp_side *from, const struct frame *frame, const uint32_t seq, const uint32_t ack)
+{
+	const uint32_t app_size = frame_app_size(frame);
+	uint32_t end;
+
+	if ((frame->tcp_flags & TH_ACK) != 0) {
+		if (!from->acked_known || (int32_t)(ack - from->acked) > 0) {
+			from->acked = ack;
+			from->acked_known = 1;
+		}
+
+		if (frame->tcp_zero_window && (frame->tcp_flags & (TH_SYN | TH_FIN | TH_RST)) == 0)
+			dir->zero_windows ++;
+	}
+
+	if (app_size == 0)
+		return;
+
+	end = seq + app_size;
+	if (!to->seq_known) {
+		to->seq_next = end;
+		to->seq_known = 1;
+	} else if ((int32_t)(end - to->seq_next) <= 0)
+		dir->retransmits ++;
+	else {
+		if ((int32_t)(seq - to->seq_next) > 0)
+			dir->out_of_order ++;
+		to->seq_next = end;
+	}
+
+	if (to->acked_known && (int32_t)(to->seq_next - to->acked) > 0 && to->seq_next - to->acked > dir->max_in_flight)
+		dir->max_in_flight = to->seq_next - to->acked;
 }
 
 #define TH_CONNECTED (TH_SYN | TH_ACK)
+#define TH_ECN (0x40 | 0x80)	/* ECE and CWR, set along the SYNs of an ECN setup */
 
-static int process_tcp(struct session_pool **pool_ptr, struct frame_node *frame_node)
+struct tcp_saved {
+	struct session_tx_list *tx_list;
+	uint64_t ts;
+};
+
+/*
+ * Every range stored for a segment gets its transmission
+ */
+static int tcp_saved(void *arg, const struct streambuffer_chunk *chunk, const size_t offset, const size_t size)
+{
+	struct tcp_saved *saved = arg;
+
+	return tx_list_add(saved->tx_list, saved->ts, chunk, offset, size);
+}
+
+/*
+ * Sequence numbers wrap every 4GB : a segment takes the 64-bit stream offset
+ * nearest to the end of the stored data. Segments stay within a window of
+ * it, 1GB at most with window scaling, well inside the 2GB either way.
+ */
+static inline int64_t session_tcp_unwrap(const uint32_t rel_seq, const uint64_t offset_next)
+{
+	return (int64_t)offset_next + (int32_t)(rel_seq - (uint32_t)offset_next);
+}
+
+static int process_tcp(struct session_table *table, struct frame_node *frame_node)
 {
 	struct frame *frame = &frame_node->frame;
-	const struct frame_net_ip *ip = &frame->net.ip;
-	const struct tcphdr *tcp = &frame->proto.tcp.hdr;
-	const uint32_t seq = htonl(tcp->seq);
-	const uint32_t ack = htonl(tcp->ack_seq);
+	const struct frame_net_ip *ip = &frame->ip;
+	const uint32_t seq = htonl(frame->seq);
+	const uint32_t ack = htonl(frame->ack_seq);
+	const uint32_t app_size = frame_app_size(frame);
 	struct session_entry *entry;
 	struct session_tcp_info *info;
 	struct session_tcp_side *from;
 	struct session_tcp_side *to;
-	size_t len;
-	uint8_t *data;
-	size_t offset;
+	int64_t offset;
+	int closing = 0;
 
-	if (tcp->source == 0 || tcp->dest == 0) {
-		fprintf(stderr, "Invalid TCP source / dest = %u / %u\n", tcp->source, tcp->dest);
+	if (frame->source == 0 || frame->dest == 0) {
+		counters_error(counter_tcp_port, "Invalid TCP source / dest = %u / %u\n", frame->source, frame->dest);
 		goto frame_err;
 	}
 
-	entry = session_entry_get(pool_ptr, ip->source.s_addr, ip->dest.s_addr, tcp->source, tcp->dest);
+	entry = session_entry_get(table, &table->tcp, &ip->source, &ip->dest, frame->source, frame->dest);
 	if (entry == NULL)
 		goto fatal_err;
 
+	if (entry->state == session_state_closed && (frame->tcp_flags & (TH_SYN | TH_ACK | TH_RST | TH_FIN)) == TH_SYN) {
+		/* A new connection reusing the endpoints of a closed one, ECN setup SYNs included */
+		session_entry_retire(table, entry);
+
+		entry = session_entry_get(table, &table->tcp, &ip->source, &ip->dest, frame->source, frame->dest);
+		if (entry == NULL)
+			goto fatal_err;
+	}
+
 	from = NULL;
 	to = NULL;
 
 	info = entry->tcp_info;
 	if (info == NULL) {
-		info = session_tcp_info_alloc();
+		info = session_tcp_info_alloc(&table->region);
 		if (info == NULL)
 			goto fatal_err;
 		entry->tcp_info = info;
@@ -330,39 +855,54 @@ static int process_tcp(struct session_pool **pool_ptr, struct frame_node *frame_
 		from = &info->side2;
 
 		to->addr = ip->source;
-		to->port = tcp->source;
+		to->port = frame->source;
 		from->addr = ip->dest;
-		from->port = tcp->dest;
+		from->port = frame->dest;
+
+		if (table->retain != session_retain_none && session_index_tcp(table, entry) < 0)
+			goto fatal_err;
 
 	} else {
 
-		if (ip->source.s_addr == info->side1.addr.s_addr && ip->dest.s_addr == info->side2.addr.s_addr && tcp->source == info->side1.port && tcp->dest == info->side2.port) {
+		if (frame_addr_equal(&ip->source, &info->side1.addr) && frame_addr_equal(&ip->dest, &info->side2.addr) && frame->source == info->side1.port && frame->dest == info->side2.port) {
 			to = &info->side1;
 			from = &info->side2;
 		}
 
-		if (ip->source.s_addr == info->side2.addr.s_addr && ip->dest.s_addr == info->side1.addr.s_addr && tcp->source == info->side2.port && tcp->dest == info->side1.port) {
+		if (frame_addr_equal(&ip->source, &info->side2.addr) && frame_addr_equal(&ip->dest, &info->side1.addr) && frame->source == info->side2.port && frame->dest == info->side1.port) {
 			to = &info->side2;
 			from = &info->side1;
 		}
 	}
 
 	if (to == NULL || from == NULL) {
-		fprintf(stderr, "Unexpected source / dest (Got <%u / %u>, <%u / %u> expected\n", tcp->source, tcp->dest, info->side1.port, info->side2.port);
+		counters_error(counter_tcp_side, "Unexpected source / dest (Got <%u / %u>, <%u / %u> expected\n", frame->source, frame->dest, info->side1.port, info->side2.port);
 		goto frame_err;
 	}
 
-	if ((tcp->th_flags & TH_FIN) != 0) {
-		info->status |= TCP_CNX_CLOSED;
-		info->status &= ~TCP_CNX_OPEN_DONE;
-	}
+	session_stats_frame(&entry->stats, to == &info->side1 ? 0 : 1, frame);
+	session_stats_tcp(&entry->stats.dir[to == &info->side1 ? 0 : 1], to, from, frame, seq, ack);
 
 	if ((info->status & TCP_CNX_CLOSED) != 0)
 		goto drop_frame;
 
+	if ((frame->tcp_flags & TH_RST) != 0) {
+		closing = 1;
+		goto drop_frame;
+	}
+
+	/* Nothing is expected from a side after its FIN */
+	if (to->fin)
+		goto drop_frame;
+
+	if ((frame->tcp_flags & TH_FIN) != 0) {
+		to->fin = 1;
+		closing = from->fin;
+	}
+
 	if ((info->status & TCP_CNX_OPEN_DONE) != TCP_CNX_OPEN_DONE) {
 
-		switch (tcp->th_flags) {
+		switch (frame->tcp_flags & ~TH_ECN) {
 		default:
 			if (info->client == NULL || info->server == NULL) {
 				info->status |= TCP_CNX_OPEN_DONE;
@@ -371,7 +911,7 @@ static int process_tcp(struct session_pool **pool_ptr, struct frame_node *frame_
 				goto keep_frame;
 			}
 
-			fprintf(error_stream, "!!! Unexpected flags in CNX stage\n");
+			counters_error(counter_tcp_cnx_flags, "!!! Unexpected flags in CNX stage\n");
 			goto frame_err;
 
 		case TH_SYN:
@@ -379,12 +919,12 @@ static int process_tcp(struct session_pool **pool_ptr, struct frame_node *frame_
 			info->server = from;
 			info->status = TCP_CNX_SYN;
 			from->first_seq = seq;
-			to->seq = 0;
+			info->syn_ts = frame->ts;
 			break;
 
 		case TH_SYN | TH_ACK:
 			if (ack != to->first_seq + 1) {
-				fprintf(error_stream, "!!! Invalid SYN ACK on cnx : Got <%u>, <%u> expected\n", ack, to->first_seq + 1);
+				counters_error(counter_tcp_syn_ack, "!!! Invalid SYN ACK on cnx : Got <%u>, <%u> expected\n", ack, to->first_seq + 1);
 				goto frame_err;
 			}
 
@@ -403,10 +943,13 @@ static int process_tcp(struct session_pool **pool_ptr, struct frame_node *frame_
 			}
 
 			if (ack != to->first_seq + 1) {
-				fprintf(error_stream, "!!! Invalid ACK on cnx : Got <%u>, <%u> expected\n", ack, to->first_seq + 1);
+				counters_error(counter_tcp_ack, "!!! Invalid ACK on cnx : Got <%u>, <%u> expected\n", ack, to->first_seq + 1);
 				goto frame_err;
 			}
 			info->status |= TCP_CNX_OPEN_DONE;
+
+			if (info->syn_ts != 0 && frame->ts >= info->syn_ts)
+				entry->stats.rtt = frame->ts - info->syn_ts;
 			break;
 		}
 
@@ -415,70 +958,110 @@ static int process_tcp(struct session_pool **pool_ptr, struct frame_node *frame_
 
 keep_frame:
 
-	offset = seq - from->first_seq - 1;
+	offset = session_tcp_unwrap(seq - from->first_seq - 1, to->offset_next);
 
-	len = frame_steal_app(frame, &data);
-	if (len > 0) {
-		int res;
-		struct streambuffer_node *buffer = NULL;
+	if (app_size > 0 && to->stream == NULL && session_tcp_stream_alloc(table, info) < 0)
+		goto fatal_err;
 
-		res = streambuffer_add(&to->tx_buffer, data, offset, len, &buffer);
-		if (res <= 0)
-			frame_update_app(frame, data, len);
-		else
-			tx_list_node_add(&to->tx_list, &frame->ts, buffer);
+	/* Payloads are copied into the stream chunks, the frame keeps its own */
+	if (app_size > 0) {
+		struct streambuffer *buffer = &to->stream->tx_buffer;
+		const size_t resident = buffer->resident;
+		struct tcp_saved saved = { &to->stream->tx_list, frame->ts };
+		int res;
 
-		if (res < 0) {
-			fprintf(stderr, "!!! TCP data have not been saved (offset = %zd)\n", offset);
+		if (offset < 0) {
+			counters_error(counter_tcp_data, "!!! TCP data before the stream start (offset = %" PRId64 ")\n", offset);
 			goto frame_err;
 		}
 
+		res = streambuffer_add(buffer, frame->app_data, offset, app_size, tcp_saved, &saved);
+		if (res < 0)
+			goto fatal_err;
+		if (res == 0)
+			goto drop_frame;
+
+		if ((uint64_t)offset + app_size > to->offset_next)
+			to->offset_next = offset + app_size;
+
+		if (session_entry_touch(table, entry, (ssize_t)buffer->resident - (ssize_t)resident) < 0)
+			goto fatal_err;
 	}
-	return 0;
 
 frame_err:
-	frame_print(error_stream, 0, frame, 0);
 drop_frame:
+	if (closing)
+		session_entry_close(table, entry);
 	return 0;
 fatal_err:
 	return -1;
 }
 
-static int process_udp(struct session_pool **pool_ptr, struct frame_list *frame_list, struct frame_node *frame_node)
+static int process_udp(struct session_table *table, struct frame_node *frame_node)
 {
 	const struct frame *frame = &frame_node->frame;
+	const struct frame_net_ip *ip = &frame->ip;
+	const uint32_t app_size = frame_app_size(frame);
 	struct session_entry *entry;
-	int ret = -1;
+	struct session_udp_info *info;
+	int side;
 
-	entry = session_entry_get(pool_ptr, frame->net.ip.source.s_addr, frame->net.ip.dest.s_addr, frame->proto.udp.hdr.source, frame->proto.udp.hdr.dest);
+	entry = session_entry_get(table, &table->udp, &ip->source, &ip->dest, frame->source, frame->dest);
 	if (entry == NULL)
 		goto err;
 
-	frame_list_unlink(frame_list, frame_node);
-	frame_list_link_ordered(&entry->frame_list, frame_node);
-	ret = 1;
+	info = entry->udp_info;
+	if (info == NULL) {
+		info = session_udp_info_alloc(&table->region);
+		if (info == NULL)
+			goto err;
+		entry->udp_info = info;
+
+		info->side1.addr = ip->source;
+		info->side1.port = frame->source;
+		info->side2.addr = ip->dest;
+		info->side2.port = frame->dest;
+	}
+
+	side = (frame_addr_equal(&ip->source, &info->side1.addr) && frame->source == info->side1.port) ? 0 : 1;
+	session_stats_frame(&entry->stats, side, frame);
+
+	/*
+	 * Only the payload is kept, the frame itself goes back to the frame table
+	 */
+	if (udpstore_add(&info->store, frame->ts, side, frame->app_data, app_size) < 0)
+		goto err;
+
+	if (app_size > 0 && session_entry_touch(table, entry, app_size) < 0)
+		goto err;
+	return 0;
+
 err:
-	return ret;
+	return -1;
 }
 
-int session_process_frame(struct session_table *table, struct frame_list *frame_list, struct frame_node *frame_node)
+int session_process_frame(struct session_table *table, struct frame_node *frame_node)
 {
 	int ret = 0;
 	struct frame *frame = &frame_node->frame;
 
-	if (frame->net.type != frame_net_type_ip)
+	if (frame->ts > table->now)
+		table->now = frame->ts;
+	session_table_expire(table);
+
+	if (frame->net_type != frame_net_type_ip && frame->net_type != frame_net_type_ipv6)
 		goto drop_frame;
 
-	switch (frame->proto.type) {
+	switch (frame->proto_type) {
 	default:
 		goto drop_frame;
 
 	case frame_proto_type_udp:
-		ret = process_udp(&table->udp, frame_list, frame_node);
+		ret = process_udp(table, frame_node);
 		break;
 
 	case frame_proto_type_tcp:
-		ret = process_tcp(&table->tcp, frame_node);
+		ret = process_tcp(table, frame_node);
 		break;
 
 	}
@@ -487,86 +1070,201 @@ drop_frame:
 	return ret;
 }
 
-static void session_entry_list_free(struct session_entry *last)
-{
-	struct session_entry *ptr;
-	struct session_entry *prev;
-
-	ptr = last;
-	while (ptr != NULL) {
-		prev = ptr->prev;
-		session_entry_free(ptr);
-		ptr = prev;
-	}
-}
-
-static void session_pool_free(struct session_pool *pool)
+static void session_pool_release(struct session_pool *pool)
 {
-	size_t idx;
-
-	for (idx = 0 ; idx < sizeof pool->session_hash_table / sizeof pool->session_hash_table[0] ; idx ++)
-		session_entry_list_free(pool->session_hash_table[idx].last);
-	free(pool);
+	for (struct session_entry *entry = pool->first ; entry != NULL ; entry = entry->next)
+		session_entry_release(entry);
+	session_hash_free(&pool->hash);
 }
 
 void session_table_free(struct session_table *table)
 {
 	if (table->tcp != NULL) {
-		session_pool_free(table->tcp);
+		session_pool_release(table->tcp);
 		table->tcp = NULL;
 	}
 
 	if (table->udp != NULL) {
-		session_pool_free(table->udp);
+		session_pool_release(table->udp);
 		table->udp = NULL;
 	}
+
+	endpoint_index_free(&table->tcp_endpoints);
+	region_free(&table->region);
+	table->lru_first = NULL;
+	table->lru_last = NULL;
+	table->resident = 0;
+	spill_close();
+	streambuffer_cache_free();
+	blockstore_free();
 }
 
-static int generic_pool_dump(FILE *file, const int depth, const struct session_pool *pool, const int full)
+static int udp_side_print(FILE *file, const struct session_udp_side *side)
 {
+	char str[INET6_ADDRSTRLEN];
+
+	if (frame_addr_is_ipv4(&side->addr))
+		return fprintf(file, "%s:%d", frame_addr_ntop(&side->addr, str, sizeof str), htons(side->port));
+	return fprintf(file, "[%s]:%d", frame_addr_ntop(&side->addr, str, sizeof str), htons(side->port));
+}
+
+static int udp_info_dump(FILE *file, const int depth, const struct session_udp_info *info)
+{
+	const struct udpstore *store = &info->store;
 	int done = 0;
 
-	for (size_t idx = 0 ; idx < sizeof pool->session_hash_table / sizeof pool->session_hash_table[0] ; idx ++) {
-		for (struct session_entry *entry = pool->session_hash_table[idx].last ; entry != NULL ; entry = entry->prev) {
-			done += fprintf(file, "%*sSession %#x-%#x-%#x-%#x\n", depth, "", entry->key.a1, entry->key.p1, entry->key.a2, entry->key.p2);
-			if (full > 0)
-				done += frame_list_dump(file, depth + 1, &entry->frame_list, full);
-		}
+	for (size_t idx = 0 ; idx < store->count ; idx ++) {
+		const struct udpstore_ref *ref = &store->ref[idx];
+
+		done += fprintf(file, "%*s[%lds, %ldus]\n", depth, "", (long)(store->ts[idx] / 1000000), (long)(store->ts[idx] % 1000000));
+		done += fprintf(file, "%*sUDP ", depth + 1, "");
+		done += udp_side_print(file, ref->side == 0 ? &info->side1 : &info->side2);
+		done += fprintf(file, " -> ");
+		done += udp_side_print(file, ref->side == 0 ? &info->side2 : &info->side1);
+		done += fprintf(file, "\n%*sData (%db)\n", depth + 2, "", ref->size);
+		if (ref->size > 0)
+			done += rawprint(file, depth + 3, udpstore_data(store, idx), ref->size, 8, 4);
 	}
 
 	return done;
 }
 
+static int stats_print(FILE *file, const int depth, const struct session_stats *stats)
+{
+	const uint64_t duration = stats->last_ts - stats->first_ts;
+	int done = 0;
+
+	done += fprintf(file, "%*sDuration %" PRIu64 ".%06" PRIu64 "s", depth, "", duration / 1000000, duration % 1000000);
+	if (stats->rtt > 0)
+		done += fprintf(file, ", rtt %" PRIu64 "us", stats->rtt);
+	done += fprintf(file, "\n");
+	return done;
+}
 
-static int tcp_side_dump(FILE *file, const int depth, const char *name, const struct session_tcp_side *side, const struct timeval *t0, const int full)
+static int udp_entry_dump(FILE *file, const int depth, const struct session_entry *entry, const int full)
 {
 	int done = 0;
 
-	done += fprintf(file, "%*s%s : %s:%d\n", depth, "", name, inet_ntoa(side->addr), htons(side->port));
+	done += key_print(file, depth, &entry->key);
+	if (entry->udp_info == NULL)
+		return done;
+
+	done += stats_print(file, depth + 1, &entry->stats);
+	for (int side = 0 ; side < 2 ; side ++) {
+		done += fprintf(file, "%*s", depth + 1, "");
+		done += udp_side_print(file, side == 0 ? &entry->udp_info->side1 : &entry->udp_info->side2);
+		done += fprintf(file, " : %" PRIu64 " packet(s), %" PRIu64 "b\n", entry->stats.dir[side].packets, entry->stats.dir[side].bytes);
+	}
+
+	if (full > 0)
+		done += udp_info_dump(file, depth + 1, entry->udp_info);
+	return done;
+}
+
+static int udp_pool_dump(FILE *file, const int depth, const struct session_pool *pool, const int full)
+{
+	int done = 0;
+
+	for (struct session_entry *entry = pool->first ; entry != NULL ; entry = entry->next)
+		done += udp_entry_dump(file, depth, entry, full);
+
+	return done;
+}
+
+
+const struct session_tx_list *session_tcp_side_tx_list(const struct session_tcp_side *side)
+{
+	static const struct session_tx_list empty;
+
+	return side->stream != NULL ? &side->stream->tx_list : &empty;
+}
+
+/*
+ * First transmission holding bytes at or after this stream offset : the
+ * replay starts in its middle when it holds bytes before
+ */
+size_t session_tx_list_seek_offset(const struct session_tx_list *list, const uint64_t offset)
+{
+	size_t low = 0;
+	size_t high = list->count;
+
+	while (low < high) {
+		const size_t mid = low + (high - low) / 2;
+
+		if (list->tx[mid].from <= offset)
+			low = mid + 1;
+		else
+			high = mid;
+	}
+
+	if (low > 0 && list->tx[low - 1].from + list->tx[low - 1].size > offset)
+		low --;
+	return low;
+}
+
+/*
+ * First transmission due dt (us) or more after the first one
+ */
+size_t session_tx_list_seek_time(const struct session_tx_list *list, const uint64_t dt)
+{
+	size_t low = 0;
+	size_t high = list->count;
+
+	while (low < high) {
+		const size_t mid = low + (high - low) / 2;
+
+		if (list->tx[mid].due - list->tx[0].due < dt)
+			low = mid + 1;
+		else
+			high = mid;
+	}
+
+	return low;
+}
+
+static int tcp_side_dump(FILE *file, const int depth, const char *name, const struct session_tcp_side *side, const struct session_stats_dir *stats, const uint64_t t0, const int full)
+{
+	int done = 0;
+	char str[INET6_ADDRSTRLEN];
+
+	if (frame_addr_is_ipv4(&side->addr))
+		done += fprintf(file, "%*s%s : %s:%d", depth, "", name, frame_addr_ntop(&side->addr, str, sizeof str), htons(side->port));
+	else
+		done += fprintf(file, "%*s%s : [%s]:%d", depth, "", name, frame_addr_ntop(&side->addr, str, sizeof str), htons(side->port));
+	done += fprintf(file, ", %" PRIu64 " packet(s), %" PRIu64 "b, %u retransmit(s), %u out of order, %u zero window(s), %" PRIu64 "b max in flight\n", stats->packets, stats->bytes, stats->retransmits, stats->out_of_order, stats->zero_windows, stats->max_in_flight);
 
 	if (full > 0) {
+		const struct fingerprint_stream *fingerprint = side->stream != NULL ? streambuffer_fingerprint(&side->stream->tx_buffer) : NULL;
+		const struct session_tx_list *list = session_tcp_side_tx_list(side);
+
+		if (fingerprint != NULL) {
+			struct fingerprint fp;
 
-		for (struct session_tx_node *node = side->tx_list.first ; node != NULL ; node = node->next) {
-			struct timeval dt;
+			fingerprint_stream_final(fingerprint, &fp);
+			done += fprintf(file, "%*sFingerprint %016" PRIx64 "%016" PRIx64 " over %" PRIu64 "b, %zd span(s)\n", depth, "", fp.h1, fp.h2, fingerprint->size, fingerprint->span_count);
+		}
 
-			timersub(&node->tx.ts, t0, &dt);
+		for (size_t i = 0 ; i < list->count ; i ++) {
+			const struct session_tx *tx = &list->tx[i];
+			const int64_t dt = tx->ts - t0;
+			const int64_t sec = dt >= 0 ? dt / 1000000 : -((999999 - dt) / 1000000);
 
-			done += fprintf(file, "%*s[%ld, %ld]\n", depth, "", dt.tv_sec, dt.tv_usec);
-			done += streambuffer_node_dump(file, depth + 1, node->tx.buffer);
+			done += fprintf(file, "%*s[%" PRId64 ", %" PRId64 "]\n", depth, "", sec, dt - sec * 1000000);
+			done += streambuffer_range_dump(file, depth + 1, tx->chunk, tx->offset, tx->size);
 		}
 	}
 
 	return done;
 }
 
-static int tcp_info_dump(FILE *file, const int depth, const struct session_tcp_info *info, const int full)
+static int tcp_info_dump(FILE *file, const int depth, const struct session_tcp_info *info, const struct session_stats *stats, const int full)
 {
 	int done = 0;
 	const struct session_tcp_side *side1;
 	const char *side1_name;
 	const struct session_tcp_side *side2;
 	const char *side2_name;
-	struct timeval t1, t2, *t0;
+	uint64_t t1, t2, t0;
 
 	if (info->client != NULL || info->server != NULL) {
 		if (info->client == NULL || info->server == NULL)
@@ -583,58 +1281,118 @@ static int tcp_info_dump(FILE *file, const int depth, const struct session_tcp_i
 	}
 
 
-	if (side1->tx_list.first != NULL)
-		t1 = side1->tx_list.first->tx.ts;
-	else
-		memset(&t1, 0, sizeof t1);
-	if (side2->tx_list.first != NULL)
-		t2 = side2->tx_list.first->tx.ts;
-	else
-		memset(&t2, 0, sizeof t2);
-	if (timercmp(&t1, &t2, <))
-		t0 = &t1;
-	else
-		t0 = &t2;
+	t1 = session_tcp_side_tx_list(side1)->count > 0 ? session_tcp_side_tx_list(side1)->tx[0].ts : 0;
+	t2 = session_tcp_side_tx_list(side2)->count > 0 ? session_tcp_side_tx_list(side2)->tx[0].ts : 0;
+	t0 = t1 < t2 ? t1 : t2;
 
- 	done += tcp_side_dump(file, depth, side1_name, side1, t0, full);
- 	done += tcp_side_dump(file, depth, side2_name, side2, t0, full);
+	done += stats_print(file, depth, stats);
+	done += tcp_side_dump(file, depth, side1_name, side1, &stats->dir[side1 == &info->side1 ? 0 : 1], t0, full);
+	done += tcp_side_dump(file, depth, side2_name, side2, &stats->dir[side2 == &info->side1 ? 0 : 1], t0, full);
 	return done;
 }
 
-static int tcp_pool_dump(FILE *file, const int depth, const struct session_pool *pool, const struct in_addr host, const uint16_t port, const int full)
+static int tcp_server_port_match(const struct session_tcp_info *info, const uint16_t port)
+{
+	if (info->server != NULL)
+		return info->server->port == port;
+	return info->side1.port == port || info->side2.port == port; /* Roles are unknown */
+}
+
+static int tcp_entry_dump(FILE *file, const int depth, const struct session_entry *entry, const uint16_t server_port, const int full)
 {
 	int done = 0;
+
+	if (entry->tcp_info == NULL)
+		abort();
+
+	if (server_port != 0 && !tcp_server_port_match(entry->tcp_info, server_port))
+		return 0;
+
+	done += key_print(file, depth, &entry->key);
+	done += tcp_info_dump(file, depth + 1, entry->tcp_info, &entry->stats, full);
+	return done;
+}
+
+/*
+ * The endpoint index gives the candidates for an endpoint, a host or a
+ * server port, only a dump without filter walks every session
+ */
+static int tcp_pool_dump(FILE *file, const int depth, const struct session_table *table, const struct frame_addr *host, const uint16_t port, const uint16_t server_port, const int full)
+{
+	const struct endpoint_bucket *bucket;
 	const uint16_t port_net_order = htons(port);
+	const uint16_t server_port_net_order = htons(server_port);
+	int done = 0;
 
-	for (size_t idx = 0 ; idx < sizeof pool->session_hash_table / sizeof pool->session_hash_table[0] ; idx ++) {
-		for (const struct session_entry *entry = pool->session_hash_table[idx].last ; entry != NULL ; entry = entry->prev) {
-			const struct session_tcp_info *info = entry->tcp_info;
-			int found = 0;
-
-			if (info == NULL)
-				abort();
-
-			if (port_net_order != 0 && host.s_addr != INADDR_ANY) {
-				if (port_net_order == info->side1.port && host.s_addr == info->side1.addr.s_addr)
-					found = 1;
-				else if (port_net_order == info->side2.port && host.s_addr == info->side2.addr.s_addr)
-					found = 1;
-				if (found == 0)
-					continue;
-			}
+	if (host != NULL && !frame_addr_is_any(host))
+		bucket = endpoint_index_find(&table->tcp_endpoints, port != 0 ? endpoint_kind_addr_port : endpoint_kind_addr, host, port_net_order);
+	else if (server_port != 0)
+		bucket = endpoint_index_find(&table->tcp_endpoints, endpoint_kind_port, NULL, server_port_net_order);
+	else {
+		for (const struct session_entry *entry = table->tcp->first ; entry != NULL ; entry = entry->next)
+			done += tcp_entry_dump(file, depth, entry, 0, full);
+		return done;
+	}
 
-			done += fprintf(file, "%*sSession %#x-%#x-%#x-%#x\n", depth, "", entry->key.a1, entry->key.p1, entry->key.a2, entry->key.p2);
-			done += tcp_info_dump(file, depth + 1, info, full);
+	if (bucket == NULL)
+		return 0;
 
-			if (found)
-				break;
-		}
+	/* An endpoint gives its oldest session, the one replay_tcp plays */
+	for (const struct endpoint_link *link = bucket->first ; link != NULL ; link = link->next) {
+		const int found = tcp_entry_dump(file, depth, link->entry, server_port_net_order, full);
+
+		done += found;
+		if (found > 0 && host != NULL && !frame_addr_is_any(host) && port != 0)
+			break;
 	}
 
 	return done;
 }
 
-int session_table_dump(FILE *file, const int depth, const struct session_table *table, const char *type, const struct in_addr addr, const uint16_t port, const int full)
+int session_entry_dump(FILE *file, const int depth, const struct session_entry *entry, const int full)
+{
+	if (entry->tcp_info != NULL)
+		return tcp_entry_dump(file, depth, entry, 0, full);
+	return udp_entry_dump(file, depth, entry, full);
+}
+
+int session_table_lifecycle_dump(FILE *file, const int depth, const struct session_table *table)
+{
+	static const char *retain_name[] = {
+		[session_retain_all] = "all",
+		[session_retain_summary] = "summary",
+		[session_retain_none] = "none",
+	};
+	int done = 0;
+
+	done += fprintf(file, "%*s%zd active, %zd closed, %zd retired, %zd released (%zd timed out)\n", depth, "", table->active_count, table->closed_count, table->retired_count, table->released_count, table->timed_out_count);
+	done += fprintf(file, "%*sRetain %s", depth, "", retain_name[table->retain]);
+	if (table->idle_timeout > 0)
+		done += fprintf(file, ", idle timeout %lu.%06lus\n", (unsigned long)(table->idle_timeout / 1000000), (unsigned long)(table->idle_timeout % 1000000));
+	else
+		done += fprintf(file, ", no idle timeout\n");
+
+	return done;
+}
+
+int session_table_hash_dump(FILE *file, const int depth, const struct session_table *table)
+{
+	int done = 0;
+
+	if (table->tcp != NULL) {
+		done += fprintf(file, "%*sTCP\n", depth, "");
+		done += session_hash_dump(file, depth + 1, &table->tcp->hash);
+	}
+
+	if (table->udp != NULL) {
+		done += fprintf(file, "%*sUDP\n", depth, "");
+		done += session_hash_dump(file, depth + 1, &table->udp->hash);
+	}
+
+	return done;
+}
+
+int session_table_dump(FILE *file, const int depth, const struct session_table *table, const char *type, const struct frame_addr *addr, const uint16_t port, const uint16_t server_port, const int full)
 {
 	int done = 0;
 
@@ -643,54 +1401,122 @@ int session_table_dump(FILE *file, const int depth, const struct session_table *
 
 	if ((type == NULL || strcasecmp(type, "tcp") == 0) && table->tcp != NULL) {
 		done += fprintf(file, "%*sTCP\n", depth, "");
-		done += tcp_pool_dump(file, depth + 1, table->tcp, addr, port, full);
+		done += tcp_pool_dump(file, depth + 1, table, addr, port, server_port, full);
 	}
 
 	if ((type == NULL || strcasecmp(type, "udp") == 0) && table->udp != NULL) {
 		done += fprintf(file, "%*sUDP\n", depth, "");
-		done += generic_pool_dump(file, depth + 1, table->udp, full);
+		done += udp_pool_dump(file, depth + 1, table->udp, full);
 	}
 
 	return done;
 }
 
-const struct session_tcp_info *session_table_get_tcp(const struct session_table *table, const struct in_addr host, const uint16_t port, const struct session_tcp_side **asked_ptr, const struct session_tcp_side **other_ptr)
+static int csv_side_print(FILE *file, const struct frame_addr *addr, const uint16_t port)
 {
-	const struct session_tcp_info *info = NULL;
-	const struct session_pool *pool = table->tcp;
-	const uint16_t port_net_order = htons(port);
+	char str[INET6_ADDRSTRLEN];
 
-	if (pool == NULL)
-		goto end;
+	return fprintf(file, ",%s,%d", frame_addr_ntop(addr, str, sizeof str), htons(port));
+}
 
-	for (size_t idx = 0 ; idx < sizeof pool->session_hash_table / sizeof pool->session_hash_table[0] ; idx ++) {
-		for (const struct session_entry *entry = pool->session_hash_table[idx].last ; entry != NULL ; entry = entry->prev) {
-			const struct session_tcp_info *cur = entry->tcp_info;
+static int csv_stats_print(FILE *file, const struct session_stats_dir *stats)
+{
+	return fprintf(file, ",%" PRIu64 ",%" PRIu64 ",%u,%u,%u,%" PRIu64, stats->packets, stats->bytes, stats->retransmits, stats->out_of_order, stats->zero_windows, stats->max_in_flight);
+}
 
-			if (cur == NULL)
-				abort();
+int session_csv_header_dump(FILE *file)
+{
+	int done = 0;
 
-			if (port_net_order == cur->side1.port && host.s_addr == cur->side1.addr.s_addr) {
-				info = cur;
-				if (asked_ptr != NULL)
-					*asked_ptr = &cur->side1;
-				if (other_ptr != NULL)
-					*other_ptr = &cur->side2;
-				goto end;
+	done += fprintf(file, "proto,state,a_addr,a_port,a_role,b_addr,b_port,first_ts,last_ts,rtt_us");
+	done += fprintf(file, ",a_packets,a_bytes,a_retransmits,a_out_of_order,a_zero_windows,a_max_in_flight");
+	done += fprintf(file, ",b_packets,b_bytes,b_retransmits,b_out_of_order,b_zero_windows,b_max_in_flight\n");
+	return done;
+}
 
-			}
+/*
+ * One line per session. Side a is the client when known, side1 otherwise.
+ */
+int session_entry_csv_dump(FILE *file, const struct session_entry *entry)
+{
+	static const char *state_name[] = {
+		[session_state_active] = "active",
+		[session_state_closed] = "closed",
+		[session_state_retired] = "retired",
+	};
+	const struct session_stats *stats = &entry->stats;
+	int a = 0;
+	int done = 0;
 
-			if (port_net_order == cur->side2.port && host.s_addr == cur->side2.addr.s_addr) {
-				info = cur;
-				if (asked_ptr != NULL)
-					*asked_ptr = &cur->side2;
-				if (other_ptr != NULL)
-					*other_ptr = &cur->side1;
-				goto end;
-			}
+	done += fprintf(file, "%s,%s", entry->tcp_info != NULL ? "tcp" : "udp", state_name[entry->state]);
+
+	if (entry->tcp_info != NULL) {
+		const struct session_tcp_info *info = entry->tcp_info;
+		const struct session_tcp_side *side_a = info->client != NULL ? info->client : &info->side1;
+		const struct session_tcp_side *side_b = info->client != NULL ? info->server : &info->side2;
+
+		a = side_a == &info->side1 ? 0 : 1;
+		done += csv_side_print(file, &side_a->addr, side_a->port);
+		done += fprintf(file, ",%s", info->client != NULL ? "client" : "side1");
+		done += csv_side_print(file, &side_b->addr, side_b->port);
+	} else {
+		done += csv_side_print(file, &entry->udp_info->side1.addr, entry->udp_info->side1.port);
+		done += fprintf(file, ",side1");
+		done += csv_side_print(file, &entry->udp_info->side2.addr, entry->udp_info->side2.port);
+	}
+
+	done += fprintf(file, ",%" PRIu64 ",%" PRIu64 ",%" PRIu64, stats->first_ts, stats->last_ts, stats->rtt);
+	done += csv_stats_print(file, &stats->dir[a]);
+	done += csv_stats_print(file, &stats->dir[!a]);
+	done += fprintf(file, "\n");
+	return done;
+}
+
+int session_table_csv_dump(FILE *file, const struct session_table *table, const char *type)
+{
+	int done = 0;
+
+	if (type != NULL && strcasecmp(type, "any") == 0)
+		type = NULL;
+
+	done += session_csv_header_dump(file);
+
+	if ((type == NULL || strcasecmp(type, "tcp") == 0) && table->tcp != NULL) {
+		for (const struct session_entry *entry = table->tcp->first ; entry != NULL ; entry = entry->next) {
+			if (entry->tcp_info != NULL)
+				done += session_entry_csv_dump(file, entry);
 		}
 	}
 
-end:
+	if ((type == NULL || strcasecmp(type, "udp") == 0) && table->udp != NULL) {
+		for (const struct session_entry *entry = table->udp->first ; entry != NULL ; entry = entry->next) {
+			if (entry->udp_info != NULL)
+				done += session_entry_csv_dump(file, entry);
+		}
+	}
+
+	return done;
+}
+
+const struct session_tcp_info *session_table_get_tcp(const struct session_table *table, const struct frame_addr *host, const uint16_t port, const struct session_tcp_side **asked_ptr, const struct session_tcp_side **other_ptr)
+{
+	const struct endpoint_bucket *bucket;
+	const struct session_tcp_info *info;
+	const uint16_t port_net_order = htons(port);
+	int side1 = 0;
+
+	bucket = endpoint_index_find(&table->tcp_endpoints, endpoint_kind_addr_port, host, port_net_order);
+	if (bucket == NULL)
+		return NULL;
+
+	/* The oldest session of this endpoint */
+	info = bucket->first->entry->tcp_info;
+	if (port_net_order == info->side1.port && frame_addr_equal(host, &info->side1.addr))
+		side1 = 1;
+
+	if (asked_ptr != NULL)
+		*asked_ptr = side1 ? &info->side1 : &info->side2;
+	if (other_ptr != NULL)
+		*other_ptr = side1 ? &info->side2 : &info->side1;
 	return info;
 }
@@ -6,8 +6,10 @@
 # include <netinet/tcp.h>
 # include "frame_list.h"
 # include "streambuffer.h"
-
-# define SESSION_HASH_SIZE 1021
+# include "udpstore.h"
+# include "region.h"
+# include "session_hash.h"
+# include "endpoint.h"
 
 #define session_tcp_cnx_done (1 << 0)
 
@@ -19,70 +21,209 @@
 #define TCP_CNX_OPEN_DONE (TCP_CNX_SYN | TCP_CNX_SYN_ACK | TCP_CNX_ACK)
 #define TCP_CNX_CLOSED (TCP_CNX_FIN)
 
-struct session_key {
-	uint32_t a1;
-	uint32_t a2;
-	uint16_t p1;
-	uint16_t p2;
-};
+/*
+ * Closed sessions stay in the lookup hash this long (capture time, us) to
+ * absorb the last ACKs and retransmissions
+ */
+#define SESSION_CLOSED_LINGER (5 * 1000000ULL)
 
+/*
+ * A range of stream bytes, as sent by one segment
+ */
 struct session_tx {
-	struct timeval ts;
-	const struct streambuffer_node *buffer;
+	uint64_t ts;		/* Capture time (us) */
+	uint64_t due;		/* Latest capture time up to this one, never decreases */
+	uint64_t from;		/* Stream offset */
+	const struct streambuffer_chunk *chunk;
+	uint32_t offset;	/* In the chunk */
+	uint32_t size;
 };
 
-struct session_tx_node {
-	struct session_tx tx;
-	struct session_tx_node *next;
-	struct session_tx_node *prev;
+/*
+ * Transmissions in a single array, appended as they come and put in stream
+ * order when sealed, on session close or after ingest : replays walk it
+ * sequentially, and seek into it by stream offset or by due time in
+ * O(log n). Sealing also gives back the room left at its end.
+ */
+struct session_tx_list {
+	struct session_tx *tx;
+	size_t count;
+	size_t alloc;
+	size_t sorted;		/* Leading transmissions in stream order, with their due time */
 };
 
-struct session_tx_list {
-	struct session_tx_node *first;
-	struct session_tx_node *last;
+struct session_tcp_stream {
+	struct streambuffer tx_buffer;
+	struct session_tx_list tx_list;
 };
 
+/*
+ * Until the first payload byte, a TCP session only holds its handshake
+ * state : the streams of both sides are allocated together at that time, so
+ * that scans and data-less sessions stay small.
+ */
 struct session_tcp_side {
+	struct frame_addr addr;
+	struct session_tcp_stream *stream;	/* NULL until the session carries data */
 	uint32_t first_seq;
-	struct in_addr addr;
+	uint32_t seq_next;	/* After the highest byte sent by this side */
+	uint32_t acked;		/* Highest ack of this side's bytes */
+	uint64_t offset_next;	/* Stream offset after the highest byte stored */
 	uint16_t port;
-	uint32_t seq;
-	struct streambuffer tx_buffer;
-	struct session_tx_list tx_list;
+	uint8_t fin;	/* Nothing more is expected from this side */
+	uint8_t seq_known : 1;
+	uint8_t acked_known : 1;
 };
 
 struct session_tcp_info {
-	uint8_t status;
 	struct session_tcp_side side1;
 	struct session_tcp_side side2;
 	struct session_tcp_side *server;
 	struct session_tcp_side *client;
+	uint64_t syn_ts;	/* Capture time of the SYN (us) */
+	uint8_t status;
+};
+
+struct session_udp_side {
+	struct frame_addr addr;
+	uint16_t port;
+};
+
+struct session_udp_info {
+	struct session_udp_side side1; /* Source of the first datagram */
+	struct session_udp_side side2;
+	struct udpstore store;
+};
+
+/*
+ * Active sessions are looked up by key. A FIN from both sides or a RST closes
+ * a TCP session, the idle timeout closes any session. Closed sessions
+ * linger for a while, then retire : they leave the lookup hash, and a new
+ * session may reuse their key.
+ */
+enum session_state {
+	session_state_active = 0,
+	session_state_closed,
+	session_state_retired,
+};
+
+/*
+ * What is kept of a session once closed, depending on what the command needs
+ */
+enum session_retain {
+	session_retain_all = 1,	/* Read-only, payloads included */
+	session_retain_summary,	/* Endpoints only, payloads are released */
+	session_retain_none,	/* Released as soon as retired */
+};
+
+/*
+ * Counters of one direction, updated in constant time per frame.
+ *
+ * A TCP segment is a retransmission when all its bytes were already sent,
+ * and out of order when it starts after the highest byte sent.
+ */
+struct session_stats_dir {
+	uint64_t packets;
+	uint64_t bytes;		/* Payload */
+	uint32_t retransmits;
+	uint32_t out_of_order;
+	uint32_t zero_windows;	/* ACKs advertising a zero window */
+	uint64_t max_in_flight;	/* Bytes sent and not yet acked */
+};
+
+struct session_stats {
+	uint64_t first_ts;	/* us */
+	uint64_t last_ts;
+	uint64_t rtt;		/* SYN to the handshake ACK (us), 0 if not seen */
+	struct session_stats_dir dir[2];	/* Sent by side1, by side2 */
 };
 
 struct session_entry {
 	struct session_key key;
+	struct session_entry *next;	/* In creation order */
 	struct session_entry *prev;
 
 	struct session_tcp_info *tcp_info;
-	struct frame_list frame_list;
+	struct session_udp_info *udp_info;
+
+	size_t resident;		/* Payload bytes held in memory */
+	size_t spilled;			/* Payload bytes moved to the spill file */
+	struct session_entry *lru_prev;	/* Only linked while resident > 0 */
+	struct session_entry *lru_next;
+
+	enum session_state state;
+	uint64_t last_ts;		/* Capture time of the last frame (us) */
+	struct session_entry *idle_prev;	/* Until retired, in the active or closed list */
+	struct session_entry *idle_next;
+
+	struct session_stats stats;
+};
+
+struct session_list {
+	struct session_entry *first;	/* Idle for the longest time */
+	struct session_entry *last;
 };
 
 struct session_pool {
-	struct {
-		struct session_entry *last;
-	}  session_hash_table[SESSION_HASH_SIZE];
+	struct session_hash hash;
+	struct session_entry *first;
+	struct session_entry *last;
 };
 
+/*
+ * When mem_limit is set, the payloads of the least recently fed sessions are
+ * moved to the spill file as soon as resident goes above it.
+ *
+ * Pools, sessions, their info and tx nodes all come from the table region,
+ * the ones of released sessions are recycled there.
+ *
+ * Sessions are only indexed by endpoint when something of them is retained.
+ */
 struct session_table {
+	struct region region;
 	struct session_pool *tcp;
 	struct session_pool *udp;
+	struct endpoint_index tcp_endpoints;
+	size_t mem_limit;
+	size_t resident;
+	size_t spilled;
+	struct session_entry *lru_first;	/* Coldest */
+	struct session_entry *lru_last;
+	struct streambuffer_reassembly reassembly;
+
+	enum session_retain retain;
+	uint64_t idle_timeout;		/* us, 0 for none */
+	uint64_t now;			/* Latest capture time seen */
+	struct session_list active;
+	struct session_list closed;
+	size_t active_count;
+	size_t closed_count;
+	size_t retired_count;
+	size_t timed_out_count;
+	size_t released_count;
 };
 
-int session_table_init(struct session_table *table);
+int session_table_init(struct session_table *table, const int pagemem_flags);
 void session_table_free(struct session_table *table);
-
-int session_process_frame(struct session_table *table, struct frame_list *fame_list, struct frame_node *frame_node);
-int session_table_dump(FILE *file, const int depth, const struct session_table *table, const char *type, const struct in_addr addr, const uint16_t port, const int full);
-const struct session_tcp_info *session_table_get_tcp(const struct session_table *table, const struct in_addr host, const uint16_t port, const struct session_tcp_side **asked_ptr, const struct session_tcp_side **other_ptr);
+void session_table_set_mem_limit(struct session_table *table, const size_t mem_limit);
+void session_table_set_overlap(struct session_table *table, const enum streambuffer_overlap overlap);
+void session_table_set_compress(struct session_table *table, const int compress);
+void session_table_set_dedup(struct session_table *table, const int dedup);
+void session_table_set_fingerprint(struct session_table *table, const int fingerprint);
+void session_table_set_lifecycle(struct session_table *table, const enum session_retain retain, const uint64_t idle_timeout);
+int session_table_lifecycle_dump(FILE *file, const int depth, const struct session_table *table);
+
+int session_process_frame(struct session_table *table, struct frame_node *frame_node);
+int session_table_seal(struct session_table *table);
+int session_table_hash_dump(FILE *file, const int depth, const struct session_table *table);
+int session_table_dump(FILE *file, const int depth, const struct session_table *table, const char *type, const struct frame_addr *addr, const uint16_t port, const uint16_t server_port, const int full);
+int session_table_csv_dump(FILE *file, const struct session_table *table, const char *type);
+int session_entry_dump(FILE *file, const int depth, const struct session_entry *entry, const int full);
+int session_csv_header_dump(FILE *file);
+int session_entry_csv_dump(FILE *file, const struct session_entry *entry);
+const struct session_tx_list *session_tcp_side_tx_list(const struct session_tcp_side *side);
+size_t session_tx_list_seek_offset(const struct session_tx_list *list, const uint64_t offset);
+size_t session_tx_list_seek_time(const struct session_tx_list *list, const uint64_t dt);
+const struct session_tcp_info *session_table_get_tcp(const struct session_table *table, const struct frame_addr *host, const uint16_t port, const struct session_tcp_side **asked_ptr, const struct session_tcp_side **other_ptr);
 
 #endif
@@ -0,0 +1,321 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <errno.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/random.h>
+#ifdef __SSE2__
+# include <emmintrin.h>
+#endif
+
+#include "session_hash.h"
+#include "flowhash.h"
+
+#define CTRL_EMPTY 0x80
+#define CTRL_DELETED 0xfe
+
+static inline uint8_t hash_tag(const uint32_t h)
+{
+	return h & 0x7f;
+}
+
+static inline size_t hash_group(const uint32_t h, const size_t groups)
+{
+	return (h >> 7) & (groups - 1);
+}
+
+/*
+ * Bit i is set when control byte i of the group is equal to value
+ */
+static inline uint32_t group_match(const uint8_t *ctrl, const uint8_t value)
+{
+#ifdef __SSE2__
+	const __m128i group = _mm_load_si128((const __m128i *)ctrl);
+	return _mm_movemask_epi8(_mm_cmpeq_epi8(group, _mm_set1_epi8(value)));
+#else
+	uint32_t mask = 0;
+
+	for (int i = 0 ; i < SESSION_HASH_GROUP ; i ++)
+		mask |= (uint32_t)(ctrl[i] == value) << i;
+	return mask;
+#endif
+}
+
+/*
+ * Bit i is set when slot i of the group is empty or deleted, which both have
+ * their high bit set
+ */
+static inline uint32_t group_match_free(const uint8_t *ctrl)
+{
+#ifdef __SSE2__
+	return _mm_movemask_epi8(_mm_load_si128((const __m128i *)ctrl));
+#else
+	uint32_t mask = 0;
+
+	for (int i = 0 ; i < SESSION_HASH_GROUP ; i ++)
+		mask |= (uint32_t)(ctrl[i] >> 7) << i;
+	return mask;
+#endif
+}
+
+static uint32_t seed_get(void)
+{
+	uint32_t seed;
+
+	if (getrandom(&seed, sizeof seed, GRND_NONBLOCK) == sizeof seed)
+		return seed;
+	return (uint32_t)time(NULL) ^ ((uint32_t)getpid() << 16);
+}
+
+static int array_init(struct session_hash_array *array, const size_t capacity)
+{
+	memset(array, 0, sizeof array[0]);
+
+	array->ctrl = aligned_alloc(SESSION_HASH_GROUP, capacity);
+	if (array->ctrl == NULL)
+		goto err;
+
+	array->slot = aligned_alloc(sizeof array->slot[0], capacity * sizeof array->slot[0]);
+	if (array->slot == NULL)
+		goto free_ctrl_err;
+
+	memset(array->ctrl, CTRL_EMPTY, capacity);
+	array->capacity = capacity;
+	return 0;
+
+free_ctrl_err:
+	free(array->ctrl);
+err:
+	fprintf(stderr, "Failed to allocate a %zd slots session hash : %s\n", capacity, strerror(errno));
+	return -1;
+}
+
+static void array_free(struct session_hash_array *array)
+{
+	free(array->ctrl);
+	free(array->slot);
+	memset(array, 0, sizeof array[0]);
+}
+
+int session_hash_init(struct session_hash *hash)
+{
+	memset(hash, 0, sizeof hash[0]);
+	hash->seed = seed_get();
+	return array_init(&hash->cur, SESSION_HASH_MIN_CAPACITY);
+}
+
+void session_hash_free(struct session_hash *hash)
+{
+	array_free(&hash->old);
+	array_free(&hash->cur);
+}
+
+_Static_assert(sizeof(struct session_key) == FLOWHASH_WORDS * sizeof(uint64_t), "flowhash is specialized for the session key size");
+
+/*
+ * Keys come from the capture : the seed has to keep crafted ones apart, which
+ * rules CRC32C out, see flowhash.h
+ */
+uint32_t session_hash_key(const struct session_hash *hash, const struct session_key *key)
+{
+	return flowhash_mix(key->w, hash->seed);
+}
+
+static struct session_hash_slot *array_lookup(const struct session_hash_array *array, const uint32_t h, const struct session_key *key, uint64_t *probes)
+{
+	const size_t groups = array->capacity / SESSION_HASH_GROUP;
+	const uint8_t tag = hash_tag(h);
+	size_t group = hash_group(h, groups);
+
+	for (size_t i = 1 ; i <= groups ; i ++) {
+		const uint8_t *ctrl = array->ctrl + group * SESSION_HASH_GROUP;
+		uint32_t match;
+
+		(*probes) ++;
+
+		for (match = group_match(ctrl, tag) ; match != 0 ; match &= match - 1) {
+			struct session_hash_slot *slot = &array->slot[group * SESSION_HASH_GROUP + __builtin_ctz(match)];
+
+			if (session_key_equal(&slot->key, key))
+				return slot;
+		}
+
+		if (group_match(ctrl, CTRL_EMPTY) != 0)
+			break;
+
+		group = (group + i) & (groups - 1); /* Triangular probing visits every group */
+	}
+
+	return NULL;
+}
+
+/*
+ * The key is known to be missing
+ */
+static void array_insert(struct session_hash_array *array, const uint32_t h, const struct session_key *key, struct session_entry *entry)
+{
+	const size_t groups = array->capacity / SESSION_HASH_GROUP;
+	size_t group = hash_group(h, groups);
+
+	for (size_t i = 1 ; ; i ++) {
+		uint8_t *ctrl = array->ctrl + group * SESSION_HASH_GROUP;
+		const uint32_t match = group_match_free(ctrl);
+
+		if (match != 0) {
+			const size_t idx = group * SESSION_HASH_GROUP + __builtin_ctz(match);
+
+			if (array->ctrl[idx] == CTRL_DELETED)
+				array->deleted --;
+			array->ctrl[idx] = hash_tag(h);
+			array->slot[idx].key = *key;
+			array->slot[idx].entry = entry;
+			array->count ++;
+			return;
+		}
+
+		group = (group + i) & (groups - 1);
+	}
+}
+
+/*
+ * Move some groups of the old array to the new one. Moved slots are marked
+ * deleted so that the probe sequences of the remaining ones still hold.
+ */
+static void hash_migrate(struct session_hash *hash, size_t group_count)
+{
+	struct session_hash_array *old = &hash->old;
+	const size_t groups = old->capacity / SESSION_HASH_GROUP;
+
+	for ( ; group_count > 0 && hash->old_group < groups ; group_count --, hash->old_group ++) {
+		const size_t first = hash->old_group * SESSION_HASH_GROUP;
+
+		for (size_t idx = first ; idx < first + SESSION_HASH_GROUP ; idx ++) {
+			if ((old->ctrl[idx] & CTRL_EMPTY) != 0)
+				continue;
+
+			array_insert(&hash->cur, session_hash_key(hash, &old->slot[idx].key), &old->slot[idx].key, old->slot[idx].entry);
+			old->ctrl[idx] = CTRL_DELETED;
+			old->count --;
+		}
+	}
+
+	if (hash->old_group >= groups)
+		array_free(old);
+}
+
+/*
+ * Move to a new array of capacity slots : twice as many, or as many when
+ * most of the used slots are deleted ones
+ */
+static int hash_resize(struct session_hash *hash, const size_t capacity)
+{
+	struct session_hash_array array;
+
+	/* Resizing again before the previous move is over : finish it first */
+	if (hash->old.capacity > 0)
+		hash_migrate(hash, hash->old.capacity / SESSION_HASH_GROUP);
+
+	if (array_init(&array, capacity) < 0)
+		goto err;
+
+	hash->old = hash->cur;
+	hash->old_group = 0;
+	hash->cur = array;
+	return 0;
+
+err:
+	return -1;
+}
+
+struct session_entry *session_hash_lookup(struct session_hash *hash, const uint32_t h, const struct session_key *key)
+{
+	struct session_hash_slot *slot;
+
+	hash->lookups ++;
+
+	slot = array_lookup(&hash->cur, h, key, &hash->probes);
+	if (slot == NULL && hash->old.capacity > 0)
+		slot = array_lookup(&hash->old, h, key, &hash->probes);
+
+	return slot != NULL ? slot->entry : NULL;
+}
+
+int session_hash_insert(struct session_hash *hash, const uint32_t h, const struct session_key *key, struct session_entry *entry)
+{
+	const size_t count = hash->cur.count + hash->old.count + 1;
+
+	if (hash->old.capacity > 0)
+		hash_migrate(hash, SESSION_HASH_MIGRATE);
+
+	if ((hash->cur.count + hash->cur.deleted + hash->old.count + 1) * 8 > hash->cur.capacity * 7) {
+		/* Same size when the live sessions fill at most half of the limit */
+		const size_t capacity = count * 16 > hash->cur.capacity * 7 ? hash->cur.capacity * 2 : hash->cur.capacity;
+
+		if (hash_resize(hash, capacity) < 0)
+			goto err;
+	}
+
+	array_insert(&hash->cur, h, key, entry);
+	return 0;
+
+err:
+	return -1;
+}
+
+/*
+ * A slot may go back to empty when its group still has an empty one : probe
+ * sequences reaching this group stop here anyway. Otherwise it is marked
+ * deleted, to be reused by an insert or dropped by the next resize.
+ */
+static void array_remove(struct session_hash_array *array, struct session_hash_slot *slot)
+{
+	const size_t idx = slot - array->slot;
+	const uint8_t *ctrl = array->ctrl + idx / SESSION_HASH_GROUP * SESSION_HASH_GROUP;
+
+	if (group_match(ctrl, CTRL_EMPTY) != 0)
+		array->ctrl[idx] = CTRL_EMPTY;
+	else {
+		array->ctrl[idx] = CTRL_DELETED;
+		array->deleted ++;
+	}
+	array->count --;
+}
+
+struct session_entry *session_hash_remove(struct session_hash *hash, const uint32_t h, const struct session_key *key)
+{
+	struct session_hash_array *array = &hash->cur;
+	struct session_hash_slot *slot;
+	uint64_t probes = 0;
+
+	slot = array_lookup(array, h, key, &probes);
+	if (slot == NULL && hash->old.capacity > 0) {
+		array = &hash->old;
+		slot = array_lookup(array, h, key, &probes);
+	}
+
+	if (slot == NULL)
+		return NULL;
+
+	array_remove(array, slot);
+	return slot->entry;
+}
+
+int session_hash_dump(FILE *file, const int depth, const struct session_hash *hash)
+{
+	const size_t count = hash->cur.count + hash->old.count;
+	int done = 0;
+
+	done += fprintf(file, "%*s%zd session(s) in %zd slots (%.1f%%)", depth, "", count, hash->cur.capacity, 100.0 * count / hash->cur.capacity);
+	if (hash->cur.deleted > 0)
+		done += fprintf(file, ", %zd deleted", hash->cur.deleted);
+	if (hash->old.capacity > 0)
+		done += fprintf(file, ", %zd still in the previous %zd slots", hash->old.count, hash->old.capacity);
+	done += fprintf(file, ", multiply-xorshift hash\n");
+
+	if (hash->lookups > 0)
+		done += fprintf(file, "%*s%" PRIu64 " lookup(s), %.2f group(s) probed per lookup\n", depth, "", hash->lookups, (double)hash->probes / hash->lookups);
+
+	return done;
+}
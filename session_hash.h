@@ -0,0 +1,86 @@
+
+#ifndef __session_hash_h_666__
+# define __session_hash_h_666__
+
+# include <stdio.h>
+# include <stdint.h>
+# include <stddef.h>
+# include "frame.h"
+
+/*
+ * IPv4 and IPv6 sessions share the same key : 16-byte aligned and zero padded
+ * so that it is compared a 64-bit word at a time
+ */
+struct session_key {
+	union {
+		struct {
+			struct frame_addr a1;
+			struct frame_addr a2;
+			uint16_t p1;
+			uint16_t p2;
+		};
+		uint64_t w[6];
+	};
+} __attribute__((aligned(16)));
+
+static inline int session_key_equal(const struct session_key *key1, const struct session_key *key2)
+{
+	uint64_t diff = 0;
+
+	for (size_t i = 0 ; i < sizeof key1->w / sizeof key1->w[0] ; i ++)
+		diff |= key1->w[i] ^ key2->w[i];
+
+	return diff == 0;
+}
+
+/*
+ * Open addressing table from session keys to session entries.
+ *
+ * Slots are probed a group at a time : one control byte per slot holds 7 bits
+ * of the hash, or marks the slot as empty or deleted, and a whole group of
+ * control bytes is matched at once. Keys are stored inline next to the entry
+ * pointer so that a hit costs a single cache line.
+ *
+ * The table doubles once 7/8 full, deleted slots included, or is rebuilt at
+ * the same size when most of them are deleted. The previous array is then
+ * kept aside and moved a few groups per insert, looked up until it is empty.
+ */
+# define SESSION_HASH_GROUP 16
+# define SESSION_HASH_MIN_CAPACITY 64
+# define SESSION_HASH_MIGRATE 2	/* Groups moved per insert while growing */
+
+struct session_entry;
+
+struct session_hash_slot {
+	struct session_key key;
+	struct session_entry *entry;
+} __attribute__((aligned(64)));
+
+struct session_hash_array {
+	uint8_t *ctrl;
+	struct session_hash_slot *slot;
+	size_t capacity;	/* Slots, a power of 2 */
+	size_t count;
+	size_t deleted;
+};
+
+struct session_hash {
+	struct session_hash_array cur;
+	struct session_hash_array old;	/* Being moved to cur */
+	size_t old_group;		/* Next group of old to move */
+	uint32_t seed;
+	uint64_t lookups;
+	uint64_t probes;		/* Groups visited by lookups */
+};
+
+int session_hash_init(struct session_hash *hash);
+void session_hash_free(struct session_hash *hash);
+
+uint32_t session_hash_key(const struct session_hash *hash, const struct session_key *key);
+struct session_entry *session_hash_lookup(struct session_hash *hash, const uint32_t h, const struct session_key *key);
+int session_hash_insert(struct session_hash *hash, const uint32_t h, const struct session_key *key, struct session_entry *entry);
+struct session_entry *session_hash_remove(struct session_hash *hash, const uint32_t h, const struct session_key *key);
+
+int session_hash_dump(FILE *file, const int depth, const struct session_hash *hash);
+
+#endif
@@ -0,0 +1,219 @@
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "sketch.h"
+#include "flowhash.h"
+
+/*
+ * HyperLogLog takes its register from the top bits of the hash and the rank
+ * from the other ones : all 64 of them need mixing, murmur3 finalizer
+ */
+uint64_t sketch_hash_addr(const struct frame_addr *addr)
+{
+	uint64_t h = addr->u64[0] * FLOWHASH_K1 ^ addr->u64[1];
+
+	h ^= h >> 33;
+	h *= FLOWHASH_K2;
+	h ^= h >> 33;
+	h *= 0xc4ceb9fe1a85ec53ULL;
+	h ^= h >> 33;
+	return h;
+}
+
+void sketch_hll_add(struct sketch_hll *hll, const uint64_t hash)
+{
+	const size_t reg = hash >> (64 - SKETCH_HLL_BITS);
+	const uint64_t rest = hash << SKETCH_HLL_BITS | 1ULL << (SKETCH_HLL_BITS - 1);
+	const uint8_t rank = __builtin_clzll(rest) + 1;
+
+	if (hll->reg[reg] < rank)
+		hll->reg[reg] = rank;
+}
+
+/*
+ * Linear counting while registers are left empty, the 64-bit hash needs no
+ * large range correction
+ */
+uint64_t sketch_hll_estimate(const struct sketch_hll *hll)
+{
+	const double m = 1 << SKETCH_HLL_BITS;
+	const double alpha = 0.7213 / (1 + 1.079 / m);
+	double sum = 0;
+	size_t zeros = 0;
+	double estimate;
+
+	for (size_t i = 0 ; i < sizeof hll->reg ; i ++) {
+		sum += ldexp(1, -hll->reg[i]);
+		zeros += hll->reg[i] == 0;
+	}
+
+	estimate = alpha * m * m / sum;
+	if (estimate <= 2.5 * m && zeros > 0)
+		estimate = m * log(m / zeros);
+
+	return estimate + 0.5;
+}
+
+static uint32_t key_hash(const struct sketch_key *key)
+{
+	const uint64_t w[FLOWHASH_WORDS] = { key->addr.u64[0], key->addr.u64[1], key->port };
+
+	return flowhash_mix(w, 0);
+}
+
+static int key_equal(const struct sketch_key *key1, const struct sketch_key *key2)
+{
+	return frame_addr_equal(&key1->addr, &key2->addr) && key1->port == key2->port;
+}
+
+static void heap_swap(struct sketch_topk *topk, const uint32_t pos1, const uint32_t pos2)
+{
+	const uint32_t c1 = topk->heap[pos1];
+	const uint32_t c2 = topk->heap[pos2];
+
+	topk->heap[pos1] = c2;
+	topk->counter[c2].heap = pos1;
+	topk->heap[pos2] = c1;
+	topk->counter[c1].heap = pos2;
+}
+
+static void heap_up(struct sketch_topk *topk, uint32_t pos)
+{
+	while (pos > 0) {
+		const uint32_t parent = (pos - 1) / 2;
+
+		if (topk->counter[topk->heap[parent]].count <= topk->counter[topk->heap[pos]].count)
+			break;
+		heap_swap(topk, parent, pos);
+		pos = parent;
+	}
+}
+
+/*
+ * Counts only grow : a counter goes down the heap
+ */
+static void heap_down(struct sketch_topk *topk, uint32_t pos)
+{
+	for (;;) {
+		uint32_t min = pos;
+		const uint32_t left = 2 * pos + 1;
+		const uint32_t right = left + 1;
+
+		if (left < topk->count && topk->counter[topk->heap[left]].count < topk->counter[topk->heap[min]].count)
+			min = left;
+		if (right < topk->count && topk->counter[topk->heap[right]].count < topk->counter[topk->heap[min]].count)
+			min = right;
+		if (min == pos)
+			break;
+		heap_swap(topk, min, pos);
+		pos = min;
+	}
+}
+
+static uint32_t *index_find(struct sketch_topk *topk, const struct sketch_key *key, const uint32_t hash)
+{
+	uint32_t slot = hash & (SKETCH_TOPK_INDEX_SIZE - 1);
+
+	while (topk->index[slot] != 0) {
+		const struct sketch_counter *counter = &topk->counter[topk->index[slot] - 1];
+
+		if (counter->hash == hash && key_equal(&counter->key, key))
+			break;
+		slot = (slot + 1) & (SKETCH_TOPK_INDEX_SIZE - 1);
+	}
+
+	return &topk->index[slot];
+}
+
+/*
+ * Backward shift deletion : the index stays free of tombstones, later
+ * entries of the probe sequence move up to the hole
+ */
+static void index_remove(struct sketch_topk *topk, uint32_t *slot_ptr)
+{
+	uint32_t hole = slot_ptr - topk->index;
+	uint32_t slot = hole;
+
+	for (;;) {
+		uint32_t home;
+
+		slot = (slot + 1) & (SKETCH_TOPK_INDEX_SIZE - 1);
+		if (topk->index[slot] == 0)
+			break;
+
+		home = topk->counter[topk->index[slot] - 1].hash & (SKETCH_TOPK_INDEX_SIZE - 1);
+		if (((slot - home) & (SKETCH_TOPK_INDEX_SIZE - 1)) >= ((slot - hole) & (SKETCH_TOPK_INDEX_SIZE - 1))) {
+			topk->index[hole] = topk->index[slot];
+			hole = slot;
+		}
+	}
+
+	topk->index[hole] = 0;
+}
+
+struct sketch_counter *sketch_topk_add(struct sketch_topk *topk, const struct sketch_key *key, const uint64_t weight)
+{
+	const uint32_t hash = key_hash(key);
+	uint32_t *slot = index_find(topk, key, hash);
+	struct sketch_counter *counter;
+
+	topk->total += weight;
+
+	if (*slot != 0) {
+		counter = &topk->counter[*slot - 1];
+		counter->count += weight;
+		heap_down(topk, counter->heap);
+		return counter;
+	}
+
+	if (topk->count < SKETCH_TOPK_CAPACITY) {
+		counter = &topk->counter[topk->count];
+		counter->key = *key;
+		counter->hash = hash;
+		counter->count = weight;
+		counter->error = 0;
+		counter->heap = topk->count;
+		topk->heap[topk->count] = topk->count;
+		*slot = ++ topk->count;
+		heap_up(topk, counter->heap);
+		return counter;
+	}
+
+	/*
+	 * Take over the smallest counter : the slot found may move when its
+	 * index entry is removed, look it up again
+	 */
+	counter = &topk->counter[topk->heap[0]];
+	index_remove(topk, index_find(topk, &counter->key, counter->hash));
+	slot = index_find(topk, key, hash);
+	*slot = counter - topk->counter + 1;
+
+	counter->key = *key;
+	counter->hash = hash;
+	counter->error = counter->count;
+	counter->count += weight;
+	if (topk->hll != NULL)
+		memset(&topk->hll[counter - topk->counter], 0, sizeof topk->hll[0]);
+	heap_down(topk, 0);
+
+	return counter;
+}
+
+static int counter_cmp(const void *p1, const void *p2)
+{
+	const struct sketch_counter *c1 = *(const struct sketch_counter **)p1;
+	const struct sketch_counter *c2 = *(const struct sketch_counter **)p2;
+
+	if (c1->count != c2->count)
+		return c1->count < c2->count ? 1 : -1;
+	return c1 < c2 ? -1 : c1 > c2;
+}
+
+size_t sketch_topk_sorted(const struct sketch_topk *topk, const struct sketch_counter *sorted[SKETCH_TOPK_CAPACITY])
+{
+	for (size_t i = 0 ; i < topk->count ; i ++)
+		sorted[i] = &topk->counter[i];
+	qsort(sorted, topk->count, sizeof sorted[0], counter_cmp);
+	return topk->count;
+}
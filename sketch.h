@@ -0,0 +1,65 @@
+
+#ifndef __sketch_h_666__
+# define __sketch_h_666__
+
+# include <stdint.h>
+# include <stddef.h>
+# include "frame.h"
+
+/*
+ * Bounded memory summaries of a frame stream.
+ *
+ * sketch_topk is a weighted Space-Saving summary : it follows at most
+ * SKETCH_TOPK_CAPACITY keys, a new key takes over the counter of the
+ * smallest one. Every key heavier than total / SKETCH_TOPK_CAPACITY is
+ * kept, and its true weight lies within [count - error, count].
+ *
+ * sketch_hll is a HyperLogLog distinct counter, its standard error is
+ * 1.04 / sqrt(1 << SKETCH_HLL_BITS), 1.6%. A top-k summary may keep one per
+ * counter, reset when the counter is taken over.
+ *
+ * Both start zeroed : static storage needs no init.
+ */
+# define SKETCH_TOPK_CAPACITY 1024
+# define SKETCH_TOPK_INDEX_SIZE (2 * SKETCH_TOPK_CAPACITY)	/* A power of 2 */
+# define SKETCH_HLL_BITS 12
+
+struct sketch_key {
+	struct frame_addr addr;		/* Zero when only a port is counted */
+	uint16_t port;			/* Network order, zero when only an address is counted */
+};
+
+struct sketch_counter {
+	struct sketch_key key;
+	uint32_t hash;
+	uint32_t heap;			/* Position in the heap */
+	uint64_t count;
+	uint64_t error;			/* Count taken over from the evicted key */
+};
+
+struct sketch_hll {
+	uint8_t reg[1 << SKETCH_HLL_BITS];
+};
+
+struct sketch_topk {
+	struct sketch_counter counter[SKETCH_TOPK_CAPACITY];
+	uint32_t heap[SKETCH_TOPK_CAPACITY];		/* Counter indexes, smallest count first */
+	uint32_t index[SKETCH_TOPK_INDEX_SIZE];		/* Counter index + 1, 0 for an empty slot */
+	struct sketch_hll *hll;				/* SKETCH_TOPK_CAPACITY of them, or NULL */
+	size_t count;
+	uint64_t total;
+};
+
+uint64_t sketch_hash_addr(const struct frame_addr *addr);
+
+void sketch_hll_add(struct sketch_hll *hll, const uint64_t hash);
+uint64_t sketch_hll_estimate(const struct sketch_hll *hll);
+
+/*
+ * Returns the counter now holding the key, its index in topk->counter is
+ * the one of its hll
+ */
+struct sketch_counter *sketch_topk_add(struct sketch_topk *topk, const struct sketch_key *key, const uint64_t weight);
+size_t sketch_topk_sorted(const struct sketch_topk *topk, const struct sketch_counter *sorted[SKETCH_TOPK_CAPACITY]);
+
+#endif
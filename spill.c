@@ -0,0 +1,270 @@
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+
+#include "spill.h"
+
+static struct {
+	FILE *file;
+	char *buffer;
+	uint64_t size;		/* Bytes written */
+	uint64_t flushed;	/* Bytes out of the stdio buffer */
+	uint64_t released;	/* Bytes no longer pointed to */
+	uint8_t *map;		/* SPILL_MAP_RESERVE bytes, the first map_size mapped */
+	uint64_t map_size;
+	uint64_t map_count;	/* Number of times the mapping grew */
+	uint32_t *unit_released;	/* Bytes released in each SPILL_RELEASE_UNIT of the file */
+	size_t unit_count;
+	uint32_t *pending;	/* Units wholly released, still to be punched */
+	size_t pending_count;
+	size_t pending_max;
+	uint64_t reclaimed;	/* Bytes punched out of the file */
+} spill;
+
+static int spill_open(void)
+{
+	const char *dir = getenv("TMPDIR");
+	char path[4096];
+	int fd;
+
+	if (dir == NULL)
+		dir = "/tmp";
+
+	if (snprintf(path, sizeof path, "%s/tcpplay-spill-XXXXXX", dir) >= (int)sizeof path) {
+		fprintf(stderr, "Spill path too long in <%s>\n", dir);
+		goto err;
+	}
+
+	fd = mkstemp(path);
+	if (fd < 0) {
+		fprintf(stderr, "Failed to create spill file <%s> : %s\n", path, strerror(errno));
+		goto err;
+	}
+	unlink(path); /* Gone as soon as we exit */
+
+	spill.file = fdopen(fd, "w+");
+	if (spill.file == NULL) {
+		fprintf(stderr, "Failed to open spill file : %s\n", strerror(errno));
+		goto close_err;
+	}
+
+	spill.buffer = malloc(SPILL_BUFFER_SIZE);
+	if (spill.buffer != NULL)
+		setvbuf(spill.file, spill.buffer, _IOFBF, SPILL_BUFFER_SIZE);
+	return 0;
+
+close_err:
+	close(fd);
+err:
+	return -1;
+}
+
+int spill_write(const void *data, const size_t size, uint64_t *offset_ptr)
+{
+	if (spill.file == NULL && spill_open() < 0)
+		goto err;
+
+	if (fwrite(data, 1, size, spill.file) != size) {
+		fprintf(stderr, "Failed to write %zdb to spill file : %s\n", size, strerror(errno));
+		goto err;
+	}
+
+	*offset_ptr = spill.size;
+	spill.size += size;
+	return 0;
+
+err:
+	return -1;
+}
+
+/*
+ * Map the file up to end at least. The range is reserved once and the file
+ * mapped over it step by step, never moving what was mapped before.
+ */
+static int spill_map(const uint64_t end)
+{
+	const uint64_t size = (end + SPILL_MAP_STEP - 1) / SPILL_MAP_STEP * SPILL_MAP_STEP;
+
+	if (size > SPILL_MAP_RESERVE) {
+		fprintf(stderr, "Spill file too large to be mapped : %" PRIu64 "b (%" PRIu64 "b at most)\n", end, (uint64_t)SPILL_MAP_RESERVE);
+		goto err;
+	}
+
+	if (spill.map == NULL) {
+		spill.map = mmap(NULL, SPILL_MAP_RESERVE, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+		if (spill.map == MAP_FAILED) {
+			fprintf(stderr, "Failed to reserve spill mapping : %s\n", strerror(errno));
+			spill.map = NULL;
+			goto err;
+		}
+	}
+
+	/* Pages past the end of the file are mapped, but never read */
+	if (mmap(spill.map + spill.map_size, size - spill.map_size, PROT_READ, MAP_SHARED | MAP_FIXED, fileno(spill.file), spill.map_size) == MAP_FAILED) {
+		fprintf(stderr, "Failed to map spill file : %s\n", strerror(errno));
+		goto err;
+	}
+	spill.map_size = size;
+	spill.map_count ++;
+	return 0;
+
+err:
+	return -1;
+}
+
+const uint8_t *spill_data(const uint64_t offset, const size_t size)
+{
+	if (offset + size > spill.size)
+		abort();
+
+	if (offset + size > spill.flushed) {
+		if (fflush(spill.file) != 0) {
+			fprintf(stderr, "Failed to flush spill file : %s\n", strerror(errno));
+			goto err;
+		}
+		spill.flushed = spill.size;
+	}
+
+	if (offset + size > spill.map_size && spill_map(offset + size) < 0)
+		goto err;
+
+	return spill.map + offset;
+
+err:
+	return NULL;
+}
+
+static int unit_release(const uint64_t unit, const uint32_t size)
+{
+	if (unit >= spill.unit_count) {
+		size_t count = spill.unit_count > 0 ? spill.unit_count * 2 : 1024;
+		uint32_t *unit_released;
+
+		while (count <= unit)
+			count *= 2;
+		unit_released = realloc(spill.unit_released, count * sizeof unit_released[0]);
+		if (unit_released == NULL)
+			goto err;
+		memset(unit_released + spill.unit_count, 0, (count - spill.unit_count) * sizeof unit_released[0]);
+		spill.unit_released = unit_released;
+		spill.unit_count = count;
+	}
+
+	spill.unit_released[unit] += size;
+	if (spill.unit_released[unit] < SPILL_RELEASE_UNIT)
+		return 0;
+
+	if (spill.pending_count == spill.pending_max) {
+		const size_t max = spill.pending_max > 0 ? spill.pending_max * 2 : 64;
+		uint32_t *pending = realloc(spill.pending, max * sizeof pending[0]);
+
+		if (pending == NULL)
+			goto err;
+		spill.pending = pending;
+		spill.pending_max = max;
+	}
+	spill.pending[spill.pending_count ++] = unit;
+	return 0;
+
+err:
+	fprintf(stderr, "Failed to track released spill file units : %s\n", strerror(errno));
+	return -1;
+}
+
+/*
+ * Released ranges are only counted here : a unit of the file wholly
+ * released waits for spill_reclaim() to be punched
+ */
+void spill_release(const uint64_t offset, const size_t size)
+{
+	uint64_t from = offset;
+
+	if (spill.file == NULL || size == 0)
+		return;
+
+	if (offset + size > spill.size)
+		abort();
+	spill.released += size;
+
+	while (from < offset + size) {
+		const uint64_t unit = from / SPILL_RELEASE_UNIT;
+		uint64_t to = (unit + 1) * SPILL_RELEASE_UNIT;
+
+		if (to > offset + size)
+			to = offset + size;
+		if (unit_release(unit, to - from) < 0)
+			return;
+		from = to;
+	}
+}
+
+static int unit_cmp(const void *p1, const void *p2)
+{
+	const uint32_t u1 = *(const uint32_t *)p1;
+	const uint32_t u2 = *(const uint32_t *)p2;
+
+	return u1 < u2 ? -1 : u1 > u2;
+}
+
+/*
+ * The units released since the last call give their room in the file back :
+ * holes are punched there, one per run of contiguous units, and read back as
+ * zeroes
+ */
+void spill_reclaim(void)
+{
+	size_t i = 0;
+
+	if (spill.pending_count == 0)
+		return;
+
+	qsort(spill.pending, spill.pending_count, sizeof spill.pending[0], unit_cmp);
+
+	/* The last units may still sit in the stdio buffer */
+	if ((uint64_t)(spill.pending[spill.pending_count - 1] + 1) * SPILL_RELEASE_UNIT > spill.flushed) {
+		if (fflush(spill.file) != 0) {
+			fprintf(stderr, "Failed to flush spill file : %s\n", strerror(errno));
+			return;
+		}
+		spill.flushed = spill.size;
+	}
+
+	while (i < spill.pending_count) {
+		const uint64_t offset = (uint64_t)spill.pending[i] * SPILL_RELEASE_UNIT;
+		size_t count = 1;
+
+		while (i + count < spill.pending_count && spill.pending[i + count] == spill.pending[i] + count)
+			count ++;
+
+		if (fallocate(fileno(spill.file), FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, offset, count * SPILL_RELEASE_UNIT) == 0)
+			spill.reclaimed += count * SPILL_RELEASE_UNIT;
+		else if (errno != EOPNOTSUPP)
+			fprintf(stderr, "Failed to release %zdb of spill file : %s\n", count * SPILL_RELEASE_UNIT, strerror(errno));
+		i += count;
+	}
+	spill.pending_count = 0;
+}
+
+void spill_close(void)
+{
+	if (spill.map != NULL)
+		munmap(spill.map, SPILL_MAP_RESERVE);
+	if (spill.file != NULL)
+		fclose(spill.file);
+	free(spill.buffer);
+	free(spill.unit_released);
+	free(spill.pending);
+	memset(&spill, 0, sizeof spill);
+}
+
+int spill_dump(FILE *file, const int depth)
+{
+	return fprintf(file, "%*sSpilled %" PRIu64 "b, released %" PRIu64 "b, reclaimed %" PRIu64 "b, mapped %" PRIu64 " time(s)\n", depth, "", spill.size, spill.released, spill.reclaimed, spill.map_count);
+}
@@ -0,0 +1,28 @@
+
+#ifndef __spill_h_666__
+# define __spill_h_666__
+
+# include <stdio.h>
+# include <stdint.h>
+# include <stddef.h>
+
+/*
+ * Append-only temporary file receiving cold payloads once the memory budget
+ * is exceeded. Spilled data is read back through a read-only mapping of the
+ * file, which grows in place in a reserved address range : pointers returned
+ * by spill_data() stay valid until spill_close().
+ */
+# define SPILL_BUFFER_SIZE (1024 * 1024)
+# define SPILL_MAP_RESERVE (1ULL << 40)
+# define SPILL_MAP_STEP (64 * 1024 * 1024)
+# define SPILL_RELEASE_UNIT (64 * 1024)	/* Whole filesystem blocks */
+
+int spill_write(const void *data, const size_t size, uint64_t *offset_ptr);
+const uint8_t *spill_data(const uint64_t offset, const size_t size);
+void spill_release(const uint64_t offset, const size_t size);
+void spill_reclaim(void);
+void spill_close(void);
+
+int spill_dump(FILE *file, const int depth);
+
+#endif
@@ -0,0 +1,142 @@
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include "stats.h"
+#include "sketch.h"
+
+static struct {
+	uint64_t frames;
+	uint64_t bytes;
+	uint64_t tcp;
+	uint64_t udp;
+	uint64_t arp;
+	uint64_t first_ts;
+	uint64_t last_ts;
+	struct sketch_topk talker_bytes;
+	struct sketch_topk talker_packets;
+	struct sketch_topk server_ports;
+	struct sketch_topk servers;
+	struct sketch_hll server_clients[SKETCH_TOPK_CAPACITY];
+	struct sketch_hll hosts;
+	struct sketch_hll clients;
+} stats = {
+	.servers.hll = stats.server_clients,
+};
+
+static int to_server(const struct frame *frame)
+{
+	if (frame->proto_type == frame_proto_type_tcp && (frame->tcp_flags & TH_SYN) != 0)
+		return (frame->tcp_flags & TH_ACK) == 0;
+	return ntohs(frame->dest) <= ntohs(frame->source);
+}
+
+void stats_frame(const struct frame *frame, const uint32_t len)
+{
+	struct sketch_key key;
+	struct sketch_counter *counter;
+	const struct frame_addr *client;
+	const struct frame_addr *server;
+	uint64_t client_hash;
+	uint16_t port;
+
+	if (stats.frames == 0 || frame->ts < stats.first_ts)
+		stats.first_ts = frame->ts;
+	if (frame->ts > stats.last_ts)
+		stats.last_ts = frame->ts;
+	stats.frames ++;
+	stats.bytes += len;
+
+	if (frame->net_type == frame_net_type_arp) {
+		stats.arp ++;
+		return;
+	}
+
+	if (frame->proto_type == frame_proto_type_tcp)
+		stats.tcp ++;
+	else
+		stats.udp ++;
+
+	memset(&key, 0, sizeof key);
+	key.addr = frame->ip.source;
+	sketch_topk_add(&stats.talker_bytes, &key, len);
+	sketch_topk_add(&stats.talker_packets, &key, 1);
+
+	if (to_server(frame)) {
+		client = &frame->ip.source;
+		server = &frame->ip.dest;
+		port = frame->dest;
+	} else {
+		client = &frame->ip.dest;
+		server = &frame->ip.source;
+		port = frame->source;
+	}
+
+	client_hash = sketch_hash_addr(client);
+	sketch_hll_add(&stats.hosts, client_hash);
+	sketch_hll_add(&stats.hosts, sketch_hash_addr(server));
+	sketch_hll_add(&stats.clients, client_hash);
+
+	memset(&key, 0, sizeof key);
+	key.port = port;
+	sketch_topk_add(&stats.server_ports, &key, len);
+
+	key.addr = *server;
+	counter = sketch_topk_add(&stats.servers, &key, 1);
+	sketch_hll_add(&stats.server_clients[counter - stats.servers.counter], client_hash);
+}
+
+static int topk_dump(FILE *file, const int depth, const struct sketch_topk *topk, const size_t top, const char *unit)
+{
+	static const struct sketch_counter *sorted[SKETCH_TOPK_CAPACITY];
+	char str[INET6_ADDRSTRLEN];
+	size_t count;
+
+	count = sketch_topk_sorted(topk, sorted);
+	if (count > top)
+		count = top;
+
+	for (size_t i = 0 ; i < count ; i ++) {
+		const struct sketch_counter *counter = sorted[i];
+
+		fprintf(file, "%*s", depth, "");
+		if (counter->key.port == 0)
+			fprintf(file, "%s", frame_addr_ntop(&counter->key.addr, str, sizeof str));
+		else if (frame_addr_is_any(&counter->key.addr))
+			fprintf(file, "%d", ntohs(counter->key.port));
+		else if (frame_addr_is_ipv4(&counter->key.addr))
+			fprintf(file, "%s:%d", frame_addr_ntop(&counter->key.addr, str, sizeof str), ntohs(counter->key.port));
+		else
+			fprintf(file, "[%s]:%d", frame_addr_ntop(&counter->key.addr, str, sizeof str), ntohs(counter->key.port));
+
+		fprintf(file, " : %" PRIu64 "%s", counter->count, unit);
+		if (counter->error > 0)
+			fprintf(file, " (over by %" PRIu64 "%s at most)", counter->error, unit);
+		fprintf(file, ", %.1f%%", topk->total > 0 ? 100. * counter->count / topk->total : 0.);
+		if (topk->hll != NULL)
+			fprintf(file, ", ~%" PRIu64 " client(s)", sketch_hll_estimate(&topk->hll[counter - topk->counter]));
+		fprintf(file, "\n");
+	}
+
+	return 0;
+}
+
+int stats_dump(FILE *file, const int depth, const size_t top)
+{
+	fprintf(file, "%*sFrames %" PRIu64 ", %" PRIu64 "b : tcp %" PRIu64 ", udp %" PRIu64 ", arp %" PRIu64 "\n", depth, "",
+		stats.frames, stats.bytes, stats.tcp, stats.udp, stats.arp);
+	if (stats.frames > 0)
+		fprintf(file, "%*sDuration %.6fs\n", depth, "", (stats.last_ts - stats.first_ts) / 1e6);
+	fprintf(file, "%*sDistinct hosts ~%" PRIu64 ", clients ~%" PRIu64 "\n", depth, "",
+		sketch_hll_estimate(&stats.hosts), sketch_hll_estimate(&stats.clients));
+
+	fprintf(file, "%*sTop talkers by bytes sent :\n", depth, "");
+	topk_dump(file, depth + 1, &stats.talker_bytes, top, "b");
+	fprintf(file, "%*sTop talkers by packets sent :\n", depth, "");
+	topk_dump(file, depth + 1, &stats.talker_packets, top, "");
+	fprintf(file, "%*sTop server ports by bytes :\n", depth, "");
+	topk_dump(file, depth + 1, &stats.server_ports, top, "b");
+	fprintf(file, "%*sTop servers by packets :\n", depth, "");
+	topk_dump(file, depth + 1, &stats.servers, top, "");
+	return 0;
+}
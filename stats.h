@@ -0,0 +1,23 @@
+
+#ifndef __stats_h_666__
+# define __stats_h_666__
+
+# include <stdio.h>
+# include <stdint.h>
+# include "frame.h"
+
+/*
+ * Capture overview in a single pass, fed with decoded frames before any
+ * session state : top talkers by bytes and packets sent, top server ports,
+ * top servers with their distinct clients, and distinct hosts. Memory is
+ * bounded by the sketches, whatever the size of the capture.
+ *
+ * Without session state, the server is the destination of a SYN, the
+ * source of a SYN ACK, otherwise the side with the lowest port.
+ */
+# define STATS_DEFAULT_TOP 10
+
+void stats_frame(const struct frame *frame, const uint32_t len);
+int stats_dump(FILE *file, const int depth, const size_t top);
+
+#endif
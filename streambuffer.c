@@ -3,153 +3,934 @@
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
+#include <inttypes.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/random.h>
 #include "streambuffer.h"
 #include "rawprint.h"
+#include "bufpool.h"
+#include "spill.h"
+#include "lz.h"
+#include "blockstore.h"
 
-int streambuffer_init(struct streambuffer *list)
+/*
+ * Decompressed chunks, shared by all the streams : they are read from a
+ * single thread. Chunks sharing a block are cached once, under the block.
+ */
+struct cache_entry {
+	const void *key;	/* Chunk or block, NULL while unused */
+	uint8_t *data;		/* STREAMBUFFER_CHUNK_MAX bytes */
+	uint64_t used;
+};
+
+static struct {
+	struct cache_entry entry[STREAMBUFFER_CACHE_SIZE];
+	uint64_t clock;
+	uint64_t hits;
+	uint64_t misses;
+} cache;
+
+static uint8_t compress_buffer[STREAMBUFFER_CHUNK_MAX];
+
+static void cache_forget(const void *key)
+{
+	for (size_t i = 0 ; i < STREAMBUFFER_CACHE_SIZE ; i ++) {
+		if (cache.entry[i].key == key)
+			cache.entry[i].key = NULL;
+	}
+}
+
+static uint8_t *cache_data(const void *key, const uint8_t *compressed, const size_t compressed_size, const size_t size)
+{
+	struct cache_entry *lru = &cache.entry[0];
+
+	for (size_t i = 0 ; i < STREAMBUFFER_CACHE_SIZE ; i ++) {
+		struct cache_entry *entry = &cache.entry[i];
+
+		if (entry->key == key) {
+			entry->used = ++ cache.clock;
+			cache.hits ++;
+			return entry->data;
+		}
+		if (entry->used < lru->used)
+			lru = entry;
+	}
+
+	cache.misses ++;
+	if (lru->data == NULL) {
+		lru->data = bufpool_alloc(STREAMBUFFER_CHUNK_MAX);
+		if (lru->data == NULL) {
+			fprintf(stderr, "Failed to allocate a stream chunk cache entry\n");
+			goto err;
+		}
+	}
+
+	lru->key = NULL;
+	if (lz_decompress(compressed, compressed_size, lru->data, STREAMBUFFER_CHUNK_MAX) != (ssize_t)size) {
+		fprintf(stderr, "Failed to decompress a %zdb stream chunk\n", size);
+		goto err;
+	}
+
+	lru->key = key;
+	lru->used = ++ cache.clock;
+	return lru->data;
+
+err:
+	return NULL;
+}
+
+/*
+ * Bytes of a block, through the cache when compressed
+ */
+static const uint8_t *block_data(const struct blockstore_block *block)
+{
+	const uint8_t *data = blockstore_data(block);
+
+	if (data == NULL || block->compressed == 0)
+		return data;
+	return cache_data(block, data, block->compressed, block->size);
+}
+
+/*
+ * The block goes with its last reference, and so does its cached copy
+ */
+static void block_release(struct blockstore_block *block)
+{
+	if (block->refs == 1)
+		cache_forget(block);
+	blockstore_release(block);
+}
+
+void streambuffer_cache_free(void)
+{
+	for (size_t i = 0 ; i < STREAMBUFFER_CACHE_SIZE ; i ++) {
+		bufpool_free(cache.entry[i].data);
+		cache.entry[i].data = NULL;
+		cache.entry[i].key = NULL;
+	}
+}
+
+int streambuffer_init(struct streambuffer *list, struct region *region, struct streambuffer_reassembly *reassembly)
 {
 	memset(list, 0, sizeof list[0]);
+	list->region = region;
+	list->reassembly = reassembly;
 	return 0;
 }
 
+/*
+ * Payloads are released, chunks go back to their region. The list is left
+ * empty and may be used again.
+ */
 void streambuffer_free(struct streambuffer *list)
 {
-	struct streambuffer_node *node;
+	struct streambuffer_chunk *chunk = list->first;
 
-	node = list->first;
-	while (node != NULL) {
-		struct streambuffer_node *next = node->next;
-		free(node->data.buffer);
-		free(node);
-		node = next;
+	while (chunk != NULL) {
+		struct streambuffer_chunk *next = chunk->next;
+
+		if (chunk->data.block != NULL)
+			block_release(chunk->data.block);
+		else {
+			if (chunk->data.compressed != 0)
+				cache_forget(chunk);
+			if (chunk->data.buffer != NULL)
+				bufpool_free(chunk->data.buffer);
+			else
+				spill_release(chunk->data.spill_offset, chunk->data.compressed != 0 ? chunk->data.compressed : chunk->to - chunk->from + 1);
+		}
+		region_recycle(list->region, chunk, sizeof chunk[0]);
+		chunk = next;
+	}
+
+	if (list->fingerprint != NULL) {
+		fingerprint_stream_free(list->fingerprint);
+		region_recycle(list->region, list->fingerprint, sizeof list->fingerprint[0]);
 	}
+
+	streambuffer_init(list, list->region, list->reassembly);
+}
+
+/*
+ * Deduplicated chunks end with their span at the latest, compressed ones
+ * stop growing early enough to be compressed while the stream goes on
+ */
+static inline size_t chunk_max(const struct streambuffer *list)
+{
+	if (list->reassembly->dedup)
+		return FINGERPRINT_SPAN_MAX;
+	if (list->reassembly->compress)
+		return STREAMBUFFER_COMPRESS_CHUNK_MAX;
+	return STREAMBUFFER_CHUNK_MAX;
+}
+
+/*
+ * Room for a new chunk : as much as the stream holds, at least the first
+ * range. Chunks use all the room of their buffer pool class.
+ */
+static size_t chunk_capacity(const struct streambuffer *list, const size_t size)
+{
+	const size_t max = chunk_max(list);
+	const size_t held = list->size < max ? list->size : max;
+
+	return bufpool_room(size > held ? size : held);
+}
+
+/*
+ * Priorities are random : offsets come from the capture, the treap has to
+ * stay balanced whatever sequence numbers it is given
+ */
+static uint32_t tree_priority(void)
+{
+	static uint64_t state;
+
+	if (state == 0 && getrandom(&state, sizeof state, GRND_NONBLOCK) != sizeof state)
+		state = (uint64_t)time(NULL) << 32 ^ getpid();
+	state |= state == 0;
+
+	/* xorshift64* */
+	state ^= state >> 12;
+	state ^= state << 25;
+	state ^= state >> 27;
+	return (state * 0x2545f4914f6cdd1dULL) >> 32;
 }
 
-static struct streambuffer_node *node_alloc(uint8_t *data, const size_t data_offset, const size_t from, const size_t to)
+static struct streambuffer_chunk *chunk_alloc(struct streambuffer *list, const uint64_t from, const size_t capacity)
 {
-	struct streambuffer_node *node;
+	struct streambuffer_chunk *chunk;
 
-	node = calloc(1, sizeof node[0]);
-	if (node == NULL) {
-		fprintf(stderr, "Failed to allocate streambuffer_node : %s\n", strerror(errno));
+	chunk = region_alloc(list->region, sizeof chunk[0]);
+	if (chunk == NULL) {
+		fprintf(stderr, "Failed to allocate streambuffer_chunk\n");
 		goto err;
 	}
 
-	node->data.buffer = data;
-	node->data.stream = data + data_offset;
-	node->from = from;
-	node->to = to;
+	chunk->data.buffer = bufpool_alloc(capacity);
+	if (chunk->data.buffer == NULL) {
+		fprintf(stderr, "Failed to allocate a %zdb stream chunk\n", capacity);
+		goto free_err;
+	}
+
+	chunk->from = from;
+	chunk->to = from - 1;
+	chunk->capacity = capacity;
+	chunk->priority = tree_priority();
+	list->resident += capacity;
+	return chunk;
+
+free_err:
+	region_recycle(list->region, chunk, sizeof chunk[0]);
 err:
-	return node;
+	return NULL;
 }
 
-static void node_link_last(struct streambuffer *list, struct streambuffer_node *node)
+/*
+ * The buffer moves : ranges are kept as offsets in their chunk. Shrinks it
+ * as well, down to the bytes held.
+ */
+static int chunk_resize(struct streambuffer *list, struct streambuffer_chunk *chunk, const size_t capacity)
 {
-	node->next = NULL;
-	node->prev = list->last;
-	if (list->last != NULL)
-		list->last->next = node;
-	else
-		list->first = node;
-	list->last = node;
-	list->size += node->to - node->from + 1;
+	uint8_t *buffer;
+
+	buffer = bufpool_alloc(capacity);
+	if (buffer == NULL) {
+		fprintf(stderr, "Failed to resize a stream chunk to %zdb\n", capacity);
+		return -1;
+	}
+
+	memcpy(buffer, chunk->data.buffer, chunk->to - chunk->from + 1);
+	bufpool_free(chunk->data.buffer);
+	chunk->data.buffer = buffer;
+	list->resident += capacity - chunk->capacity;
+	chunk->capacity = capacity;
+	return 0;
 }
 
-static void node_link_first(struct streambuffer *list, struct streambuffer_node *node)
+/*
+ * Compressed when that saves a buffer pool class, or left raw
+ */
+static int chunk_compress(struct streambuffer *list, struct streambuffer_chunk *chunk)
 {
-	node->next = list->first;
-	node->prev = NULL;
+	struct streambuffer_reassembly *reassembly = list->reassembly;
+	const size_t size = chunk->to - chunk->from + 1;
+	uint8_t *buffer;
+	size_t compressed;
+
+	compressed = lz_compress(chunk->data.buffer, size, compress_buffer, size);
+	if (compressed == 0 || bufpool_room(compressed) >= bufpool_room(size)) {
+		reassembly->incompressible ++;
+		return 0;
+	}
+
+	buffer = bufpool_alloc(compressed);
+	if (buffer == NULL) {
+		fprintf(stderr, "Failed to allocate a %zdb compressed stream chunk\n", compressed);
+		return -1;
+	}
 
-	if (list->first != NULL)
-		list->first->prev = node;
+	memcpy(buffer, compress_buffer, compressed);
+	bufpool_free(chunk->data.buffer);
+	chunk->data.buffer = buffer;
+	chunk->data.compressed = compressed;
+	list->resident -= chunk->capacity - bufpool_room(compressed);
+	chunk->capacity = bufpool_room(compressed);
+
+	reassembly->compressed_chunks ++;
+	reassembly->compressed_in += size;
+	reassembly->compressed_out += compressed;
+	return 0;
+}
+
+/*
+ * The chunk takes the block holding the same bytes, which accounts for them
+ */
+static void chunk_share(struct streambuffer *list, struct streambuffer_chunk *chunk, struct blockstore_block *block)
+{
+	bufpool_free(chunk->data.buffer);
+	chunk->data.buffer = NULL;
+	chunk->data.compressed = 0;
+	chunk->data.block = block;
+	list->resident -= chunk->capacity;
+	chunk->capacity = 0;
+}
+
+/*
+ * Back to a buffer of its own, before its bytes change
+ */
+static int chunk_unshare(struct streambuffer *list, struct streambuffer_chunk *chunk)
+{
+	struct blockstore_block *block = chunk->data.block;
+	const size_t stored = blockstore_stored(block);
+	const uint8_t *data;
+	uint8_t *buffer;
+
+	data = blockstore_data(block);
+	if (data == NULL)
+		return -1;
+
+	buffer = bufpool_alloc(stored);
+	if (buffer == NULL) {
+		fprintf(stderr, "Failed to allocate a %zdb stream chunk\n", stored);
+		return -1;
+	}
+
+	memcpy(buffer, data, stored);
+	chunk->data.buffer = buffer;
+	chunk->data.compressed = block->compressed;
+	chunk->data.block = NULL;
+	chunk->capacity = bufpool_room(stored);
+	list->resident += chunk->capacity;
+	block_release(block);
+	return 0;
+}
+
+/*
+ * The chunk no longer grows : it shares the block of the same bytes if
+ * any, or is compressed and becomes such a block. Either way its bytes are
+ * no longer accounted to the stream.
+ */
+static int chunk_seal(struct streambuffer *list, struct streambuffer_chunk *chunk)
+{
+	struct streambuffer_reassembly *reassembly = list->reassembly;
+	const size_t size = chunk->to - chunk->from + 1;
+	int dedup = reassembly->dedup && size >= STREAMBUFFER_DEDUP_MIN;
+	struct blockstore_block *block;
+	struct fingerprint fp;
+
+	if (chunk->data.sealed)
+		return 0;
+	chunk->data.sealed = 1;
+
+	if (chunk->data.buffer == NULL)
+		return 0;
+
+	if (dedup) {
+		fingerprint_block(chunk->data.buffer, size, &fp);
+		block = blockstore_find(&fp, size);
+		if (block != NULL) {
+			const uint8_t *data = block_data(block);
+
+			if (data != NULL && memcmp(data, chunk->data.buffer, size) == 0) {
+				blockstore_take(block);
+				chunk_share(list, chunk, block);
+				return 0;
+			}
+
+			/* Same fingerprint, other bytes : the chunk stays private */
+			dedup = 0;
+		}
+	}
+
+	if (reassembly->compress && size >= STREAMBUFFER_COMPRESS_MIN && chunk_compress(list, chunk) < 0)
+		return -1;
+
+	if (dedup) {
+		/* Cut chunks may end well before their room */
+		if (chunk->data.compressed == 0 && bufpool_room(size) < chunk->capacity && chunk_resize(list, chunk, bufpool_room(size)) < 0)
+			return -1;
+
+		block = blockstore_add(&fp, chunk->data.buffer, size, chunk->data.compressed);
+		if (block == NULL)
+			return -1;
+		list->resident -= chunk->capacity;
+		chunk->data.buffer = NULL;
+		chunk->data.compressed = 0;
+		chunk->data.block = block;
+		chunk->capacity = 0;
+	}
+
+	return 0;
+}
+
+/*
+ * Iterative : down to the first node of a lower priority, which the chunk
+ * takes the place of, then split that subtree around the chunk offset
+ */
+static void tree_insert(struct streambuffer *list, struct streambuffer_chunk *chunk)
+{
+	struct streambuffer_chunk **link = &list->root;
+	struct streambuffer_chunk **left = &chunk->left;
+	struct streambuffer_chunk **right = &chunk->right;
+	struct streambuffer_chunk *node;
+
+	while (*link != NULL && (*link)->priority >= chunk->priority)
+		link = chunk->from < (*link)->from ? &(*link)->left : &(*link)->right;
+
+	node = *link;
+	*link = chunk;
+
+	while (node != NULL) {
+		if (node->from < chunk->from) {
+			*left = node;
+			left = &node->right;
+			node = node->right;
+		} else {
+			*right = node;
+			right = &node->left;
+			node = node->left;
+		}
+	}
+
+	*left = NULL;
+	*right = NULL;
+}
+
+/*
+ * Last chunk starting at or before offset, NULL if none
+ */
+static struct streambuffer_chunk *tree_find(const struct streambuffer *list, const uint64_t offset)
+{
+	struct streambuffer_chunk *found = NULL;
+	struct streambuffer_chunk *chunk = list->root;
+
+	while (chunk != NULL) {
+		if (chunk->from <= offset) {
+			found = chunk;
+			chunk = chunk->right;
+		} else
+			chunk = chunk->left;
+	}
+
+	return found;
+}
+
+/*
+ * Link an empty chunk before next, or last when next is NULL
+ */
+static void chunk_link(struct streambuffer *list, struct streambuffer_chunk *chunk, struct streambuffer_chunk *next)
+{
+	chunk->next = next;
+	chunk->prev = next != NULL ? next->prev : list->last;
+	if (chunk->prev != NULL)
+		chunk->prev->next = chunk;
 	else
-		list->last = node;
-	list->first = node;
-	list->size += node->to - node->from + 1;
+		list->first = chunk;
+	if (next != NULL)
+		next->prev = chunk;
+	else
+		list->last = chunk;
+
+	tree_insert(list, chunk);
+	list->chunk_count ++;
+	if (list->first_resident == NULL || chunk->from < list->first_resident->from)
+		list->first_resident = chunk;
+}
+
+/*
+ * Compressed chunks take new bytes through their cached copy, and are
+ * compressed again. They stay raw if that does not fit anymore : room for
+ * that is taken first, so that nothing changes if it is not there.
+ */
+static int chunk_patch(struct streambuffer *list, struct streambuffer_chunk *chunk, const uint8_t *data, const uint64_t from, const size_t size)
+{
+	const size_t chunk_size = chunk->to - chunk->from + 1;
+	uint8_t *cached = cache_data(chunk, chunk->data.buffer, chunk->data.compressed, chunk_size);
+	uint8_t *buffer;
+	size_t compressed;
+
+	if (cached == NULL)
+		return -1;
+
+	buffer = bufpool_alloc(chunk_size);
+	if (buffer == NULL) {
+		fprintf(stderr, "Failed to allocate a %zdb stream chunk\n", chunk_size);
+		return -1;
+	}
+
+	memcpy(cached + (from - chunk->from), data, size);
+
+	compressed = lz_compress(cached, chunk_size, compress_buffer, chunk_size);
+	if (compressed != 0 && bufpool_room(compressed) < bufpool_room(chunk_size)) {
+		uint8_t *smaller = bufpool_alloc(compressed);
+
+		if (smaller != NULL) {
+			bufpool_free(buffer);
+			buffer = smaller;
+		} else
+			compressed = 0;
+	} else
+		compressed = 0;
+
+	if (compressed != 0)
+		memcpy(buffer, compress_buffer, compressed);
+	else {
+		memcpy(buffer, cached, chunk_size);
+		cache_forget(chunk);
+	}
+
+	bufpool_free(chunk->data.buffer);
+	chunk->data.buffer = buffer;
+	chunk->data.compressed = compressed;
+	list->resident -= chunk->capacity;
+	chunk->capacity = bufpool_room(compressed != 0 ? compressed : chunk_size);
+	list->resident += chunk->capacity;
+	return 0;
+}
+
+/*
+ * Compare bytes received again with the stored ones, keep the first or
+ * the last value
+ */
+static int chunk_overlap(struct streambuffer *list, struct streambuffer_chunk *chunk, const uint8_t *data, const uint64_t from, const uint64_t to, int *conflict_ptr)
+{
+	struct streambuffer_reassembly *reassembly = list->reassembly;
+	const size_t size = to - from + 1;
+	const uint8_t *stored = streambuffer_chunk_data(chunk);
+	size_t diff;
+
+	reassembly->overlap_bytes += size;
+	if (stored == NULL)
+		return 0;
+	stored += from - chunk->from;
+
+	if (memcmp(stored, data, size) == 0)
+		return 0;
+
+	diff = 0;
+	for (size_t i = 0 ; i < size ; i ++)
+		diff += stored[i] != data[i];
+	reassembly->conflict_bytes += diff;
+	*conflict_ptr = 1;
+
+	if (reassembly->overlap != streambuffer_overlap_last)
+		return 0;
+	if (chunk->data.block != NULL ? chunk->data.block->buffer == NULL : chunk->data.buffer == NULL)
+		return 0;
+	if (list->fingerprint != NULL && from < list->fingerprint->size)
+		list->fingerprint_stale = 1;
+	if (chunk->data.block != NULL && chunk_unshare(list, chunk) < 0)
+		return -1;
+	if (chunk->data.compressed != 0)
+		return chunk_patch(list, chunk, data, from, size);
+	memcpy(chunk->data.buffer + (from - chunk->from), data, size);
+	return 0;
 }
 
-int streambuffer_add(struct streambuffer *list, uint8_t *data, const size_t offset, const size_t size, struct streambuffer_node **res_ptr)
+/*
+ * Hash the bytes following the hashed ones, from chunk on while they are
+ * contiguous
+ */
+static int stream_fingerprint(struct streambuffer *list, const struct streambuffer_chunk *chunk)
 {
-	struct streambuffer_node *node;
-	struct streambuffer_node *prev;
-	struct streambuffer_node *next;
-	const size_t data_from = offset;
-	const size_t data_to = offset + size - 1;
-	int hole;
+	struct fingerprint_stream *fingerprint = list->fingerprint;
+
+	if (fingerprint == NULL) {
+		fingerprint = region_alloc(list->region, sizeof fingerprint[0]);
+		if (fingerprint == NULL) {
+			fprintf(stderr, "Failed to allocate fingerprint_stream\n");
+			return -1;
+		}
+		fingerprint_stream_init(fingerprint);
+		list->fingerprint = fingerprint;
+	}
+
+	if (list->fingerprint_stale)
+		return 0;
+
+	while (chunk != NULL && chunk->from <= fingerprint->size && fingerprint->size <= chunk->to) {
+		const uint8_t *data = streambuffer_chunk_data(chunk);
+
+		if (data == NULL)
+			return -1;
+		if (fingerprint_stream_update(fingerprint, data + (fingerprint->size - chunk->from), chunk->to + 1 - fingerprint->size) < 0)
+			return -1;
+		chunk = chunk->next;
+	}
+
+	return 0;
+}
+
+/*
+ * Copy the bytes of [offset, offset + size[ not stored yet, compare the
+ * others. Returns the number of ranges stored.
+ */
+int streambuffer_add(struct streambuffer *list, const uint8_t *data, const uint64_t offset, const size_t size, streambuffer_saved_t saved, void *arg)
+{
+	struct streambuffer_chunk *chunk;
+	struct streambuffer_chunk *next;
+	const uint64_t data_to = offset + size - 1;
+	uint64_t from = offset;
+	int conflict = 0;
+	int added = 0;
 
 	/*
-	 * prev will point to the node brefore or containing this data
+	 * next is the first chunk ending at or after the segment start
 	 */
-	prev = list->last;
-	while (prev != NULL) {
-		if (data_from >= prev->from)
-			break;
-		prev = prev->prev;
+	if (list->last == NULL || offset > list->last->to)
+		next = NULL;
+	else {
+		next = tree_find(list, offset);
+		if (next == NULL)
+			next = list->first;
+		else if (next->to < offset)
+			next = next->next;
 	}
 
-	if (prev == NULL) {
+	while (from <= data_to) {
+		uint64_t to;
+		size_t room;
+		size_t count;
+		size_t cut;
+
+		if (next != NULL && next->from <= from) {
+			/* Already stored */
+			to = next->to < data_to ? next->to : data_to;
+			if (chunk_overlap(list, next, data + (from - offset), from, to, &conflict) < 0)
+				goto err;
+			next = next->next;
+			from = to + 1;
+			continue;
+		}
+
 		/*
-		 * This data comes before all known one, make it first
+		 * Hole up to the next chunk, or the segment end : extend the
+		 * chunk before it when contiguous, or start a new one
 		 */
-		node = node_alloc(data, 0, data_from, data_to);
-		if (node == NULL)
+		to = (next != NULL && next->from <= data_to) ? next->from - 1 : data_to;
+		count = to - from + 1;
+
+		chunk = next != NULL ? next->prev : list->last;
+		if (chunk != NULL && (chunk->to + 1 != from || chunk->data.buffer == NULL || chunk->data.sealed))
+			chunk = NULL;
+
+		if (chunk != NULL && chunk->to - chunk->from + 1 + count > chunk->capacity && chunk->capacity < chunk_max(list)) {
+			size_t capacity = chunk->to - chunk->from + 1 + count;
+
+			if (capacity < chunk->capacity * 3 / 2)
+				capacity = chunk->capacity * 3 / 2;
+			if (capacity > chunk_max(list))
+				capacity = chunk_max(list);
+			if (chunk_resize(list, chunk, bufpool_room(capacity)) < 0)
+				goto err;
+		}
+
+		if (chunk == NULL || chunk->to - chunk->from + 1 == chunk->capacity) {
+			size_t capacity = chunk_capacity(list, count);
+
+			/* A fill never needs more than its hole */
+			if (next != NULL && capacity > next->from - from)
+				capacity = bufpool_room(next->from - from);
+
+			chunk = chunk_alloc(list, from, capacity);
+			if (chunk == NULL)
+				goto err;
+			chunk_link(list, chunk, next);
+
+			/* The stream went on past the last chunk : a fill of the hole after it gets a chunk of its own */
+			if (next == NULL && chunk->prev != NULL && chunk_seal(list, chunk->prev) < 0)
+				goto err;
+		}
+
+		room = chunk->capacity - (chunk->to - chunk->from + 1);
+		if (count > room)
+			count = room;
+
+		memcpy(chunk->data.buffer + (from - chunk->from), data + (from - offset), count);
+
+		/* Deduplicated chunks end where their content cuts a span */
+		cut = 0;
+		if (list->reassembly->dedup) {
+			const size_t held = chunk->to - chunk->from + 1;
+
+			cut = fingerprint_span_cut(chunk->data.buffer, held, held + count);
+			if (cut != 0)
+				count = cut - held;
+		}
+
+		chunk->to += count;
+		list->size += count;
+		if (next != NULL)
+			list->reassembly->fills ++;
+		added ++;
+
+		if (saved != NULL && saved(arg, chunk, from - chunk->from, count) < 0)
+			goto err;
+		from += count;
+
+		if (list->reassembly->fingerprint && stream_fingerprint(list, chunk) < 0)
+			goto err;
+
+		/* Chunks between contiguous neighbours do not grow anymore */
+		if (chunk->prev != NULL && chunk->prev->to + 1 == chunk->from && chunk_seal(list, chunk->prev) < 0)
+			goto err;
+		if ((cut != 0 || (chunk->next != NULL && chunk->to + 1 == chunk->next->from)) && chunk_seal(list, chunk) < 0)
 			goto err;
-		node_link_first(list, node);
-		goto saved;
 	}
 
-	/*
-	 * next will point to the node after or containing this data
-	 */
-	hole = 0;
-	next = prev->next;
-	while (next != NULL) {
-		if (next->prev->to + 1 != next->from) {
-			hole ++;
-			break;
-		}
-		if (next->to >= data_to)
-			break;
-		next = next->next;
+	list->reassembly->conflicts += conflict;
+	return added;
+
+err:
+	return -1;
+}
+
+/*
+ * No more data is expected : give back the room left in the last chunk,
+ * and seal the ones still growing
+ */
+int streambuffer_seal(struct streambuffer *list)
+{
+	struct streambuffer_chunk *chunk = list->last;
+
+	if (chunk != NULL && chunk->data.buffer != NULL && !chunk->data.sealed) {
+		const size_t size = bufpool_room(chunk->to - chunk->from + 1);
+
+		if (size < chunk->capacity && chunk_resize(list, chunk, size) < 0)
+			return -1;
 	}
 
-	if (!hole && next != NULL)
-		goto already_saved; /* There is no hole, and next contains this data */
+	for (chunk = list->first_resident ; chunk != NULL ; chunk = chunk->next) {
+		if (chunk_seal(list, chunk) < 0)
+			return -1;
+	}
 
-	if (next == NULL) {
-		/*
-		 * This data comes after all known one, make it first
-		 */
-		node = node_alloc(data, 0, data_from, data_to);
-		if (node == NULL)
+	return 0;
+}
+
+int streambuffer_spill(struct streambuffer *list, size_t *released_ptr)
+{
+	struct streambuffer_chunk *chunk;
+	size_t released = 0;
+
+	for (chunk = list->first_resident ; chunk != NULL ; chunk = chunk->next) {
+		const size_t size = chunk->data.compressed != 0 ? chunk->data.compressed : chunk->to - chunk->from + 1;
+
+		/* Blocks are accounted to the store, and spilled for all their chunks */
+		if (chunk->data.block != NULL) {
+			if (blockstore_spill(chunk->data.block) < 0)
+				goto err;
+			continue;
+		}
+
+		if (chunk->data.buffer == NULL)
+			continue;
+
+		if (spill_write(chunk->data.buffer, size, &chunk->data.spill_offset) < 0)
 			goto err;
-		node_link_last(list, node);
-		goto saved;
+
+		bufpool_free(chunk->data.buffer);
+		chunk->data.buffer = NULL;
+		released += chunk->capacity;
 	}
 
-	/*
-	 * TODO:
-	 * holes and non contiguous data are not managed for now !
-	 */
-	goto err;
-
-saved:
-	if (res_ptr != NULL)
-		*res_ptr = node;
-	return 1;
-already_saved:
-	if (res_ptr != NULL)
-		*res_ptr = prev;
+	list->resident -= released;
+	list->first_resident = NULL;
+	*released_ptr = released;
 	return 0;
+
 err:
+	list->resident -= released;
+	list->first_resident = chunk;
+	*released_ptr = released;
 	return -1;
 }
 
-int streambuffer_node_dump(FILE *file, const int depth, const struct streambuffer_node *node)
+/*
+ * Compressed chunks are valid until STREAMBUFFER_CACHE_SIZE other ones are
+ * read. Raw ones are valid as long as the chunk : spilled bytes are read
+ * from a mapping which never moves.
+ */
+const uint8_t *streambuffer_chunk_data(const struct streambuffer_chunk *chunk)
+{
+	const uint8_t *data;
+
+	if (chunk->data.block != NULL)
+		return block_data(chunk->data.block);
+
+	if (chunk->data.compressed == 0) {
+		if (chunk->data.buffer != NULL)
+			return chunk->data.buffer;
+		return spill_data(chunk->data.spill_offset, chunk->to - chunk->from + 1);
+	}
+
+	data = chunk->data.buffer;
+	if (data == NULL)
+		data = spill_data(chunk->data.spill_offset, chunk->data.compressed);
+	if (data == NULL)
+		return NULL;
+	return cache_data(chunk, data, chunk->data.compressed, chunk->to - chunk->from + 1);
+}
+
+/*
+ * Fingerprint of the bytes contiguous from the stream start, NULL if the
+ * stream is not fingerprinted. Hashed bytes which took another value since
+ * are hashed again.
+ */
+const struct fingerprint_stream *streambuffer_fingerprint(struct streambuffer *list)
+{
+	if (list->fingerprint == NULL)
+		return NULL;
+
+	if (list->fingerprint_stale) {
+		fingerprint_stream_free(list->fingerprint);
+		list->fingerprint_stale = 0;
+		if (list->first != NULL && stream_fingerprint(list, list->first) < 0)
+			return NULL;
+	}
+
+	return list->fingerprint;
+}
+
+/*
+ * First chunk ending at or after offset, NULL past the end
+ */
+static const struct streambuffer_chunk *chunk_next(const struct streambuffer *list, const uint64_t offset)
+{
+	const struct streambuffer_chunk *chunk = tree_find(list, offset);
+
+	if (chunk == NULL)
+		return list->first;
+	if (chunk->to < offset)
+		return chunk->next;
+	return chunk;
+}
+
+/*
+ * Offset after the last byte, holes included
+ */
+uint64_t streambuffer_end(const struct streambuffer *list)
+{
+	return list->last != NULL ? list->last->to + 1 : 0;
+}
+
+int streambuffer_holds(const struct streambuffer *list, const uint64_t offset)
+{
+	const struct streambuffer_chunk *chunk = chunk_next(list, offset);
+
+	return chunk != NULL && chunk->from <= offset;
+}
+
+/*
+ * First offset from offset on where the streams differ : their bytes, or
+ * one holding a byte where the other has a hole or has ended. Holes of
+ * both are skipped. Returns the end of both when they do not differ.
+ */
+uint64_t streambuffer_compare(const struct streambuffer *list1, const struct streambuffer *list2, uint64_t offset, uint64_t *compared_ptr)
+{
+	uint64_t compared = 0;
+
+	for (;;) {
+		const struct streambuffer_chunk *chunk1 = chunk_next(list1, offset);
+		const struct streambuffer_chunk *chunk2 = chunk_next(list2, offset);
+		const uint64_t from1 = chunk1 == NULL ? UINT64_MAX : chunk1->from > offset ? chunk1->from : offset;
+		const uint64_t from2 = chunk2 == NULL ? UINT64_MAX : chunk2->from > offset ? chunk2->from : offset;
+		const uint8_t *data1;
+		const uint8_t *data2;
+		size_t size;
+
+		if (from1 != from2) {
+			offset = from1 < from2 ? from1 : from2;
+			break;
+		}
+		if (chunk1 == NULL)
+			break;
+		offset = from1;
+
+		/* Both stay valid : spilled raw bytes do not move, and the cache holds more than two chunks */
+		data1 = streambuffer_chunk_data(chunk1);
+		data2 = streambuffer_chunk_data(chunk2);
+		if (data1 == NULL || data2 == NULL)
+			break;
+		data1 += offset - chunk1->from;
+		data2 += offset - chunk2->from;
+
+		size = (chunk1->to < chunk2->to ? chunk1->to : chunk2->to) - offset + 1;
+		if (memcmp(data1, data2, size) != 0) {
+			while (*data1 == *data2) {
+				data1 ++;
+				data2 ++;
+				offset ++;
+				compared ++;
+			}
+			break;
+		}
+		offset += size;
+		compared += size;
+	}
+
+	*compared_ptr = compared;
+	return offset;
+}
+
+int streambuffer_holes_dump(FILE *file, const int depth, const struct streambuffer *list)
+{
+	uint64_t from = 0;
+	int done = 0;
+
+	for (const struct streambuffer_chunk *chunk = list->first ; chunk != NULL ; chunk = chunk->next) {
+		if (chunk->from > from)
+			done += fprintf(file, "%*s[%" PRIu64 " - %" PRIu64 "]\n", depth, "", from, chunk->from - 1);
+		from = chunk->to + 1;
+	}
+
+	return done;
+}
+
+int streambuffer_range_dump(FILE *file, const int depth, const struct streambuffer_chunk *chunk, const size_t offset, const size_t size)
+{
+	int done = 0;
+	const uint8_t *data = streambuffer_chunk_data(chunk);
+
+	done += fprintf(file, "%*s[%" PRIu64 " - %" PRIu64 "]\n", depth, "", chunk->from + offset, chunk->from + offset + size - 1);
+	if (data == NULL)
+		done += fprintf(file, "%*sData not available\n", depth, "");
+	else
+		done += rawprint(file, depth, data + offset, size, 8, 4);
+	return done;
+}
+
+int streambuffer_reassembly_dump(FILE *file, const int depth, const struct streambuffer_reassembly *reassembly)
 {
 	int done = 0;
-	done += fprintf(file, "%*s[%zd - %zd]\n", depth, "", node->from, node->to);
-	done += rawprint(file, depth, node->data.stream, node->to - node->from + 1, 8, 4);
+
+	done += fprintf(file, "%*sOverlap policy : %s\n", depth, "", reassembly->overlap == streambuffer_overlap_first ? "first" : "last");
+	done += fprintf(file, "%*sOverlapping %" PRIu64 "b, conflicting %" PRIu64 "b in %" PRIu64 " segment(s)\n", depth, "", reassembly->overlap_bytes, reassembly->conflict_bytes, reassembly->conflicts);
+	done += fprintf(file, "%*sHoles filled %" PRIu64 " time(s)\n", depth, "", reassembly->fills);
+	if (reassembly->compress) {
+		done += fprintf(file, "%*sCompressed %" PRIu64 " chunk(s), %" PRIu64 "b to %" PRIu64 "b, %" PRIu64 " left raw\n", depth, "", reassembly->compressed_chunks, reassembly->compressed_in, reassembly->compressed_out, reassembly->incompressible);
+		done += fprintf(file, "%*sDecompressed %" PRIu64 " chunk(s), %" PRIu64 " cache hit(s)\n", depth, "", cache.misses, cache.hits);
+	}
 	return done;
 }
 
@@ -157,8 +938,8 @@ int streambuffer_dump(FILE *file, const int depth, const struct streambuffer *li
 {
 	int done = 0;
 
-	for (const struct streambuffer_node *node = list->first ; node != NULL ; node = node->next)
-		done += streambuffer_node_dump(file, depth, node);
+	for (const struct streambuffer_chunk *chunk = list->first ; chunk != NULL ; chunk = chunk->next)
+		done += streambuffer_range_dump(file, depth, chunk, 0, chunk->to - chunk->from + 1);
 
 	return done;
 }
@@ -1,33 +1,131 @@
-
 #ifndef __streambuffer_h_666__
 # define __streambuffer_h_666__
 
 #include <stdint.h>
 #include <stddef.h>
+#include "region.h"
+#include "blockstore.h"
+
+/*
+ * Chunks hold contiguous stream bytes : in-order segments are copied at the
+ * end of the last chunk, which grows by 1.5x steps up to
+ * STREAMBUFFER_CHUNK_MAX. A new chunk starts with as much room as the stream
+ * already holds, so that bulk streams end up as a rope of large chunks.
+ * Chunks are sealed, and no longer grow, once followed by contiguous data or
+ * by a newer chunk, and when their stream is closed or the capture ends.
+ * Sealed streams give back the room left in their last chunk. Streams
+ * account for the room of their buffers, not only for the bytes held.
+ *
+ * With compression, sealed chunks are LZ compressed when that saves room.
+ * They grow up to STREAMBUFFER_COMPRESS_CHUNK_MAX only, so that streams still
+ * open are mostly compressed too. Their bytes are read back through a small
+ * LRU cache of decompressed chunks : sequential readers, dump or replay,
+ * decompress each chunk once.
+ *
+ * With deduplication, chunks also end where the gear hash of fingerprint.h
+ * cuts a span, so that streams holding the same content at other offsets
+ * still cut it the same way. Sealed chunks holding the same bytes share a
+ * single block of the block store, which accounts for them.
+ *
+ * With fingerprints, the bytes contiguous from the stream start are hashed
+ * as they are stored : two streams are compared through their fingerprint,
+ * and their spans tell from where their bytes need comparing.
+ */
+# define STREAMBUFFER_CHUNK_MAX (4 * 1024 * 1024)
+# define STREAMBUFFER_COMPRESS_MIN 256	/* Smaller chunks stay raw */
+# define STREAMBUFFER_COMPRESS_CHUNK_MAX (256 * 1024)
+# define STREAMBUFFER_DEDUP_MIN 128	/* Smaller chunks are not worth a block */
+# define STREAMBUFFER_CACHE_SIZE 4
 
 struct streambuffer_data {
-	uint8_t *buffer;
-	uint8_t *stream;
+	uint8_t *buffer;	/* NULL once spilled, or held by the block */
+	uint64_t spill_offset;
+	uint32_t compressed;	/* Size held in buffer or spilled, 0 while raw */
+	uint8_t sealed;		/* No longer grows */
+	struct blockstore_block *block;	/* Holding the bytes, NULL if private */
 };
 
-struct streambuffer_node {
-	size_t from;
-	size_t to;
+/*
+ * Stream offsets are 64-bit : sessions unwrap TCP sequence numbers, so that
+ * streams above 4GB keep their order
+ */
+struct streambuffer_chunk {
+	uint64_t from;
+	uint64_t to;
+	size_t capacity;
 	struct streambuffer_data data;
-	struct streambuffer_node *next;
-	struct streambuffer_node *prev;
+	struct streambuffer_chunk *next;
+	struct streambuffer_chunk *prev;
+	struct streambuffer_chunk *left;	/* Offset index, a treap */
+	struct streambuffer_chunk *right;
+	uint32_t priority;
+};
+
+/*
+ * Bytes received again keep their first value, or take the last one while
+ * they are resident
+ */
+enum streambuffer_overlap {
+	streambuffer_overlap_first = 0,
+	streambuffer_overlap_last,
 };
 
+/*
+ * Shared by the buffers of a session table
+ */
+struct streambuffer_reassembly {
+	enum streambuffer_overlap overlap;
+	uint64_t overlap_bytes;		/* Received again */
+	uint64_t conflict_bytes;	/* Received again with another value */
+	uint64_t conflicts;		/* Segments holding such bytes */
+	uint64_t fills;			/* Ranges stored before the end of their stream */
+	int compress;
+	int dedup;
+	int fingerprint;
+	uint64_t compressed_chunks;
+	uint64_t compressed_in;		/* Bytes of the chunks compressed */
+	uint64_t compressed_out;
+	uint64_t incompressible;	/* Chunks left raw */
+};
+
+/*
+ * Chunks never overlap and are listed in offset order, holes in between.
+ * The treap finds the chunk of an offset in O(log n), appends do not need it.
+ */
 struct streambuffer {
 	size_t size;
-	struct streambuffer_node *first;
-	struct streambuffer_node *last;
+	size_t resident;	/* Room of the buffers held in memory */
+	size_t chunk_count;
+	struct streambuffer_chunk *first;
+	struct streambuffer_chunk *last;
+	struct streambuffer_chunk *first_resident; /* Nothing to spill or seal before this one */
+	struct streambuffer_chunk *root;
+	struct region *region;	/* Chunks come from there */
+	struct streambuffer_reassembly *reassembly;
+	struct fingerprint_stream *fingerprint;	/* Allocated with the first byte hashed */
+	uint8_t fingerprint_stale;		/* Hashed bytes took another value since */
 };
 
-int streambuffer_init(struct streambuffer *st);
+/*
+ * Called for every range a segment adds, in offset order : offset is the
+ * one of the range in its chunk
+ */
+typedef int (*streambuffer_saved_t)(void *arg, const struct streambuffer_chunk *chunk, const size_t offset, const size_t size);
+
+int streambuffer_init(struct streambuffer *st, struct region *region, struct streambuffer_reassembly *reassembly);
 void streambuffer_free(struct streambuffer *list);
-int streambuffer_add(struct streambuffer *list, uint8_t *data, const size_t offset, const size_t size, struct streambuffer_node **res_ptr);
+int streambuffer_add(struct streambuffer *list, const uint8_t *data, const uint64_t offset, const size_t size, streambuffer_saved_t saved, void *arg);
+int streambuffer_seal(struct streambuffer *list);
+int streambuffer_spill(struct streambuffer *list, size_t *released_ptr);
+const uint8_t *streambuffer_chunk_data(const struct streambuffer_chunk *chunk);
+const struct fingerprint_stream *streambuffer_fingerprint(struct streambuffer *list);
+uint64_t streambuffer_end(const struct streambuffer *list);
+int streambuffer_holds(const struct streambuffer *list, const uint64_t offset);
+uint64_t streambuffer_compare(const struct streambuffer *list1, const struct streambuffer *list2, const uint64_t offset, uint64_t *compared_ptr);
+void streambuffer_cache_free(void);
 int streambuffer_dump(FILE *file, const int depth, const struct streambuffer *list);
-int streambuffer_node_dump(FILE *file, const int depth, const struct streambuffer_node *node);
+int streambuffer_holes_dump(FILE *file, const int depth, const struct streambuffer *list);
+int streambuffer_range_dump(FILE *file, const int depth, const struct streambuffer_chunk *chunk, const size_t offset, const size_t size);
+int streambuffer_reassembly_dump(FILE *file, const int depth, const struct streambuffer_reassembly *reassembly);
 
 #endif
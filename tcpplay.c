@@ -4,6 +4,7 @@
 #include <pcap/pcap.h>
 #include <string.h>
 #include <errno.h>
+#include <inttypes.h>
 #include <unistd.h>
 
 #include "decode.h"
@@ -11,19 +12,31 @@
 #include "frame_list.h"
 #include "session.h"
 #include "replayer.h"
+#include "counters.h"
+#include "pagemem.h"
+#include "bufpool.h"
+#include "reorder.h"
+#include "spill.h"
+#include "blockstore.h"
+#include "query.h"
+#include "stats.h"
 
 static int cmd_list_session(struct session_table *session_table, int ac, char **av)
 {
 	const char *type;
+	int csv;
 
 	type = NULL;
+	csv = 0;
 	for (int i = 1 ; i < ac ; i ++) {
 		if (strcmp(av[i], "-type") == 0) {
 			if (i + 1 >= ac)
 				goto no_arg;
 			type = av[i + 1];
 			i++;
-		} else {
+		} else if (strcmp(av[i], "-csv") == 0)
+			csv = 1;
+		else {
 			fprintf(stderr, "Unknown option for <%s> command : <%s>\n", av[0], av[i]);
 			goto usage;
 		}
@@ -32,18 +45,28 @@ static int cmd_list_session(struct session_table *session_table, int ac, char **
 	no_arg:
 		fprintf(stderr, "No argument for <%s> option\n", av[0]);
 	usage:
-		fprintf(stderr, "Usage : %s [-type]\n", av[0]);
+		fprintf(stderr, "Usage : %s [-type] [-csv]\n", av[0]);
 		return 1;
 	}
 
+	if (csv) {
+		session_table_csv_dump(stdout, session_table, type);
+		return 0;
+	}
+
 	printf("Session found :\n");
-	session_table_dump(stdout, 0, session_table, type, (struct in_addr){INADDR_ANY}, 0, 0);
+	session_table_dump(stdout, 0, session_table, type, NULL, 0, 0, 0);
 	return 0;
 }
 
-static int str2addr_port(const char *str, struct in_addr *addr, uint16_t *port)
+/*
+ * Accepts <ipv4:port> and <[ipv6]:port> : an IPv6 address needs its
+ * brackets, 2001:db8::5:1 is a host, not 2001:db8::5 port 1
+ */
+static int str2addr_port(const char *str, struct frame_addr *addr, uint16_t *port)
 {
-	char tmp[sizeof "255.255.255.255:65535"];
+	char tmp[sizeof "[ffff:ffff:ffff:ffff:ffff:ffff:255.255.255.255]:65535"];
+	char *host;
 	char *ptr;
 	char *end;
 	unsigned long ul;
@@ -51,17 +74,29 @@ static int str2addr_port(const char *str, struct in_addr *addr, uint16_t *port)
 	if (snprintf(tmp, sizeof tmp, "%s", str) >= (int )sizeof tmp)
 		goto err;
 
-	ptr = strchr(tmp, ':');
+	ptr = strrchr(tmp, ':');
+	if (ptr == NULL)
+		goto err;
 	*ptr = 0;
 
-	if (inet_aton(tmp, addr) != 1)
+	host = tmp;
+	if (host[0] == '[') {
+		if (ptr == host + 1 || ptr[-1] != ']')
+			goto err;
+		ptr[-1] = 0;
+		host ++;
+	} else if (strchr(host, ':') != NULL)
+		goto err;
+
+	if (frame_addr_pton(host, addr) < 0)
 		goto err;
 
+	errno = 0;
 	ul = strtoul(ptr + 1, &end, 10);
 	if (errno == EINVAL || errno == ERANGE)
 		goto err;
 
-	if (*ptr != 0 || ul >= UINT16_MAX)
+	if (*end != 0 || ul >= UINT16_MAX)
 		goto err;
 
 	*port = (uint16_t)ul;
@@ -71,15 +106,117 @@ err:
 	return -1;
 }
 
+/*
+ * Byte count, with an optional k, m or g suffix
+ */
+static int str2size(const char *str, size_t *size)
+{
+	unsigned long long ull;
+	char *end;
+	int shift = 0;
+
+	errno = 0;
+	ull = strtoull(str, &end, 0);
+	if (errno != 0 || end == str)
+		goto err;
+
+	switch (*end) {
+	case 'k': case 'K': shift = 10; end ++; break;
+	case 'm': case 'M': shift = 20; end ++; break;
+	case 'g': case 'G': shift = 30; end ++; break;
+	}
+
+	if (*end != 0 || ull > (SIZE_MAX >> shift))
+		goto err;
+
+	*size = (size_t)ull << shift;
+	return 0;
+
+err:
+	return -1;
+}
+
+/*
+ * Seconds, with an optional fraction, to microseconds
+ */
+static int str2usec(const char *str, uint64_t *usec)
+{
+	double d;
+	char *end;
+
+	errno = 0;
+	d = strtod(str, &end);
+	if (errno != 0 || end == str || *end != 0 || !(d >= 0) || d > (double)(UINT64_MAX / 1000000))
+		goto err;
+
+	*usec = (uint64_t)(d * 1000000);
+	return 0;
+
+err:
+	return -1;
+}
+
+/*
+ * The replayer only binds / connects IPv4 sockets
+ */
+static int str2ipv4_port(const char *str, struct in_addr *addr, uint16_t *port)
+{
+	struct frame_addr tmp;
+
+	if (str2addr_port(str, &tmp, port) < 0)
+		goto err;
+
+	if (!frame_addr_is_ipv4(&tmp))
+		goto err;
+
+	addr->s_addr = tmp.u32[3];
+	return 0;
+
+err:
+	return -1;
+}
+
+/*
+ * A host alone (addr, [addr6] or addr6), or a host and a port
+ */
+static int str2addr_opt_port(const char *str, struct frame_addr *addr, uint16_t *port)
+{
+	char tmp[INET6_ADDRSTRLEN + 2];
+	size_t len = strlen(str);
+
+	if (str2addr_port(str, addr, port) == 0)
+		return 0;
+
+	if (len >= sizeof tmp)
+		goto err;
+
+	if (str[0] == '[' && len > 2 && str[len - 1] == ']') {
+		memcpy(tmp, str + 1, len - 2);
+		tmp[len - 2] = 0;
+	} else
+		memcpy(tmp, str, len + 1);
+
+	if (frame_addr_pton(tmp, addr) < 0)
+		goto err;
+
+	*port = 0;
+	return 0;
+
+err:
+	return -1;
+}
+
 static int cmd_dump_session(struct session_table *session_table, int ac, char **av)
 {
 	const char *type;
 	const char *host;
-	struct in_addr addr;
+	struct frame_addr addr;
 	uint16_t port;
+	uint16_t server_port;
 
 	type = NULL;
 	host = NULL;
+	server_port = 0;
 	for (int i = 1 ; i < ac ; i ++) {
 		if (strcmp(av[i], "-type") == 0) {
 			if (i + 1 >= ac)
@@ -91,6 +228,20 @@ static int cmd_dump_session(struct session_table *session_table, int ac, char **
 				goto no_arg;
 			host = av[i + 1];
 			i++;
+		} else if (strcmp(av[i], "-port") == 0) {
+			char *end;
+			unsigned long ul;
+
+			if (i + 1 >= ac)
+				goto no_arg;
+			errno = 0;
+			ul = strtoul(av[i + 1], &end, 10);
+			if (errno != 0 || *end != 0 || ul == 0 || ul > UINT16_MAX) {
+				fprintf(stderr, "Invalid port : <%s>\n", av[i + 1]);
+				goto usage;
+			}
+			server_port = ul;
+			i++;
 		} else {
 			fprintf(stderr, "Unknown option for <%s> command : <%s>\n", av[0], av[i]);
 			goto usage;
@@ -100,25 +251,25 @@ static int cmd_dump_session(struct session_table *session_table, int ac, char **
 	no_arg:
 		fprintf(stderr, "No argument for <%s> option\n", av[0]);
 	usage:
-		fprintf(stderr, "Usage : %s [-type] [-host <addr:port>]\n", av[0]);
+		fprintf(stderr, "Usage : %s [-type] [-host <addr[:port] | [addr6][:port]>] [-port <server port>]\n", av[0]);
 		return 1;
 	}
 
 	if (host == NULL) {
-		addr.s_addr = INADDR_ANY;
+		memset(&addr, 0, sizeof addr);
 		port = 0;
-	} else if (str2addr_port(host, &addr, &port) < 0) {
+	} else if (str2addr_opt_port(host, &addr, &port) < 0) {
 		fprintf(stderr, "Invalid host : <%s>\n", host);
 		goto usage;
 	}
 
-	session_table_dump(stdout, 0, session_table, type, addr, port, 1);
+	session_table_dump(stdout, 0, session_table, type, &addr, port, server_port, 1);
 	return 0;
 }
 
 static int cmd_replay_tcp_session(struct session_table *session_table, int ac, char **av)
 {
-	struct in_addr replay_addr;
+	struct frame_addr replay_addr;
 	uint16_t replay_port;
 	struct in_addr local_addr;
 	uint16_t local_port;
@@ -126,12 +277,15 @@ static int cmd_replay_tcp_session(struct session_table *session_table, int ac, c
 	uint16_t distant_port;
 	int server_mode;
 	int interactive_mode;
+	size_t from_offset;
+	uint64_t from_time;
+	enum { from_start, from_offset_set, from_time_set } from;
 	const struct session_tcp_info *info;
 	const struct session_tcp_side *local_side;
 	struct replayer replayer;
 	int ret = 1;
 
-	replay_addr.s_addr = INADDR_ANY;
+	memset(&replay_addr, 0, sizeof replay_addr);
 	replay_port = 0;
 	local_addr.s_addr = INADDR_ANY;
 	local_port = 0;
@@ -139,6 +293,9 @@ static int cmd_replay_tcp_session(struct session_table *session_table, int ac, c
 	distant_port = 0;
 	server_mode = 0;
 	interactive_mode = 0;
+	from_offset = 0;
+	from_time = 0;
+	from = from_start;
 	for (int i = 1 ; i < ac ; i ++) {
 
 		if (strcmp(av[i], "-replay_host") == 0) {
@@ -150,20 +307,34 @@ static int cmd_replay_tcp_session(struct session_table *session_table, int ac, c
 		} else 	if (strcmp(av[i], "-local_host") == 0) {
 			if (i + 1 >= ac)
 				goto no_arg;
-			if (str2addr_port(av[i + 1], &local_addr, &local_port) < 0)
+			if (str2ipv4_port(av[i + 1], &local_addr, &local_port) < 0)
 				goto inv_arg;
 			i++;
 		} else if (strcmp(av[i], "-distant_host") == 0) {
 			if (i + 1 >= ac)
 				goto no_arg;
-			if (str2addr_port(av[i + 1], &distant_addr, &distant_port) < 0)
+			if (str2ipv4_port(av[i + 1], &distant_addr, &distant_port) < 0)
 				goto inv_arg;
 			i++;
 		} else 	if (strcmp(av[i], "-server") == 0)
 			server_mode = 1;
 		else if (strcmp(av[i], "-interactive") == 0)
 			interactive_mode ++;
-		else {
+		else if (strcmp(av[i], "-from-offset") == 0) {
+			if (i + 1 >= ac)
+				goto no_arg;
+			if (str2size(av[i + 1], &from_offset) < 0)
+				goto inv_arg;
+			from = from_offset_set;
+			i++;
+		} else if (strcmp(av[i], "-from-time") == 0) {
+			if (i + 1 >= ac)
+				goto no_arg;
+			if (str2usec(av[i + 1], &from_time) < 0)
+				goto inv_arg;
+			from = from_time_set;
+			i++;
+		} else {
 			fprintf(stderr, "Unknown option for <%s> command : <%s>\n", av[0], av[i]);
 			goto usage;
 		}
@@ -175,11 +346,11 @@ static int cmd_replay_tcp_session(struct session_table *session_table, int ac, c
 	no_arg:
 		fprintf(stderr, "No argument for <%s> option\n", av[i]);
 	usage:
-		fprintf(stderr, "Usage : %s <-replay_host <addr:port>> [-server] [-interactive] [-local_host <addr:port>] [-distant_host <addr:port>]\n", av[0]);
+		fprintf(stderr, "Usage : %s <-replay_host <addr:port | [addr6]:port>> [-server] [-interactive] [-local_host <addr:port>] [-distant_host <addr:port>] [-from-offset <bytes> | -from-time <seconds>]\n", av[0]);
 		return 1;
 	}
 
-	if (replay_port == 0 || replay_addr.s_addr == INADDR_ANY) {
+	if (replay_port == 0 || frame_addr_is_any(&replay_addr)) {
 		fprintf(stderr, "No host defined\n");
 		goto usage;
 	}
@@ -194,15 +365,33 @@ static int cmd_replay_tcp_session(struct session_table *session_table, int ac, c
 		goto usage;
 	}
 
-	info = session_table_get_tcp(session_table, replay_addr, replay_port, &local_side, NULL);
+	info = session_table_get_tcp(session_table, &replay_addr, replay_port, &local_side, NULL);
 	if (info == NULL) {
-		fprintf(stderr, "Failed to get %s:%d session\n", inet_ntoa(replay_addr), replay_port);
+		char str[INET6_ADDRSTRLEN];
+		fprintf(stderr, "Failed to get %s:%d session\n", frame_addr_ntop(&replay_addr, str, sizeof str), replay_port);
 		goto err;
 	}
 
-	if (replayer_init(&replayer, server_mode, local_addr, local_port, distant_addr, distant_port, &local_side->tx_list) < 0)
+	if (replayer_init(&replayer, server_mode, local_addr, local_port, distant_addr, distant_port, session_tcp_side_tx_list(local_side)) < 0)
 		goto err;
 
+	if (from != from_start) {
+		const struct session_tx_list *list = session_tcp_side_tx_list(local_side);
+		const size_t first = from == from_offset_set ? session_tx_list_seek_offset(list, from_offset) : session_tx_list_seek_time(list, from_time);
+		const size_t skip = from == from_offset_set && first < list->count && list->tx[first].from < from_offset ? from_offset - list->tx[first].from : 0;
+
+		if (first == list->count) {
+			if (from == from_offset_set)
+				fprintf(stderr, "Offset %zd is beyond the end of the stream\n", from_offset);
+			else
+				fprintf(stderr, "No transmission %" PRIu64 ".%06" PRIu64 "s after the first one\n", from_time / 1000000, from_time % 1000000);
+			goto replayer_deinit;
+		}
+
+		if (replayer_seek(&replayer, first, skip) < 0)
+			goto replayer_deinit;
+	}
+
 	for (;;) {
 		int idle = 0;
 #define REPLAY_INTERACTIVE_PROMPT "Press [Enter]"
@@ -236,15 +425,276 @@ err:
 	return ret;
 }
 
+static int cmd_errors(struct session_table *session_table, int ac, char **av)
+{
+	(void)session_table;
+
+	if (ac > 1) {
+		fprintf(stderr, "Unknown option for <%s> command : <%s>\n", av[0], av[1]);
+		fprintf(stderr, "Usage : %s\n", av[0]);
+		return 1;
+	}
+
+	printf("Error counters :\n");
+	counters_dump(stdout, 1);
+	printf("Last offending frames :\n");
+	counters_ring_dump(stdout, 1);
+	return 0;
+}
+
+static int cmd_mem(struct session_table *session_table, int ac, char **av)
+{
+	if (ac > 1) {
+		fprintf(stderr, "Unknown option for <%s> command : <%s>\n", av[0], av[1]);
+		fprintf(stderr, "Usage : %s\n", av[0]);
+		return 1;
+	}
+
+	printf("Payload buffers :\n");
+	bufpool_dump(stdout, 1);
+	printf("Pages :\n");
+	pagemem_dump(stdout, 1);
+	printf("Session table :\n");
+	region_dump(stdout, 1, &session_table->region);
+	printf("Session hash :\n");
+	session_table_hash_dump(stdout, 1, session_table);
+	printf("Session lifecycle :\n");
+	session_table_lifecycle_dump(stdout, 1, session_table);
+	printf("Session payloads :\n");
+	if (session_table->mem_limit > 0)
+		printf("%*sResident %zdb / %zdb, spilled %zdb\n", 1, "", session_table->resident + blockstore_held(), session_table->mem_limit, session_table->spilled + blockstore_spilled());
+	else
+		printf("%*sNo memory limit\n", 1, "");
+	spill_dump(stdout, 1);
+	printf("Reassembly :\n");
+	streambuffer_reassembly_dump(stdout, 1, &session_table->reassembly);
+	printf("Deduplication :\n");
+	blockstore_dump(stdout, 1);
+	return 0;
+}
+
+/*
+ * Options first, then the query itself
+ */
+static int cmd_query(struct session_table *session_table, int ac, char **av)
+{
+	struct query query;
+	struct query_snapshot snapshot;
+	const char *type;
+	uint32_t *rows;
+	ssize_t count;
+	int csv;
+	int i;
+
+	type = NULL;
+	csv = 0;
+	for (i = 1 ; i < ac && av[i][0] == '-' ; i ++) {
+		if (strcmp(av[i], "-type") == 0) {
+			if (i + 1 >= ac)
+				goto no_arg;
+			type = av[i + 1];
+			i++;
+		} else if (strcmp(av[i], "-csv") == 0)
+			csv = 1;
+		else {
+			fprintf(stderr, "Unknown option for <%s> command : <%s>\n", av[0], av[i]);
+			goto usage;
+		}
+		continue;
+
+	no_arg:
+		fprintf(stderr, "No argument for <%s> option\n", av[i]);
+		goto usage;
+	}
+
+	if (query_compile(&query, ac - i, av + i) < 0)
+		goto usage;
+
+	if (query_snapshot_init(&snapshot, &query, session_table, type) < 0)
+		return 1;
+
+	count = query_run(&query, &snapshot, &rows);
+	if (count < 0) {
+		query_snapshot_free(&snapshot);
+		return 1;
+	}
+
+	if (csv) {
+		session_csv_header_dump(stdout);
+		for (ssize_t row = 0 ; row < count ; row ++)
+			session_entry_csv_dump(stdout, snapshot.entry[rows[row]]);
+	} else {
+		printf("Session found : %zd / %zd\n", count, snapshot.count);
+		for (ssize_t row = 0 ; row < count ; row ++)
+			session_entry_dump(stdout, 1, snapshot.entry[rows[row]], 0);
+	}
+
+	free(rows);
+	query_snapshot_free(&snapshot);
+	return 0;
+
+usage:
+	fprintf(stderr, "Usage : %s [-type] [-csv] <query>\n", av[0]);
+	query_usage(stderr, 4);
+	return 1;
+}
+
+static int cmd_stats(struct session_table *session_table, int ac, char **av)
+{
+	size_t top = STATS_DEFAULT_TOP;
+	int i;
+
+	(void)session_table;
+
+	for (i = 1 ; i < ac ; i ++) {
+		if (strcmp(av[i], "-top") == 0) {
+			char *end;
+
+			if (i + 1 >= ac)
+				goto no_arg;
+			errno = 0;
+			top = strtoul(av[i + 1], &end, 0);
+			if (errno != 0 || *end != 0 || top == 0)
+				goto inv_arg;
+			i++;
+		} else {
+			fprintf(stderr, "Unknown option for <%s> command : <%s>\n", av[0], av[i]);
+			goto usage;
+		}
+	}
+
+	printf("Capture :\n");
+	stats_dump(stdout, 1, top);
+	return 0;
+
+no_arg:
+	fprintf(stderr, "No argument for <%s> option\n", av[i]);
+	goto usage;
+inv_arg:
+	fprintf(stderr, "Invalid argument for <%s> option\n", av[i]);
+usage:
+	fprintf(stderr, "Usage : %s [-top <n>]\n", av[0]);
+	return 1;
+}
+
+/*
+ * With -fingerprint, equal streams are told by their fingerprints, and bytes
+ * are only compared from their first different span. Streams missing the
+ * same ranges are still identical, their holes are listed.
+ */
+static void diff_streams(const char *name, const struct session_tcp_side *side1, const struct session_tcp_side *side2)
+{
+	struct streambuffer *buffer1 = side1->stream != NULL ? &side1->stream->tx_buffer : NULL;
+	struct streambuffer *buffer2 = side2->stream != NULL ? &side2->stream->tx_buffer : NULL;
+	const struct fingerprint_stream *fingerprint1;
+	const struct fingerprint_stream *fingerprint2;
+	uint64_t offset = 0;
+	uint64_t compared;
+	uint64_t end;
+
+	printf("%s : %zdb, %zdb\n", name, buffer1 != NULL ? buffer1->size : 0, buffer2 != NULL ? buffer2->size : 0);
+
+	if (buffer1 == NULL || buffer2 == NULL) {
+		printf("%*s%s\n", 1, "", buffer1 == buffer2 ? "Identical" : "First difference at offset 0");
+		return;
+	}
+
+	fingerprint1 = streambuffer_fingerprint(buffer1);
+	fingerprint2 = streambuffer_fingerprint(buffer2);
+	if (fingerprint1 != NULL && fingerprint2 != NULL) {
+		if (fingerprint1->size == buffer1->size && fingerprint2->size == buffer2->size && fingerprint_stream_equal(fingerprint1, fingerprint2)) {
+			printf("%*sIdentical fingerprints\n", 1, "");
+			return;
+		}
+		offset = fingerprint_stream_diverge(fingerprint1, fingerprint2);
+	}
+
+	end = streambuffer_compare(buffer1, buffer2, offset, &compared);
+	if (end == streambuffer_end(buffer1) && end == streambuffer_end(buffer2)) {
+		if (buffer1->size == end)
+			printf("%*sIdentical\n", 1, "");
+		else {
+			printf("%*sIdentical, with holes at :\n", 1, "");
+			streambuffer_holes_dump(stdout, 2, buffer1);
+		}
+	} else if (!streambuffer_holds(buffer1, end) || !streambuffer_holds(buffer2, end))
+		printf("%*sFirst difference at offset %" PRIu64 ", missing from the %s stream\n", 1, "", end, streambuffer_holds(buffer1, end) ? "second" : "first");
+	else
+		printf("%*sFirst difference at offset %" PRIu64 "\n", 1, "", end);
+	printf("%*sCompared %" PRIu64 "b from offset %" PRIu64 "\n", 1, "", compared, offset);
+}
+
+/*
+ * Compare two TCP sessions, each given by one of its endpoints : what both
+ * endpoints sent, then what they received
+ */
+static int cmd_diff(struct session_table *session_table, int ac, char **av)
+{
+	const struct session_tcp_side *asked[2];
+	const struct session_tcp_side *other[2];
+
+	if (ac != 3)
+		goto usage;
+
+	for (int i = 0 ; i < 2 ; i ++) {
+		struct frame_addr addr;
+		uint16_t port;
+
+		if (str2addr_port(av[i + 1], &addr, &port) < 0) {
+			fprintf(stderr, "Invalid endpoint <%s>\n", av[i + 1]);
+			goto usage;
+		}
+
+		if (session_table_get_tcp(session_table, &addr, port, &asked[i], &other[i]) == NULL) {
+			fprintf(stderr, "Failed to get %s session\n", av[i + 1]);
+			return 1;
+		}
+	}
+
+	diff_streams("Sent", asked[0], asked[1]);
+	diff_streams("Received", other[0], other[1]);
+	return 0;
+
+usage:
+	fprintf(stderr, "Usage : %s <addr:port | [addr6]:port> <addr:port | [addr6]:port>\n", av[0]);
+	return 1;
+}
+
+/*
+ * retain is what the command needs of closed sessions. Commands with a
+ * frame function get every decoded frame instead of the session stage.
+ */
 static const struct {
 	const char *name;
 	int(*fun)(struct session_table *session_table, int ac, char **av);
+	enum session_retain retain;
+	void(*frame)(const struct frame *frame, const uint32_t len);
 } cmd_table[] = {
-	{ "list", cmd_list_session },
-	{ "dump", cmd_dump_session },
-	{ "replay_tcp", cmd_replay_tcp_session },
+	{ "list", cmd_list_session, session_retain_summary, NULL },
+	{ "query", cmd_query, session_retain_summary, NULL },
+	{ "stats", cmd_stats, session_retain_none, stats_frame },
+	{ "dump", cmd_dump_session, session_retain_all, NULL },
+	{ "replay_tcp", cmd_replay_tcp_session, session_retain_all, NULL },
+	{ "diff", cmd_diff, session_retain_all, NULL },
+	{ "errors", cmd_errors, session_retain_none, NULL },
+	{ "mem", cmd_mem, session_retain_all, NULL },
 };
 
+static int process_frame(struct session_table *session_table, struct frame_table *frame_table, struct frame_node *frame_node)
+{
+	int res;
+
+	res = session_process_frame(session_table, frame_node);
+	if (res < 0)
+		goto err;
+	if (res == 0)
+		frame_node_recycle(frame_table, frame_node);
+	return 0;
+
+err:
+	return -1;
+}
+
 int main(int ac, char **av)
 {
 	pcap_t *pc;
@@ -253,36 +703,142 @@ int main(int ac, char **av)
 	decode_fun_t decode;
 	struct frame_table frame_table;
 	struct session_table session_table;
+	struct reorder reorder;
+	size_t reorder_window = REORDER_DEFAULT_WINDOW;
+	enum reorder_late_policy late_policy = reorder_late_process;
+	enum streambuffer_overlap overlap = streambuffer_overlap_first;
+	struct frame_node *frame_node;
 	int(*cmd_fun)(struct session_table *session_table, int ac, char **av) = NULL;
+	void(*cmd_frame)(const struct frame *frame, const uint32_t len) = NULL;
+	enum session_retain retain = 0;
+	uint64_t idle_timeout = 0;
+	int pagemem_flags = 0;
+	size_t max_frames = FRAME_TABLE_DEFAULT_NODES;
+	size_t mem_limit = 0;
+	int teardown = 0;
+	int compress = 0;
+	int dedup = 0;
+	int fingerprint = 0;
+	int arg;
 	int ret = 1;
 
-	if (ac < 2)
+	for (arg = 1 ; arg < ac ; arg ++) {
+		if (av[arg][0] != '-' || av[arg][1] == 0)
+			break;
+
+		if (strcmp(av[arg], "-hugepages") == 0)
+			pagemem_flags |= PAGEMEM_FLAGS_HUGE;
+		else if (strcmp(av[arg], "-teardown") == 0)
+			teardown = 1;
+		else if (strcmp(av[arg], "-compress") == 0)
+			compress = 1;
+		else if (strcmp(av[arg], "-dedup") == 0)
+			dedup = 1;
+		else if (strcmp(av[arg], "-fingerprint") == 0)
+			fingerprint = 1;
+		else if (strcmp(av[arg], "-reorder-window") == 0) {
+			char *end;
+
+			if (arg + 1 >= ac)
+				goto no_arg;
+			errno = 0;
+			reorder_window = strtoul(av[arg + 1], &end, 0);
+			if (errno != 0 || *end != 0)
+				goto inv_arg;
+			arg ++;
+		} else if (strcmp(av[arg], "-max-frames") == 0) {
+			char *end;
+
+			if (arg + 1 >= ac)
+				goto no_arg;
+			errno = 0;
+			max_frames = strtoul(av[arg + 1], &end, 0);
+			if (errno != 0 || *end != 0 || max_frames == 0 || max_frames >= FRAME_NODE_NONE)
+				goto inv_arg;
+			arg ++;
+		} else if (strcmp(av[arg], "-mem-limit") == 0) {
+			if (arg + 1 >= ac)
+				goto no_arg;
+			if (str2size(av[arg + 1], &mem_limit) < 0)
+				goto inv_arg;
+			arg ++;
+		} else if (strcmp(av[arg], "-idle-timeout") == 0) {
+			if (arg + 1 >= ac)
+				goto no_arg;
+			if (str2usec(av[arg + 1], &idle_timeout) < 0)
+				goto inv_arg;
+			arg ++;
+		} else if (strcmp(av[arg], "-retain") == 0) {
+			if (arg + 1 >= ac)
+				goto no_arg;
+			if (strcmp(av[arg + 1], "all") == 0)
+				retain = session_retain_all;
+			else if (strcmp(av[arg + 1], "summary") == 0)
+				retain = session_retain_summary;
+			else if (strcmp(av[arg + 1], "none") == 0)
+				retain = session_retain_none;
+			else
+				goto inv_arg;
+			arg ++;
+		} else if (strcmp(av[arg], "-late") == 0) {
+			if (arg + 1 >= ac)
+				goto no_arg;
+			if (strcmp(av[arg + 1], "process") == 0)
+				late_policy = reorder_late_process;
+			else if (strcmp(av[arg + 1], "drop") == 0)
+				late_policy = reorder_late_drop;
+			else
+				goto inv_arg;
+			arg ++;
+		} else if (strcmp(av[arg], "-overlap") == 0) {
+			if (arg + 1 >= ac)
+				goto no_arg;
+			if (strcmp(av[arg + 1], "first") == 0)
+				overlap = streambuffer_overlap_first;
+			else if (strcmp(av[arg + 1], "last") == 0)
+				overlap = streambuffer_overlap_last;
+			else
+				goto inv_arg;
+			arg ++;
+		} else {
+			fprintf(stderr, "Unknown option : <%s>\n", av[arg]);
+			goto usage;
+		}
+	}
+
+	if (arg >= ac)
 		goto usage;
 
-	if (strcmp(av[1], "-") != 0) {
-		from = av[1];
+	if (strcmp(av[arg], "-") != 0) {
+		from = av[arg];
 		pc = pcap_open_offline(from, errbuff);
 	} else {
 		from = "stdin";
 		pc = pcap_fopen_offline(stdin, errbuff);
 	}
 
-	if (ac >= 3) {
+	if (arg + 1 < ac) {
 		cmd_fun = NULL;
 		for (size_t i = 0 ; i < sizeof cmd_table / sizeof cmd_table[0] ; i ++) {
-			if (strcmp(av[2], cmd_table[i].name) == 0) {
+			if (strcmp(av[arg + 1], cmd_table[i].name) == 0) {
 				cmd_fun = cmd_table[i].fun;
+				cmd_frame = cmd_table[i].frame;
+				if (retain == 0)
+					retain = cmd_table[i].retain;
 				break;
 			}
 		}
 
 		if (cmd_fun == NULL) {
-			fprintf(stderr, "Unknown command : %s\n", av[2]);
+			fprintf(stderr, "Unknown command : %s\n", av[arg + 1]);
 			goto usage;
 		}
 
-	} else
+	} else {
 		cmd_fun = cmd_list_session;
+		if (retain == 0)
+			retain = session_retain_summary;
+	}
 
 	if (pc == NULL) {
 		fprintf(stderr, "Failed to open <%s> input : %s\n", from, errbuff);
@@ -293,16 +849,27 @@ int main(int ac, char **av)
 	if (decode == NULL)
 		goto close_err;
 
-	if (frame_table_init(&frame_table) < 0)
+	bufpool_set_flags(pagemem_flags);
+
+	if (frame_table_init(&frame_table, max_frames, pagemem_flags) < 0)
 		goto close_err;
 
-	if (session_table_init(&session_table) < 0)
+	if (session_table_init(&session_table, pagemem_flags) < 0)
 		goto free_frame_table_err;
+	session_table_set_mem_limit(&session_table, mem_limit);
+	session_table_set_overlap(&session_table, overlap);
+	session_table_set_compress(&session_table, compress);
+	session_table_set_dedup(&session_table, dedup);
+	session_table_set_fingerprint(&session_table, fingerprint);
+	session_table_set_lifecycle(&session_table, retain, idle_timeout);
+
+	if (reorder_init(&reorder, reorder_window, late_policy) < 0)
+		goto free_session_table_err;
 
 	for (;;) {
 		struct pcap_pkthdr *hdr;
 		const u_char *data;
-		struct frame_node *frame_node;
+		struct frame_node *out;
 		int res;
 
 		res = pcap_next_ex(pc, &hdr, &data);
@@ -313,45 +880,117 @@ int main(int ac, char **av)
 
 		if (res == -1) {
 			fprintf(stderr, "Failed to read from <%s> : %s", from, pcap_geterr(pc));
-			goto free_session_table_err;
+			goto free_reorder_err;
 		}
 
 		if (res != 1)
 			abort();
 
+		counters_set_packet(&hdr->ts, data, hdr->caplen);
+
 		if (hdr->caplen < hdr->len) {
-			fprintf(stderr, "Packet was not fully captured\n");
+			counters_error(counter_pcap_truncated, "Packet was not fully captured\n");
 			continue;
 		}
 
 		frame_node = frame_node_new(&frame_table, &hdr->ts);
 		if (frame_node == NULL)
-			goto free_session_table_err;
+			goto free_reorder_err;
 
-		if (decode(&frame_node->frame, 0, data, hdr->len, NULL) >= 0) {
-			int res;
+		if (decode(&frame_node->frame, 0, data, hdr->len, frame_node_cold(&frame_table, frame_node)) < 0) {
+			frame_node_recycle(&frame_table, frame_node);
+			continue;
+		}
 
-			res = session_process_frame(&session_table, &frame_table.used_list, frame_node);
-			if (res < 0)
-				goto free_session_table_err;
-			if (res == 0)
-				frame_node_recycle(&frame_table, frame_node);
+		if (cmd_frame != NULL) {
+			cmd_frame(&frame_node->frame, hdr->len);
+			frame_node_recycle(&frame_table, frame_node);
+			continue;
 		}
+
+		switch (reorder_push(&reorder, frame_node, &out)) {
+		case reorder_buffered:
+			break;
+
+		case reorder_drop:
+			counters_error(counter_reorder_late, "Frame older than the reorder window dropped\n");
+			frame_node_recycle(&frame_table, out);
+			break;
+
+		case reorder_late:
+			counters_error(counter_reorder_late, "Frame older than the reorder window processed out of order\n");
+			if (process_frame(&session_table, &frame_table, out) < 0)
+				goto free_reorder_err;
+			break;
+
+		case reorder_emit:
+			if (out != frame_node) {
+				const struct timeval ts = frame_ts(&out->frame);
+				counters_set_packet(&ts, NULL, 0); /* Raw data is gone */
+			}
+
+			if (process_frame(&session_table, &frame_table, out) < 0)
+				goto free_reorder_err;
+			break;
+		}
+	}
+
+	while ((frame_node = reorder_flush(&reorder)) != NULL) {
+		const struct timeval ts = frame_ts(&frame_node->frame);
+
+		counters_set_packet(&ts, NULL, 0);
+		if (process_frame(&session_table, &frame_table, frame_node) < 0)
+			goto free_reorder_err;
 	}
+	if (session_table_seal(&session_table) < 0)
+		goto free_reorder_err;
+
+	if (counters_total() > 0 && cmd_fun != cmd_errors) {
+		fprintf(stderr, "Frames with errors :\n");
+		counters_dump(stderr, 1);
+	}
+
+	ret = cmd_fun(&session_table, ac - arg - 1, av + arg + 1);
 
-	ret = cmd_fun(&session_table, ac - 2, av + 2);
+	/*
+	 * Everything goes away with the process : unless asked (to check for
+	 * leaks), do not walk every session only to release it
+	 */
+	if (!teardown)
+		exit(ret);
 
+free_reorder_err:
+	reorder_free(&reorder);
 free_session_table_err:
 	session_table_free(&session_table);
 free_frame_table_err:
 	frame_table_free(&frame_table);
+	bufpool_destroy();
 close_err:
 	pcap_close(pc);
 err:
 	return ret;
 
+no_arg:
+	fprintf(stderr, "No argument for <%s> option\n", av[arg]);
+	goto usage;
+inv_arg:
+	fprintf(stderr, "Invalid argument for <%s> option\n", av[arg]);
 usage:
-	fprintf(stderr, "Usage: %s < file.pcap | - > [ cmd [ options ] ]\n", av[0]);
+	fprintf(stderr, "Usage: %s [ options ] < file.pcap | - > [ cmd [ options ] ]\n", av[0]);
+	fprintf(stderr, "options:\n");
+	fprintf(stderr, "%*s-hugepages : back frames and payloads with huge pages\n", 4, "");
+	fprintf(stderr, "%*s-teardown : release all the memory before exiting\n", 4, "");
+	fprintf(stderr, "%*s-reorder-window <n> : reorder frames on their timestamp within n frames (%d)\n", 4, "", REORDER_DEFAULT_WINDOW);
+	fprintf(stderr, "%*s-max-frames <n> : frames held at once, by the reorder window and the sessions (%d)\n", 4, "", FRAME_TABLE_DEFAULT_NODES);
+	fprintf(stderr, "%*s-mem-limit <size[k|m|g]> : move the payloads of the coldest sessions to a temporary file above this size\n", 4, "");
+	fprintf(stderr, "%*s-late <process | drop> : frames older than the window are processed out of order, or dropped\n", 4, "");
+	fprintf(stderr, "%*s-compress : compress the stream data kept in memory\n", 4, "");
+	fprintf(stderr, "%*s-dedup : keep stream data repeated across sessions once\n", 4, "");
+	fprintf(stderr, "%*s-fingerprint : hash streams as they are reassembled, for dump and diff\n", 4, "");
+	fprintf(stderr, "%*s-overlap <first | last> : bytes received again keep their first or last value\n", 4, "");
+	fprintf(stderr, "%*s-idle-timeout <seconds> : close sessions without frames for this long, in capture time\n", 4, "");
+	fprintf(stderr, "%*s-retain <all | summary | none> : what is kept of closed sessions (depends on the command)\n", 4, "");
 	fprintf(stderr, "cmd:\n");
 	for (size_t i = 0 ; i < sizeof cmd_table / sizeof cmd_table[0] ; i ++)
 		fprintf(stderr, "%*s%s\n", 4, "", cmd_table[i].name);
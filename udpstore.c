@@ -0,0 +1,165 @@
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "udpstore.h"
+#include "spill.h"
+
+enum {
+	store_min_count = 16,
+	store_min_arena = 1024,
+};
+
+int udpstore_init(struct udpstore *store)
+{
+	memset(store, 0, sizeof store[0]);
+	return 0;
+}
+
+void udpstore_free(struct udpstore *store)
+{
+	for (size_t i = 0 ; i < store->extent_count ; i ++) {
+		const uint64_t to = i + 1 < store->extent_count ? store->extent[i + 1].from : store->arena_base;
+
+		spill_release(store->extent[i].spill_offset, to - store->extent[i].from);
+	}
+
+	free(store->ts);
+	free(store->ref);
+	free(store->arena);
+	free(store->extent);
+	memset(store, 0, sizeof store[0]);
+}
+
+static int store_extend(struct udpstore *store)
+{
+	const size_t max = store->max > 0 ? store->max * 2 : store_min_count;
+	uint64_t *ts;
+	struct udpstore_ref *ref;
+
+	ts = realloc(store->ts, max * sizeof ts[0]);
+	if (ts == NULL)
+		goto err;
+	store->ts = ts;
+
+	ref = realloc(store->ref, max * sizeof ref[0]);
+	if (ref == NULL)
+		goto err;
+	store->ref = ref;
+
+	store->max = max;
+	return 0;
+
+err:
+	fprintf(stderr, "Failed to extend UDP store to %zd datagrams : %s\n", max, strerror(errno));
+	return -1;
+}
+
+static int arena_extend(struct udpstore *store, const size_t size)
+{
+	size_t max = store->arena_max > 0 ? store->arena_max : store_min_arena;
+	uint8_t *arena;
+
+	while (max < store->arena_size + size)
+		max *= 2;
+
+	arena = realloc(store->arena, max);
+	if (arena == NULL) {
+		fprintf(stderr, "Failed to extend UDP store arena to %zdb : %s\n", max, strerror(errno));
+		goto err;
+	}
+
+	store->arena = arena;
+	store->arena_max = max;
+	return 0;
+
+err:
+	return -1;
+}
+
+int udpstore_add(struct udpstore *store, const uint64_t ts, const int side, const uint8_t *data, const size_t size)
+{
+	struct udpstore_ref *ref;
+
+	if (size > UINT16_MAX) {
+		fprintf(stderr, "Unexpected UDP datagram size : %zd\n", size);
+		goto err;
+	}
+
+	if (store->count >= store->max && store_extend(store) < 0)
+		goto err;
+
+	if (store->arena_size + size > store->arena_max && arena_extend(store, size) < 0)
+		goto err;
+
+	ref = &store->ref[store->count];
+	ref->offset = store->arena_base + store->arena_size;
+	ref->side = side;
+	ref->size = size;
+	store->ts[store->count] = ts;
+
+	if (size > 0)
+		memcpy(store->arena + store->arena_size, data, size);
+	store->arena_size += size;
+	store->count ++;
+	return 0;
+
+err:
+	return -1;
+}
+
+int udpstore_spill(struct udpstore *store, size_t *released_ptr)
+{
+	struct udpstore_extent *extent;
+
+	*released_ptr = 0;
+	if (store->arena_size == 0)
+		return 0;
+
+	extent = realloc(store->extent, (store->extent_count + 1) * sizeof extent[0]);
+	if (extent == NULL) {
+		fprintf(stderr, "Failed to extend UDP store extents : %s\n", strerror(errno));
+		goto err;
+	}
+	store->extent = extent;
+
+	extent = &store->extent[store->extent_count];
+	extent->from = store->arena_base;
+	if (spill_write(store->arena, store->arena_size, &extent->spill_offset) < 0)
+		goto err;
+	store->extent_count ++;
+
+	*released_ptr = store->arena_size;
+	store->arena_base += store->arena_size;
+	free(store->arena);
+	store->arena = NULL;
+	store->arena_size = 0;
+	store->arena_max = 0;
+	return 0;
+
+err:
+	return -1;
+}
+
+const uint8_t *udpstore_data(const struct udpstore *store, const size_t idx)
+{
+	const struct udpstore_ref *ref = &store->ref[idx];
+	size_t low = 0;
+	size_t high = store->extent_count;
+
+	if (ref->offset >= store->arena_base)
+		return store->arena + (ref->offset - store->arena_base);
+
+	/* Last extent starting at or before the datagram */
+	while (high - low > 1) {
+		const size_t mid = (low + high) / 2;
+		if (store->extent[mid].from <= ref->offset)
+			low = mid;
+		else
+			high = mid;
+	}
+
+	return spill_data(store->extent[low].spill_offset + (ref->offset - store->extent[low].from), ref->size);
+}
@@ -0,0 +1,48 @@
+
+#ifndef __udpstore_h_666__
+# define __udpstore_h_666__
+
+# include <stdint.h>
+# include <stddef.h>
+# include <sys/time.h>
+
+/*
+ * Columnar store of the datagrams of a UDP session : capture times in one
+ * array, payload references in another, and the payloads themselves
+ * appended to a single arena
+ */
+struct udpstore_ref {
+	uint64_t offset : 47;	/* Since the first datagram of the session */
+	uint64_t side : 1;	/* 0 if sent by side1, 1 if sent by side2 */
+	uint64_t size : 16;
+};
+
+/*
+ * Part of the payloads moved to the spill file : it goes from offset "from"
+ * up to the next extent, or up to arena_base for the last one
+ */
+struct udpstore_extent {
+	uint64_t from;
+	uint64_t spill_offset;
+};
+
+struct udpstore {
+	size_t count;
+	size_t max;
+	uint64_t *ts;		/* Capture time (us) */
+	struct udpstore_ref *ref;
+	uint64_t arena_base;	/* Offset of arena[0], anything below is spilled */
+	uint8_t *arena;
+	size_t arena_size;
+	size_t arena_max;
+	struct udpstore_extent *extent;
+	size_t extent_count;
+};
+
+int udpstore_init(struct udpstore *store);
+void udpstore_free(struct udpstore *store);
+int udpstore_add(struct udpstore *store, const uint64_t ts, const int side, const uint8_t *data, const size_t size);
+int udpstore_spill(struct udpstore *store, size_t *released_ptr);
+const uint8_t *udpstore_data(const struct udpstore *store, const size_t idx);
+
+#endif